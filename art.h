@@ -0,0 +1,1185 @@
+#ifndef ART_H
+#define ART_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * An adaptive radix tree (ART) map from byte strings to values, with
+ * the insert/remove/find and ordered iterator interface of
+ * BinarySearchTree.
+ *
+ * A lookup walks one inner node per key byte instead of comparing whole
+ * keys at every level, so it costs O(key length) whatever the size of
+ * the map, and long shared prefixes (URLs, paths) are not compared over
+ * and over. Inner nodes come in four sizes, Node4, Node16, Node48 and
+ * Node256, and grow or shrink as children come and go. Chains of
+ * single-child nodes are collapsed into a prefix stored in the node
+ * below (path compression).
+ *
+ * Keys are std::string used as byte strings: embedded NULs are fine and
+ * order is by unsigned byte, which matches std::string's operator<. A
+ * key that is a prefix of another ends at an inner node, and its leaf
+ * hangs off that node's terminal slot, which sorts before the children.
+ *
+ * Leaves are kept on a doubly linked list in key order, so iterators
+ * step in O(1) and --end() reaches the largest key.
+ */
+template <typename Value>
+class ArtMap
+{
+public:
+    typedef std::string Key;
+
+    ArtMap();
+    ~ArtMap();
+    void insert(const std::pair<const std::string, Value>& keyValuePair);
+    void remove(const std::string& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    size_t memoryBytes() const;
+
+protected:
+    enum NodeType { LEAF, NODE4, NODE16, NODE48, NODE256 };
+
+    struct NodeBase
+    {
+        explicit NodeBase(unsigned char t) : type(t) { }
+        unsigned char type;
+    };
+
+    struct Leaf : NodeBase
+    {
+        Leaf(const std::string& key, const Value& value) :
+            NodeBase(LEAF), item(key, value), prev(NULL), next(NULL) { }
+        std::pair<const std::string, Value> item;
+        Leaf* prev;
+        Leaf* next;
+    };
+
+    // count is the number of children; the terminal leaf is extra
+    struct Inner : NodeBase
+    {
+        explicit Inner(unsigned char t) : NodeBase(t), count(0), terminal(NULL) { }
+        unsigned short count;
+        Leaf* terminal;
+        std::string prefix;
+    };
+
+    // Node4 and Node16 keep their key bytes sorted
+    struct Node4 : Inner
+    {
+        Node4() : Inner(NODE4) { }
+        unsigned char keys[4];
+        NodeBase* children[4];
+    };
+
+    struct Node16 : Inner
+    {
+        Node16() : Inner(NODE16) { }
+        unsigned char keys[16];
+        NodeBase* children[16];
+    };
+
+    // index[b] is 1 + the slot of byte b's child, or 0 if there is none
+    struct Node48 : Inner
+    {
+        Node48() : Inner(NODE48)
+        {
+            std::memset(index, 0, sizeof(index));
+            std::memset(children, 0, sizeof(children));
+        }
+        unsigned char index[256];
+        NodeBase* children[48];
+    };
+
+    struct Node256 : Inner
+    {
+        Node256() : Inner(NODE256)
+        {
+            std::memset(children, 0, sizeof(children));
+        }
+        NodeBase* children[256];
+    };
+
+    /**
+    * Shared by the map and its iterators, like BinarySearchTree's
+    * TreeHeader: the ends of the leaf list and the key count.
+    */
+    struct Header
+    {
+        Leaf* head;
+        Leaf* tail;
+        size_t count;
+    };
+
+public:
+    class const_iterator;
+
+    /**
+    * Walks the items in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const std::string, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const std::string, Value>* pointer;
+        typedef std::pair<const std::string, Value>& reference;
+
+        iterator();
+
+        std::pair<const std::string, Value>& operator*() const;
+        std::pair<const std::string, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class ArtMap<Value>;
+        friend class const_iterator;
+        iterator(Leaf* leaf, const Header* header);
+        Leaf* current_;
+        const Header* header_;
+    };
+
+    /**
+    * Like iterator, but gives read-only access to the items.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const std::string, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const std::string, Value>* pointer;
+        typedef const std::pair<const std::string, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const std::string, Value>& operator*() const;
+        const std::pair<const std::string, Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        Leaf* current_;
+        const Header* header_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    iterator find(const std::string& key) const;
+    Value& operator[](const std::string& key);
+    Value const & operator[](const std::string& key) const;
+
+protected:
+    Leaf* findLeaf(const std::string& key) const;
+    static NodeBase** childSlot(Inner* n, unsigned char c);
+    static NodeBase* childAfter(const Inner* n, int& c);
+    static NodeBase* childBefore(const Inner* n, int& c);
+    static Leaf* minLeaf(NodeBase* node);
+    static Leaf* maxLeaf(NodeBase* node);
+    static void attach(Node4* n, Leaf* leaf, size_t depth);
+    static void addChild(NodeBase*& ref, Inner* n, unsigned char c, NodeBase* child);
+    static void removeChild(Inner* n, unsigned char c);
+    static void shrink(NodeBase*& ref);
+    static Inner* grow(Inner* n);
+    static void freeNode(NodeBase* node);
+    static void freeSubtree(NodeBase* node);
+    static size_t subtreeBytes(const NodeBase* node);
+    void linkBefore(Leaf* leaf, Leaf* next);
+    void unlink(Leaf* leaf);
+
+    NodeBase* root_;
+    Header header_;
+
+private:
+    ArtMap(const ArtMap&);
+    ArtMap& operator=(const ArtMap&);
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the ArtMap::iterator class.
+  --------------------------------------------------
+*/
+
+template<typename Value>
+ArtMap<Value>::iterator::iterator() :
+    current_(NULL), header_(NULL)
+{
+
+}
+
+template<typename Value>
+ArtMap<Value>::iterator::iterator(Leaf* leaf, const Header* header) :
+    current_(leaf), header_(header)
+{
+
+}
+
+template<typename Value>
+std::pair<const std::string, Value>&
+ArtMap<Value>::iterator::operator*() const
+{
+    return current_->item;
+}
+
+template<typename Value>
+std::pair<const std::string, Value>*
+ArtMap<Value>::iterator::operator->() const
+{
+    return &(current_->item);
+}
+
+template<typename Value>
+bool ArtMap<Value>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Value>
+bool ArtMap<Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Value>
+typename ArtMap<Value>::iterator&
+ArtMap<Value>::iterator::operator++()
+{
+    current_ = current_->next;
+    return *this;
+}
+
+template<typename Value>
+typename ArtMap<Value>::iterator
+ArtMap<Value>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves back one item; decrementing end() gives the largest item.
+*/
+template<typename Value>
+typename ArtMap<Value>::iterator&
+ArtMap<Value>::iterator::operator--()
+{
+    current_ = (current_ == NULL) ? header_->tail : current_->prev;
+    return *this;
+}
+
+template<typename Value>
+typename ArtMap<Value>::iterator
+ArtMap<Value>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the ArtMap::iterator class.
+  ------------------------------------------------
+*/
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the ArtMap::const_iterator class.
+  --------------------------------------------------------
+*/
+
+template<typename Value>
+ArtMap<Value>::const_iterator::const_iterator() :
+    current_(NULL), header_(NULL)
+{
+
+}
+
+/**
+* Converts a mutable iterator into a read-only one.
+*/
+template<typename Value>
+ArtMap<Value>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_), header_(it.header_)
+{
+
+}
+
+template<typename Value>
+const std::pair<const std::string, Value>&
+ArtMap<Value>::const_iterator::operator*() const
+{
+    return current_->item;
+}
+
+template<typename Value>
+const std::pair<const std::string, Value>*
+ArtMap<Value>::const_iterator::operator->() const
+{
+    return &(current_->item);
+}
+
+template<typename Value>
+bool ArtMap<Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Value>
+bool ArtMap<Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Value>
+typename ArtMap<Value>::const_iterator&
+ArtMap<Value>::const_iterator::operator++()
+{
+    current_ = current_->next;
+    return *this;
+}
+
+template<typename Value>
+typename ArtMap<Value>::const_iterator
+ArtMap<Value>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+template<typename Value>
+typename ArtMap<Value>::const_iterator&
+ArtMap<Value>::const_iterator::operator--()
+{
+    current_ = (current_ == NULL) ? header_->tail : current_->prev;
+    return *this;
+}
+
+template<typename Value>
+typename ArtMap<Value>::const_iterator
+ArtMap<Value>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the ArtMap::const_iterator class.
+  ------------------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the ArtMap class.
+  -------------------------------------------
+*/
+
+template<typename Value>
+ArtMap<Value>::ArtMap() :
+    root_(NULL)
+{
+    header_.head = NULL;
+    header_.tail = NULL;
+    header_.count = 0;
+}
+
+template<typename Value>
+ArtMap<Value>::~ArtMap()
+{
+    clear();
+}
+
+/**
+* Inserts the key, or overwrites its value if it is already present.
+*/
+template<typename Value>
+void ArtMap<Value>::insert(const std::pair<const std::string, Value>& keyValuePair)
+{
+    const std::string& key = keyValuePair.first;
+    NodeBase** ref = &root_;
+    size_t depth = 0;
+    for(;;){
+        NodeBase* node = *ref;
+        if(node == NULL){
+            // only an empty map has a NULL link to follow
+            Leaf* leaf = new Leaf(key, keyValuePair.second);
+            *ref = leaf;
+            linkBefore(leaf, NULL);
+            return;
+        }
+
+        if(node->type == LEAF){
+            Leaf* old = static_cast<Leaf*>(node);
+            const std::string& oldKey = old->item.first;
+            if(oldKey == key){
+                old->item.second = keyValuePair.second;
+                return;
+            }
+            // both keys go under a new Node4 holding their common bytes
+            size_t limit = std::min(key.size(), oldKey.size());
+            size_t common = 0;
+            while(depth + common < limit && key[depth + common] == oldKey[depth + common]){
+                common++;
+            }
+            Node4* n = new Node4();
+            n->prefix.assign(key, depth, common);
+            Leaf* leaf = new Leaf(key, keyValuePair.second);
+            attach(n, old, depth + common);
+            attach(n, leaf, depth + common);
+            *ref = n;
+            linkBefore(leaf, (key < oldKey) ? old : old->next);
+            return;
+        }
+
+        Inner* n = static_cast<Inner*>(node);
+        size_t p = 0;
+        while(p < n->prefix.size() && depth + p < key.size() && n->prefix[p] == key[depth + p]){
+            p++;
+        }
+        if(p < n->prefix.size()){
+            // the key leaves the compressed path: split the prefix at p
+            Node4* top = new Node4();
+            top->prefix.assign(n->prefix, 0, p);
+            unsigned char c = static_cast<unsigned char>(n->prefix[p]);
+            n->prefix.erase(0, p + 1);
+            top->keys[0] = c;
+            top->children[0] = n;
+            top->count = 1;
+            Leaf* leaf = new Leaf(key, keyValuePair.second);
+            attach(top, leaf, depth + p);
+            *ref = top;
+            // every key under n has byte c at depth + p
+            if(depth + p == key.size() || static_cast<unsigned char>(key[depth + p]) < c){
+                linkBefore(leaf, minLeaf(n));
+            }
+            else{
+                linkBefore(leaf, maxLeaf(n)->next);
+            }
+            return;
+        }
+
+        depth += n->prefix.size();
+        if(depth == key.size()){
+            if(n->terminal != NULL){
+                n->terminal->item.second = keyValuePair.second;
+                return;
+            }
+            Leaf* leaf = new Leaf(key, keyValuePair.second);
+            linkBefore(leaf, minLeaf(n));
+            n->terminal = leaf;
+            return;
+        }
+
+        unsigned char c = static_cast<unsigned char>(key[depth]);
+        NodeBase** child = childSlot(n, c);
+        if(child != NULL){
+            ref = child;
+            depth++;
+            continue;
+        }
+        // new leaf beside its neighbours in this node
+        Leaf* leaf = new Leaf(key, keyValuePair.second);
+        int b = c;
+        NodeBase* below = childBefore(n, b);
+        Leaf* prev = (below != NULL) ? maxLeaf(below) : n->terminal;
+        if(prev != NULL){
+            linkBefore(leaf, prev->next);
+        }
+        else{
+            b = c;
+            linkBefore(leaf, minLeaf(childAfter(n, b)));
+        }
+        addChild(*ref, n, c, leaf);
+        return;
+    }
+}
+
+/**
+* Removes the key if present. Nodes left with one entry are merged into
+* the link above them, and underfull nodes shrink to the next size down.
+*/
+template<typename Value>
+void ArtMap<Value>::remove(const std::string& key)
+{
+    NodeBase** ref = &root_;
+    NodeBase** parentRef = NULL;
+    unsigned char parentByte = 0;
+    size_t depth = 0;
+    while(*ref != NULL){
+        NodeBase* node = *ref;
+        if(node->type == LEAF){
+            Leaf* leaf = static_cast<Leaf*>(node);
+            if(!(leaf->item.first == key)){
+                return;
+            }
+            unlink(leaf);
+            delete leaf;
+            if(parentRef == NULL){
+                root_ = NULL;
+            }
+            else{
+                removeChild(static_cast<Inner*>(*parentRef), parentByte);
+                shrink(*parentRef);
+            }
+            return;
+        }
+
+        Inner* n = static_cast<Inner*>(node);
+        size_t plen = n->prefix.size();
+        if(key.size() - depth < plen || key.compare(depth, plen, n->prefix) != 0){
+            return;
+        }
+        depth += plen;
+        if(depth == key.size()){
+            if(n->terminal != NULL){
+                unlink(n->terminal);
+                delete n->terminal;
+                n->terminal = NULL;
+                shrink(*ref);
+            }
+            return;
+        }
+        unsigned char c = static_cast<unsigned char>(key[depth]);
+        NodeBase** child = childSlot(n, c);
+        if(child == NULL){
+            return;
+        }
+        parentRef = ref;
+        parentByte = c;
+        ref = child;
+        depth++;
+    }
+}
+
+template<typename Value>
+void ArtMap<Value>::clear()
+{
+    freeSubtree(root_);
+    root_ = NULL;
+    header_.head = NULL;
+    header_.tail = NULL;
+    header_.count = 0;
+}
+
+template<typename Value>
+bool ArtMap<Value>::empty() const
+{
+    return header_.count == 0;
+}
+
+template<typename Value>
+size_t ArtMap<Value>::size() const
+{
+    return header_.count;
+}
+
+/**
+* Bytes held by nodes, leaves and prefixes, counting keys stored
+* inline in a std::string as part of their leaf.
+*/
+template<typename Value>
+size_t ArtMap<Value>::memoryBytes() const
+{
+    return subtreeBytes(root_);
+}
+
+template<typename Value>
+typename ArtMap<Value>::iterator ArtMap<Value>::begin() const
+{
+    return iterator(header_.head, &header_);
+}
+
+template<typename Value>
+typename ArtMap<Value>::iterator ArtMap<Value>::end() const
+{
+    return iterator(NULL, &header_);
+}
+
+template<typename Value>
+typename ArtMap<Value>::const_iterator ArtMap<Value>::cbegin() const
+{
+    return begin();
+}
+
+template<typename Value>
+typename ArtMap<Value>::const_iterator ArtMap<Value>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns an iterator to the key, or end() if it is not present.
+*/
+template<typename Value>
+typename ArtMap<Value>::iterator ArtMap<Value>::find(const std::string& key) const
+{
+    return iterator(findLeaf(key), &header_);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Value>
+Value& ArtMap<Value>::operator[](const std::string& key)
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == NULL) throw std::out_of_range("Invalid key");
+    return leaf->item.second;
+}
+
+template<typename Value>
+Value const & ArtMap<Value>::operator[](const std::string& key) const
+{
+    Leaf* leaf = findLeaf(key);
+    if(leaf == NULL) throw std::out_of_range("Invalid key");
+    return leaf->item.second;
+}
+
+/**
+* Follows the key byte by byte. Bytes before depth have all matched on
+* the way down, so a leaf only needs the rest of its key compared.
+*/
+template<typename Value>
+typename ArtMap<Value>::Leaf* ArtMap<Value>::findLeaf(const std::string& key) const
+{
+    NodeBase* node = root_;
+    size_t depth = 0;
+    while(node != NULL){
+        if(node->type == LEAF){
+            Leaf* leaf = static_cast<Leaf*>(node);
+            const std::string& k = leaf->item.first;
+            if(k.size() == key.size() &&
+               std::memcmp(k.data() + depth, key.data() + depth, key.size() - depth) == 0){
+                return leaf;
+            }
+            return NULL;
+        }
+        Inner* n = static_cast<Inner*>(node);
+        size_t plen = n->prefix.size();
+        if(key.size() - depth < plen ||
+           std::memcmp(key.data() + depth, n->prefix.data(), plen) != 0){
+            return NULL;
+        }
+        depth += plen;
+        if(depth == key.size()){
+            return n->terminal;
+        }
+        NodeBase** child = childSlot(n, static_cast<unsigned char>(key[depth]));
+        if(child == NULL){
+            return NULL;
+        }
+        node = *child;
+        depth++;
+    }
+    return NULL;
+}
+
+/**
+* Returns the link to n's child for byte c, or NULL if there is none.
+*/
+template<typename Value>
+typename ArtMap<Value>::NodeBase** ArtMap<Value>::childSlot(Inner* n, unsigned char c)
+{
+    switch(n->type){
+    case NODE4:{
+        Node4* n4 = static_cast<Node4*>(n);
+        for(unsigned i = 0; i < n4->count; i++){
+            if(n4->keys[i] == c){
+                return &n4->children[i];
+            }
+        }
+        return NULL;
+    }
+    case NODE16:{
+        Node16* n16 = static_cast<Node16*>(n);
+#if defined(__SSE2__)
+        // compare all 16 key bytes at once
+        __m128i hits = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(c)),
+                                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(n16->keys)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits)) & ((1u << n16->count) - 1);
+        return (mask != 0) ? &n16->children[__builtin_ctz(mask)] : NULL;
+#else
+        for(unsigned i = 0; i < n16->count; i++){
+            if(n16->keys[i] == c){
+                return &n16->children[i];
+            }
+        }
+        return NULL;
+#endif
+    }
+    case NODE48:{
+        Node48* n48 = static_cast<Node48*>(n);
+        return (n48->index[c] != 0) ? &n48->children[n48->index[c] - 1] : NULL;
+    }
+    default:{
+        Node256* n256 = static_cast<Node256*>(n);
+        return (n256->children[c] != NULL) ? &n256->children[c] : NULL;
+    }
+    }
+}
+
+/**
+* Returns n's child with the smallest byte above c (c = -1 for the first
+* child) and sets c to that byte, or returns NULL.
+*/
+template<typename Value>
+typename ArtMap<Value>::NodeBase* ArtMap<Value>::childAfter(const Inner* n, int& c)
+{
+    switch(n->type){
+    case NODE4:
+    case NODE16:{
+        const unsigned char* keys = (n->type == NODE4) ? static_cast<const Node4*>(n)->keys
+                                                       : static_cast<const Node16*>(n)->keys;
+        NodeBase* const* children = (n->type == NODE4) ? static_cast<const Node4*>(n)->children
+                                                       : static_cast<const Node16*>(n)->children;
+        for(unsigned i = 0; i < n->count; i++){
+            if(keys[i] > c){
+                c = keys[i];
+                return children[i];
+            }
+        }
+        return NULL;
+    }
+    case NODE48:{
+        const Node48* n48 = static_cast<const Node48*>(n);
+        for(int b = c + 1; b < 256; b++){
+            if(n48->index[b] != 0){
+                c = b;
+                return n48->children[n48->index[b] - 1];
+            }
+        }
+        return NULL;
+    }
+    default:{
+        const Node256* n256 = static_cast<const Node256*>(n);
+        for(int b = c + 1; b < 256; b++){
+            if(n256->children[b] != NULL){
+                c = b;
+                return n256->children[b];
+            }
+        }
+        return NULL;
+    }
+    }
+}
+
+/**
+* Returns n's child with the largest byte below c (c = 256 for the last
+* child) and sets c to that byte, or returns NULL.
+*/
+template<typename Value>
+typename ArtMap<Value>::NodeBase* ArtMap<Value>::childBefore(const Inner* n, int& c)
+{
+    switch(n->type){
+    case NODE4:
+    case NODE16:{
+        const unsigned char* keys = (n->type == NODE4) ? static_cast<const Node4*>(n)->keys
+                                                       : static_cast<const Node16*>(n)->keys;
+        NodeBase* const* children = (n->type == NODE4) ? static_cast<const Node4*>(n)->children
+                                                       : static_cast<const Node16*>(n)->children;
+        for(unsigned i = n->count; i > 0; i--){
+            if(keys[i - 1] < c){
+                c = keys[i - 1];
+                return children[i - 1];
+            }
+        }
+        return NULL;
+    }
+    case NODE48:{
+        const Node48* n48 = static_cast<const Node48*>(n);
+        for(int b = c - 1; b >= 0; b--){
+            if(n48->index[b] != 0){
+                c = b;
+                return n48->children[n48->index[b] - 1];
+            }
+        }
+        return NULL;
+    }
+    default:{
+        const Node256* n256 = static_cast<const Node256*>(n);
+        for(int b = c - 1; b >= 0; b--){
+            if(n256->children[b] != NULL){
+                c = b;
+                return n256->children[b];
+            }
+        }
+        return NULL;
+    }
+    }
+}
+
+/**
+* Smallest leaf under node: a terminal leaf comes before the children.
+*/
+template<typename Value>
+typename ArtMap<Value>::Leaf* ArtMap<Value>::minLeaf(NodeBase* node)
+{
+    while(node->type != LEAF){
+        Inner* n = static_cast<Inner*>(node);
+        if(n->terminal != NULL){
+            return n->terminal;
+        }
+        int c = -1;
+        node = childAfter(n, c);
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* Largest leaf under node.
+*/
+template<typename Value>
+typename ArtMap<Value>::Leaf* ArtMap<Value>::maxLeaf(NodeBase* node)
+{
+    while(node->type != LEAF){
+        Inner* n = static_cast<Inner*>(node);
+        int c = 256;
+        NodeBase* last = childBefore(n, c);
+        if(last == NULL){
+            return n->terminal;
+        }
+        node = last;
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* Puts a leaf into a new Node4 whose path ends at depth: as its terminal
+* if the key ends there, else as the child for the key's next byte.
+*/
+template<typename Value>
+void ArtMap<Value>::attach(Node4* n, Leaf* leaf, size_t depth)
+{
+    const std::string& key = leaf->item.first;
+    if(depth == key.size()){
+        n->terminal = leaf;
+        return;
+    }
+    NodeBase* ref = n;
+    addChild(ref, n, static_cast<unsigned char>(key[depth]), leaf);
+}
+
+/**
+* Adds child under byte c, first growing n into the next size up if it
+* is full; ref (the link to n) is updated if n is replaced.
+*/
+template<typename Value>
+void ArtMap<Value>::addChild(NodeBase*& ref, Inner* n, unsigned char c, NodeBase* child)
+{
+    if((n->type == NODE4 && n->count == 4) || (n->type == NODE16 && n->count == 16) ||
+       (n->type == NODE48 && n->count == 48)){
+        n = grow(n);
+        ref = n;
+    }
+    switch(n->type){
+    case NODE4:
+    case NODE16:{
+        unsigned char* keys = (n->type == NODE4) ? static_cast<Node4*>(n)->keys
+                                                 : static_cast<Node16*>(n)->keys;
+        NodeBase** children = (n->type == NODE4) ? static_cast<Node4*>(n)->children
+                                                 : static_cast<Node16*>(n)->children;
+        unsigned i = n->count;
+        while(i > 0 && keys[i - 1] > c){
+            keys[i] = keys[i - 1];
+            children[i] = children[i - 1];
+            i--;
+        }
+        keys[i] = c;
+        children[i] = child;
+        break;
+    }
+    case NODE48:{
+        Node48* n48 = static_cast<Node48*>(n);
+        unsigned slot = 0;
+        while(n48->children[slot] != NULL){
+            slot++;
+        }
+        n48->children[slot] = child;
+        n48->index[c] = static_cast<unsigned char>(slot + 1);
+        break;
+    }
+    default:
+        static_cast<Node256*>(n)->children[c] = child;
+        break;
+    }
+    n->count++;
+}
+
+/**
+* Drops the link for byte c, which must exist, without freeing the child.
+*/
+template<typename Value>
+void ArtMap<Value>::removeChild(Inner* n, unsigned char c)
+{
+    switch(n->type){
+    case NODE4:
+    case NODE16:{
+        unsigned char* keys = (n->type == NODE4) ? static_cast<Node4*>(n)->keys
+                                                 : static_cast<Node16*>(n)->keys;
+        NodeBase** children = (n->type == NODE4) ? static_cast<Node4*>(n)->children
+                                                 : static_cast<Node16*>(n)->children;
+        unsigned i = 0;
+        while(keys[i] != c){
+            i++;
+        }
+        for(; i + 1 < n->count; i++){
+            keys[i] = keys[i + 1];
+            children[i] = children[i + 1];
+        }
+        break;
+    }
+    case NODE48:{
+        Node48* n48 = static_cast<Node48*>(n);
+        n48->children[n48->index[c] - 1] = NULL;
+        n48->index[c] = 0;
+        break;
+    }
+    default:
+        static_cast<Node256*>(n)->children[c] = NULL;
+        break;
+    }
+    n->count--;
+}
+
+/**
+* Called on the node at ref after it lost an entry. A node left with a
+* single entry is replaced by it, its prefix and byte moving down into
+* an inner child; otherwise a node well under its size moves down one
+* size, leaving slack so that alternating inserts and removes do not
+* resize on every call.
+*/
+template<typename Value>
+void ArtMap<Value>::shrink(NodeBase*& ref)
+{
+    Inner* n = static_cast<Inner*>(ref);
+    if(n->count + (n->terminal != NULL ? 1 : 0) == 1){
+        if(n->terminal != NULL){
+            ref = n->terminal;
+        }
+        else{
+            int c = -1;
+            NodeBase* child = childAfter(n, c);
+            if(child->type != LEAF){
+                Inner* below = static_cast<Inner*>(child);
+                below->prefix = n->prefix + static_cast<char>(c) + below->prefix;
+            }
+            ref = child;
+        }
+        freeNode(n);
+        return;
+    }
+
+    Inner* smaller = NULL;
+    if(n->type == NODE16 && n->count <= 3){
+        smaller = new Node4();
+    }
+    else if(n->type == NODE48 && n->count <= 12){
+        smaller = new Node16();
+    }
+    else if(n->type == NODE256 && n->count <= 36){
+        smaller = new Node48();
+    }
+    if(smaller == NULL){
+        return;
+    }
+    smaller->prefix.swap(n->prefix);
+    smaller->terminal = n->terminal;
+    NodeBase* link = smaller;
+    int c = -1;
+    for(NodeBase* child = childAfter(n, c); child != NULL; child = childAfter(n, c)){
+        addChild(link, smaller, static_cast<unsigned char>(c), child);
+    }
+    ref = smaller;
+    freeNode(n);
+}
+
+/**
+* Returns a copy of the full node n in the next size up, and frees n.
+*/
+template<typename Value>
+typename ArtMap<Value>::Inner* ArtMap<Value>::grow(Inner* n)
+{
+    Inner* bigger;
+    if(n->type == NODE4){
+        bigger = new Node16();
+    }
+    else if(n->type == NODE16){
+        bigger = new Node48();
+    }
+    else{
+        bigger = new Node256();
+    }
+    bigger->prefix.swap(n->prefix);
+    bigger->terminal = n->terminal;
+    NodeBase* link = bigger;
+    int c = -1;
+    for(NodeBase* child = childAfter(n, c); child != NULL; child = childAfter(n, c)){
+        addChild(link, bigger, static_cast<unsigned char>(c), child);
+    }
+    freeNode(n);
+    return bigger;
+}
+
+/**
+* Frees one node (not its children) through its real type; the node
+* structs have no virtual destructor, to keep them small.
+*/
+template<typename Value>
+void ArtMap<Value>::freeNode(NodeBase* node)
+{
+    switch(node->type){
+    case LEAF:
+        delete static_cast<Leaf*>(node);
+        break;
+    case NODE4:
+        delete static_cast<Node4*>(node);
+        break;
+    case NODE16:
+        delete static_cast<Node16*>(node);
+        break;
+    case NODE48:
+        delete static_cast<Node48*>(node);
+        break;
+    default:
+        delete static_cast<Node256*>(node);
+        break;
+    }
+}
+
+/**
+* Frees node and everything below it.
+*/
+template<typename Value>
+void ArtMap<Value>::freeSubtree(NodeBase* node)
+{
+    if(node == NULL){
+        return;
+    }
+    if(node->type != LEAF){
+        Inner* n = static_cast<Inner*>(node);
+        int c = -1;
+        for(NodeBase* child = childAfter(n, c); child != NULL; child = childAfter(n, c)){
+            freeSubtree(child);
+        }
+        if(n->terminal != NULL){
+            freeNode(n->terminal);
+        }
+    }
+    freeNode(node);
+}
+
+template<typename Value>
+size_t ArtMap<Value>::subtreeBytes(const NodeBase* node)
+{
+    if(node == NULL){
+        return 0;
+    }
+    if(node->type == LEAF){
+        const std::string& key = static_cast<const Leaf*>(node)->item.first;
+        // short keys live inside the std::string itself
+        return sizeof(Leaf) + ((key.capacity() > 15) ? key.capacity() + 1 : 0);
+    }
+    const Inner* n = static_cast<const Inner*>(node);
+    size_t bytes;
+    switch(n->type){
+    case NODE4: bytes = sizeof(Node4); break;
+    case NODE16: bytes = sizeof(Node16); break;
+    case NODE48: bytes = sizeof(Node48); break;
+    default: bytes = sizeof(Node256); break;
+    }
+    if(n->prefix.capacity() > 15){
+        bytes += n->prefix.capacity() + 1;
+    }
+    bytes += subtreeBytes(n->terminal);
+    int c = -1;
+    for(const NodeBase* child = childAfter(n, c); child != NULL; child = childAfter(n, c)){
+        bytes += subtreeBytes(child);
+    }
+    return bytes;
+}
+
+/**
+* Puts leaf on the ordered list just before next (NULL for the end).
+*/
+template<typename Value>
+void ArtMap<Value>::linkBefore(Leaf* leaf, Leaf* next)
+{
+    Leaf* prev = (next != NULL) ? next->prev : header_.tail;
+    leaf->prev = prev;
+    leaf->next = next;
+    if(prev != NULL){
+        prev->next = leaf;
+    }
+    else{
+        header_.head = leaf;
+    }
+    if(next != NULL){
+        next->prev = leaf;
+    }
+    else{
+        header_.tail = leaf;
+    }
+    header_.count++;
+}
+
+template<typename Value>
+void ArtMap<Value>::unlink(Leaf* leaf)
+{
+    if(leaf->prev != NULL){
+        leaf->prev->next = leaf->next;
+    }
+    else{
+        header_.head = leaf->next;
+    }
+    if(leaf->next != NULL){
+        leaf->next->prev = leaf->prev;
+    }
+    else{
+        header_.tail = leaf->prev;
+    }
+    header_.count--;
+}
+
+/*
+  -----------------------------------------
+  End implementations for the ArtMap class.
+  -----------------------------------------
+*/
+
+#endif
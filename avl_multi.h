@@ -0,0 +1,426 @@
+#ifndef AVL_MULTI_H
+#define AVL_MULTI_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include "avlbst.h"
+
+/**
+* An AVLTree that keeps every inserted item, duplicates included.
+* Items with equal keys stay in insertion order: a new item goes after
+* all items with its key. find() and operator[] give the first item
+* with a key; equalRange() and count() cover all of them in
+* O(log n + k). remove(key) removes every item with the key, and
+* erase() removes a single one.
+*
+* The hash index and tombstone mode assume unique keys, so they are
+* not available.
+*/
+template <typename Key, typename Value>
+class AVLMultiMap : public AVLTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    typedef typename BinarySearchTree<Key, Value>::node_type node_type;
+
+    using AVLTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& new_item);
+    std::pair<iterator, bool> insert(node_type&& handle);
+    virtual void remove(const Key& key);
+    size_t count(const Key& key) const;
+    std::pair<iterator, iterator> equalRange(const Key& key) const;
+    virtual void findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+    virtual void setHashIndex(bool enable);
+    virtual void setTombstoneMode(bool enable, double maxDeadFraction = 0.25);
+
+protected:
+    virtual Node<Key,Value>* internalFind(const Key& key) const;
+    Node<Key,Value>* upperBound(const Key& key) const;
+    AVLNode<Key,Value>* insertParent(const Key& key) const;
+};
+
+/**
+* A multiset: each item is a key and the number of copies its node
+* stands for. By default every copy gets its own node, with value 1,
+* so equal keys that compare equal but differ otherwise keep their
+* insertion order. In compressed mode a key has one node and its value
+* counts the copies, which saves a node per duplicate when copies are
+* interchangeable. size() counts copies in both modes.
+*/
+template <typename Key>
+class AVLMultiSet : public AVLMultiMap<Key, size_t>
+{
+public:
+    explicit AVLMultiSet(bool compressed = false);
+
+    void insert(const Key& key);
+    bool removeOne(const Key& key);
+    virtual size_t eraseRange(const Key& lo, const Key& hi);
+    virtual void clear();
+    size_t count(const Key& key) const;
+    size_t size() const;
+    bool isCompressed() const;
+
+protected:
+    virtual void linkNode(Node<Key,size_t>* parent, Node<Key,size_t>* n);
+    virtual void unlinkNode(Node<Key,size_t>* n);
+
+    bool compressed_;
+    size_t copies_;  // sum of the node values
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the AVLMultiMap class.
+  ----------------------------------------------
+*/
+
+/**
+* Adds the item after any items with an equal key; nothing is overwritten.
+*/
+template<class Key, class Value>
+void AVLMultiMap<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    this->lastFix_.levels = 0;
+    this->lastFix_.rotations = 0;
+    AVLNode<Key, Value>* parent = insertParent(new_item.first);
+    this->linkNode(parent, this->createNode(new_item.first, new_item.second, parent));
+}
+
+/**
+* Links the handle's node after any items with an equal key, so the
+* insert always happens. Throws std::invalid_argument for a node from a
+* tree of a different kind.
+*/
+template<class Key, class Value>
+std::pair<typename AVLMultiMap<Key, Value>::iterator, bool>
+AVLMultiMap<Key, Value>::insert(node_type&& handle)
+{
+    Node<Key, Value>* n = this->handleNode(handle);
+    if(n == NULL){
+        return std::make_pair(this->end(), false);
+    }
+    if(!this->acceptsNode(n)){
+        throw std::invalid_argument("node handle from an incompatible tree");
+    }
+    this->releaseHandle(handle);
+    this->linkNode(insertParent(n->getKey()), n);
+    return std::make_pair(this->makeIterator(n), true);
+}
+
+/**
+* Removes every item with the key.
+*/
+template<class Key, class Value>
+void AVLMultiMap<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* curr = internalFind(key);
+    while(curr != NULL && !(key < curr->getKey())){
+        Node<Key, Value>* next = this->nextNode(curr);
+        this->removeNode(curr);
+        curr = next;
+    }
+}
+
+/**
+* Number of items with the key, in O(log n + k).
+*/
+template<class Key, class Value>
+size_t AVLMultiMap<Key, Value>::count(const Key& key) const
+{
+    size_t n = 0;
+    Node<Key, Value>* curr = internalFind(key);
+    while(curr != NULL && !(key < curr->getKey())){
+        n++;
+        curr = this->nextNode(curr);
+    }
+    return n;
+}
+
+/**
+* Returns the items with the key as [first, second), in insertion order;
+* both are the position the key would go at if it is absent.
+*/
+template<class Key, class Value>
+std::pair<typename AVLMultiMap<Key, Value>::iterator, typename AVLMultiMap<Key, Value>::iterator>
+AVLMultiMap<Key, Value>::equalRange(const Key& key) const
+{
+    return std::make_pair(this->makeIterator(this->lowerBound(key)), this->makeIterator(upperBound(key)));
+}
+
+/**
+* BinarySearchTree::findBatch() with a lower-bound descent in each lane,
+* so every search goes on to the first item with its key, as find() does.
+*/
+template<class Key, class Value>
+void AVLMultiMap<Key, Value>::findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    const size_t LANES = BinarySearchTree<Key, Value>::BATCH_LANES;
+    out.assign(keys.size(), this->end());
+    Node<Key, Value>* lane[LANES];
+    Node<Key, Value>* bound[LANES];
+
+    for(size_t first = 0; first < keys.size(); first += LANES){
+        size_t count = keys.size() - first;
+        if(count > LANES){
+            count = LANES;
+        }
+        for(size_t i = 0; i < count; i++){
+            lane[i] = this->root_;
+            bound[i] = NULL;
+        }
+
+        // advance every unfinished search by one level per pass
+        size_t active = count;
+        while(active > 0){
+            active = 0;
+            for(size_t i = 0; i < count; i++){
+                Node<Key, Value>* curr = lane[i];
+                if(curr == NULL){
+                    continue;
+                }
+                if(curr->getKey() < keys[first + i]){
+                    curr = curr->getRight();
+                }
+                else{
+                    bound[i] = curr;
+                    curr = curr->getLeft();
+                }
+                if(curr != NULL){
+                    BST_PREFETCH(curr);
+                    active++;
+                }
+                lane[i] = curr;
+            }
+        }
+        for(size_t i = 0; i < count; i++){
+            if(bound[i] != NULL && !(keys[first + i] < bound[i]->getKey())){
+                out[first + i] = this->makeIterator(bound[i]);
+            }
+        }
+    }
+}
+
+/**
+* Throws std::logic_error when asked to turn the index on: it maps
+* each key to a single node.
+*/
+template<class Key, class Value>
+void AVLMultiMap<Key, Value>::setHashIndex(bool enable)
+{
+    if(enable){
+        throw std::logic_error("AVLMultiMap: the hash index needs unique keys");
+    }
+    AVLTree<Key, Value>::setHashIndex(false);
+}
+
+/**
+* Throws std::logic_error when asked to turn tombstones on: an insert
+* would not know which removed duplicate to revive.
+*/
+template<class Key, class Value>
+void AVLMultiMap<Key, Value>::setTombstoneMode(bool enable, double maxDeadFraction)
+{
+    if(enable){
+        throw std::logic_error("AVLMultiMap: tombstone mode needs unique keys");
+    }
+    AVLTree<Key, Value>::setTombstoneMode(false, maxDeadFraction);
+}
+
+/**
+* The first item with the key in order, or NULL.
+*/
+template<class Key, class Value>
+Node<Key,Value>* AVLMultiMap<Key, Value>::internalFind(const Key& key) const
+{
+    Node<Key, Value>* found = this->lowerBound(key);
+    if(found != NULL && key < found->getKey()){
+        return NULL;
+    }
+    return found;
+}
+
+/**
+* The first node whose key is greater than key, or NULL.
+*/
+template<class Key, class Value>
+Node<Key,Value>* AVLMultiMap<Key, Value>::upperBound(const Key& key) const
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* found = NULL;
+    while(curr != NULL){
+        if(key < curr->getKey()){
+            found = curr;
+            curr = curr->getLeft();
+        }
+        else{
+            curr = curr->getRight();
+        }
+    }
+    return found;
+}
+
+/**
+* Where a new item with the key is linked: after every equal key, so
+* the search goes right on ties. Keys past either end attach to the
+* cached leftmost or rightmost node, as in AVLTree::insert().
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLMultiMap<Key, Value>::insertParent(const Key& key) const
+{
+    AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    if(curr == NULL){
+        return NULL;
+    }
+    AVLNode<Key, Value>* rightmost = static_cast<AVLNode<Key, Value>*>(this->header_.rightmost);
+    if(!(key < rightmost->getKey())){
+        return rightmost;
+    }
+    AVLNode<Key, Value>* leftmost = static_cast<AVLNode<Key, Value>*>(this->header_.leftmost);
+    if(key < leftmost->getKey()){
+        return leftmost;
+    }
+    AVLNode<Key, Value>* parent = NULL;
+    while(curr != NULL){
+        parent = curr;
+        curr = (key < curr->getKey()) ? curr->getLeft() : curr->getRight();
+    }
+    return parent;
+}
+
+/*
+  --------------------------------------------
+  End implementations for the AVLMultiMap class.
+  --------------------------------------------
+*/
+
+/*
+  ----------------------------------------------
+  Begin implementations for the AVLMultiSet class.
+  ----------------------------------------------
+*/
+
+template<class Key>
+AVLMultiSet<Key>::AVLMultiSet(bool compressed) :
+    compressed_(compressed), copies_(0)
+{
+
+}
+
+/**
+* Adds one copy of key: a new node, or in compressed mode one more on
+* the count of the key's node if it has one.
+*/
+template<class Key>
+void AVLMultiSet<Key>::insert(const Key& key)
+{
+    if(compressed_){
+        Node<Key, size_t>* found = this->internalFind(key);
+        if(found != NULL){
+            found->getValue()++;
+            copies_++;
+            return;
+        }
+    }
+    AVLMultiMap<Key, size_t>::insert(std::make_pair(key, static_cast<size_t>(1)));
+}
+
+/**
+* Removes one copy of key (the oldest, if copies have their own nodes).
+* Returns false if the key is absent.
+*/
+template<class Key>
+bool AVLMultiSet<Key>::removeOne(const Key& key)
+{
+    Node<Key, size_t>* found = this->internalFind(key);
+    if(found == NULL){
+        return false;
+    }
+    if(found->getValue() > 1){
+        found->getValue()--;
+        copies_--;
+        return true;
+    }
+    this->removeNode(found);
+    return true;
+}
+
+/**
+* AVLTree::eraseRange(), after counting the copies it will drop: outside
+* a burst the range is freed as a subtree, without unlinkNode().
+*/
+template<class Key>
+size_t AVLMultiSet<Key>::eraseRange(const Key& lo, const Key& hi)
+{
+    if(!this->isSettled()){
+        return AVLTree<Key, size_t>::eraseRange(lo, hi);
+    }
+    size_t dropped = 0;
+    for(Node<Key, size_t>* curr = this->lowerBound(lo); curr != NULL && curr->getKey() < hi;
+        curr = this->nextNode(curr)){
+        dropped += curr->getValue();
+    }
+    copies_ -= dropped;
+    return AVLTree<Key, size_t>::eraseRange(lo, hi);
+}
+
+template<class Key>
+void AVLMultiSet<Key>::clear()
+{
+    AVLTree<Key, size_t>::clear();
+    copies_ = 0;
+}
+
+/**
+* Number of copies of key, in O(log n + k) (O(log n) when compressed).
+*/
+template<class Key>
+size_t AVLMultiSet<Key>::count(const Key& key) const
+{
+    size_t n = 0;
+    Node<Key, size_t>* curr = this->internalFind(key);
+    while(curr != NULL && !(key < curr->getKey())){
+        n += curr->getValue();
+        curr = this->nextNode(curr);
+    }
+    return n;
+}
+
+/**
+* Number of copies in the set.
+*/
+template<class Key>
+size_t AVLMultiSet<Key>::size() const
+{
+    return copies_;
+}
+
+template<class Key>
+bool AVLMultiSet<Key>::isCompressed() const
+{
+    return compressed_;
+}
+
+template<class Key>
+void AVLMultiSet<Key>::linkNode(Node<Key,size_t>* parent, Node<Key,size_t>* n)
+{
+    AVLMultiMap<Key, size_t>::linkNode(parent, n);
+    copies_ += n->getValue();
+}
+
+template<class Key>
+void AVLMultiSet<Key>::unlinkNode(Node<Key,size_t>* n)
+{
+    AVLMultiMap<Key, size_t>::unlinkNode(n);
+    copies_ -= n->getValue();
+}
+
+/*
+  --------------------------------------------
+  End implementations for the AVLMultiSet class.
+  --------------------------------------------
+*/
+
+#endif
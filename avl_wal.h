@@ -0,0 +1,426 @@
+#ifndef AVL_WAL_H
+#define AVL_WAL_H
+
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <chrono>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "avlbst.h"
+
+/**
+ * Serializer hook for write-ahead log records. Trivially copyable types
+ * are copied byte for byte; other types need a specialization with the
+ * same two functions (see std::string below). read() returns false if
+ * the bytes between p and end do not hold a complete value.
+ */
+template <typename T, bool Trivial = std::is_trivially_copyable<T>::value>
+struct LogCodec;
+
+template <typename T>
+struct LogCodec<T, true>
+{
+    static void write(const T& in, std::string& out)
+    {
+        out.append(reinterpret_cast<const char*>(&in), sizeof(T));
+    }
+    static bool read(const char*& p, const char* end, T& out)
+    {
+        if(static_cast<size_t>(end - p) < sizeof(T)){
+            return false;
+        }
+        std::memcpy(static_cast<void*>(&out), p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+};
+
+template <>
+struct LogCodec<std::string, false>
+{
+    static void write(const std::string& in, std::string& out)
+    {
+        uint32_t len = static_cast<uint32_t>(in.size());
+        out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.append(in);
+    }
+    static bool read(const char*& p, const char* end, std::string& out)
+    {
+        uint32_t len;
+        if(static_cast<size_t>(end - p) < sizeof(len)){
+            return false;
+        }
+        std::memcpy(&len, p, sizeof(len));
+        if(static_cast<size_t>(end - p) - sizeof(len) < len){
+            return false;
+        }
+        out.assign(p + sizeof(len), len);
+        p += sizeof(len) + len;
+        return true;
+    }
+};
+
+/**
+ * Group commit settings. A batch of log records is written and synced
+ * once maxBatch mutations are pending or the oldest pending one has
+ * waited maxDelayMicros, whichever comes first.
+ */
+struct WalOptions
+{
+    WalOptions() : maxBatch(128), maxDelayMicros(2000), sync(true) { }
+
+    size_t maxBatch;
+    long maxDelayMicros;
+    bool sync;          // call fdatasync on commit (turn off only for testing)
+};
+
+/**
+ * Counters for judging the cost of durability. Write amplification is
+ * logBytes / payloadBytes.
+ */
+struct WalStats
+{
+    WalStats() : mutations(0), commits(0), logBytes(0), payloadBytes(0), replayed(0) { }
+
+    uint64_t mutations;     // insert/remove calls logged
+    uint64_t commits;       // batches written (one fdatasync each)
+    uint64_t logBytes;      // bytes appended to the log, headers included
+    uint64_t payloadBytes;  // key and value bytes inside those records
+    uint64_t replayed;      // records applied from the log at startup
+};
+
+/**
+ * An AVLTree whose insert() and remove() are recorded in a write-ahead
+ * log so the map survives a crash.
+ *
+ * The state lives in two files: base + ".snap", a saveTo() snapshot
+ * written by checkpoint(), and base + ".wal", the mutations since then.
+ * Opening replays the snapshot and then the log; a torn record at the
+ * end of the log (from a crash mid-write) is discarded.
+ *
+ * Mutations are applied to the tree at once but only become durable
+ * when their batch commits: on reaching WalOptions::maxBatch, when a
+ * later call notices the latency budget has run out, on poll(), or on
+ * sync(). Callers that must not lose an acknowledged write call sync()
+ * first; idle callers should call poll() periodically.
+ *
+ * Log records are [uint32 length][uint32 checksum][uint8 op][key][value],
+ * where length and checksum cover everything after the checksum field.
+ */
+template <typename Key, typename Value>
+class DurableAVLTree
+{
+public:
+    DurableAVLTree(const std::string& base, const WalOptions& options = WalOptions());
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void sync();
+    void poll();
+    void checkpoint();
+
+    const AVLTree<Key, Value>& tree() const;
+    const WalStats& stats() const;
+
+protected:
+    enum { OP_INSERT = 1, OP_REMOVE = 2 };
+    static const size_t RECORD_HEADER = 2 * sizeof(uint32_t);
+
+    void replay();
+    void append(const std::string& body, size_t payload);
+    void commitIfDue();
+    void writePending();
+
+private:
+    DurableAVLTree(const DurableAVLTree&);
+    DurableAVLTree& operator=(const DurableAVLTree&);
+
+    std::string snapPath_;
+    std::string logPath_;
+    WalOptions options_;
+    AVLTree<Key, Value> tree_;
+    int fd_;
+    std::string pending_;
+    size_t written_;  // bytes of pending_ already in the log
+    size_t pendingOps_;
+    std::chrono::steady_clock::time_point oldest_;
+    WalStats stats_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the DurableAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Loads the snapshot and replays the log found at base, creating empty
+* files if there are none. Throws std::runtime_error on I/O errors.
+*/
+template<typename Key, typename Value>
+DurableAVLTree<Key, Value>::DurableAVLTree(const std::string& base, const WalOptions& options) :
+    snapPath_(base + ".snap"),
+    logPath_(base + ".wal"),
+    options_(options),
+    fd_(-1),
+    written_(0),
+    pendingOps_(0)
+{
+    try{
+        replay();
+    }
+    catch(...){
+        if(fd_ >= 0){
+            ::close(fd_);
+        }
+        throw;
+    }
+}
+
+/**
+* Commits anything still pending. Errors are swallowed here; call sync()
+* first to see them.
+*/
+template<typename Key, typename Value>
+DurableAVLTree<Key, Value>::~DurableAVLTree()
+{
+    try{
+        sync();
+    }
+    catch(const std::exception&){
+    }
+    if(fd_ >= 0){
+        ::close(fd_);
+    }
+}
+
+/**
+* Applies the insert to the tree and logs it.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::string body(1, static_cast<char>(OP_INSERT));
+    LogCodec<Key>::write(keyValuePair.first, body);
+    LogCodec<Value>::write(keyValuePair.second, body);
+    tree_.insert(keyValuePair);
+    append(body, body.size() - 1);
+}
+
+/**
+* Applies the removal to the tree and logs it.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::string body(1, static_cast<char>(OP_REMOVE));
+    LogCodec<Key>::write(key, body);
+    tree_.remove(key);
+    append(body, body.size() - 1);
+}
+
+/**
+* Writes and syncs every pending record as one batch.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::sync()
+{
+    if(pendingOps_ == 0){
+        return;
+    }
+    writePending();
+    if(options_.sync && fdatasync(fd_) != 0){
+        throw std::runtime_error("DurableAVLTree: fdatasync failed on " + logPath_);
+    }
+    stats_.logBytes += pending_.size();
+    stats_.commits++;
+    pending_.clear();
+    written_ = 0;
+    pendingOps_ = 0;
+}
+
+/**
+* Commits the pending batch if its latency budget has run out. Meant to
+* be called from an idle loop so a quiet writer's last batch still lands.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::poll()
+{
+    commitIfDue();
+}
+
+/**
+* Writes a snapshot of the whole tree and empties the log, so the next
+* startup replays only what happens after this point. If the process
+* dies between the two steps, the log is replayed on top of a snapshot
+* that already contains it, which is harmless since every record is an
+* idempotent overwrite or removal. saveTo() syncs the directory after
+* its rename, so the log is only emptied once the new snapshot is sure
+* to be the one found after a crash.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::checkpoint()
+{
+    sync();
+    tree_.saveTo(snapPath_);
+    if(ftruncate(fd_, 0) != 0 || fsync(fd_) != 0){
+        throw std::runtime_error("DurableAVLTree: cannot truncate " + logPath_);
+    }
+}
+
+/**
+* Read access to the in-memory tree.
+*/
+template<typename Key, typename Value>
+const AVLTree<Key, Value>& DurableAVLTree<Key, Value>::tree() const
+{
+    return tree_;
+}
+
+template<typename Key, typename Value>
+const WalStats& DurableAVLTree<Key, Value>::stats() const
+{
+    return stats_;
+}
+
+/**
+* Rebuilds the tree from the snapshot and the log, then cuts off any
+* torn record at the end of the log so new records follow valid ones.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::replay()
+{
+    if(access(snapPath_.c_str(), F_OK) == 0){
+        MappedAVLTree<Key, Value> snap = MappedAVLTree<Key, Value>::open(snapPath_);
+        if(!snap.verify()){
+            throw std::runtime_error("DurableAVLTree: corrupt snapshot " + snapPath_);
+        }
+        for(typename MappedAVLTree<Key, Value>::iterator it = snap.begin(); it != snap.end(); ++it){
+            tree_.insert(std::make_pair(it.key(), it.value()));
+        }
+    }
+
+    fd_ = ::open(logPath_.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(fd_ < 0){
+        throw std::runtime_error("DurableAVLTree: cannot open " + logPath_);
+    }
+    struct stat st;
+    if(fstat(fd_, &st) != 0){
+        throw std::runtime_error("DurableAVLTree: cannot stat " + logPath_);
+    }
+    std::string log(static_cast<size_t>(st.st_size), '\0');
+    size_t got = 0;
+    while(got < log.size()){
+        ssize_t n = pread(fd_, &log[got], log.size() - got, got);
+        if(n <= 0){
+            throw std::runtime_error("DurableAVLTree: cannot read " + logPath_);
+        }
+        got += static_cast<size_t>(n);
+    }
+
+    size_t pos = 0;
+    while(log.size() - pos >= RECORD_HEADER){
+        uint32_t len, sum;
+        std::memcpy(&len, &log[pos], sizeof(len));
+        std::memcpy(&sum, &log[pos + sizeof(len)], sizeof(sum));
+        if(len == 0 || log.size() - pos - RECORD_HEADER < len){
+            break;
+        }
+        const char* p = &log[pos + RECORD_HEADER];
+        const char* end = p + len;
+        if(static_cast<uint32_t>(mappedChecksum(p, len)) != sum){
+            break;
+        }
+        // past this point the record is intact, so failing to decode it
+        // means the log was written for another key/value type
+        char op = *p++;
+        Key key;
+        if(!LogCodec<Key>::read(p, end, key)){
+            throw std::runtime_error("DurableAVLTree: undecodable record in " + logPath_);
+        }
+        if(op == OP_INSERT){
+            Value value;
+            if(!LogCodec<Value>::read(p, end, value)){
+                throw std::runtime_error("DurableAVLTree: undecodable record in " + logPath_);
+            }
+            tree_.insert(std::make_pair(key, value));
+        }
+        else{
+            tree_.remove(key);
+        }
+        stats_.replayed++;
+        pos += RECORD_HEADER + len;
+    }
+    if(pos != log.size() && (ftruncate(fd_, pos) != 0 || fsync(fd_) != 0)){
+        throw std::runtime_error("DurableAVLTree: cannot trim " + logPath_);
+    }
+}
+
+/**
+* Frames body as a log record, adds it to the pending batch and commits
+* the batch if it is full or overdue.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::append(const std::string& body, size_t payload)
+{
+    uint32_t len = static_cast<uint32_t>(body.size());
+    uint32_t sum = static_cast<uint32_t>(mappedChecksum(body.data(), body.size()));
+    if(pendingOps_ == 0){
+        oldest_ = std::chrono::steady_clock::now();
+    }
+    pending_.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    pending_.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+    pending_.append(body);
+    pendingOps_++;
+    stats_.mutations++;
+    stats_.payloadBytes += payload;
+    commitIfDue();
+}
+
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::commitIfDue()
+{
+    if(pendingOps_ == 0){
+        return;
+    }
+    if(pendingOps_ >= options_.maxBatch ||
+       std::chrono::steady_clock::now() - oldest_ >= std::chrono::microseconds(options_.maxDelayMicros)){
+        sync();
+    }
+}
+
+/**
+* Writes pending_ from written_ on. A failed write leaves written_ at
+* the bytes that did reach the log, so the next sync() resumes the batch
+* there; writing it again from the start would put a whole copy after
+* the torn prefix, and replay stops at the first bad record.
+*/
+template<typename Key, typename Value>
+void DurableAVLTree<Key, Value>::writePending()
+{
+    while(written_ < pending_.size()){
+        ssize_t n = ::write(fd_, pending_.data() + written_, pending_.size() - written_);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error("DurableAVLTree: write failed on " + logPath_);
+        }
+        written_ += static_cast<size_t>(n);
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the DurableAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -6,7 +6,9 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <string>
 #include "bst.h"
+#include "hash_index.h"
 
 struct KeyError { };
 
@@ -109,7 +111,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return (this->flags_ & this->LEFT_THREAD) ? NULL : static_cast<AVLNode<Key, Value>*>(this->left_);
 }
 
 /**
@@ -118,7 +120,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return (this->flags_ & this->RIGHT_THREAD) ? NULL : static_cast<AVLNode<Key, Value>*>(this->right_);
 }
 
 
@@ -129,22 +131,204 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
+/**
+* Rebalancing work done by one AVLTree insert or remove.
+*/
+struct AVLFixStats
+{
+    size_t levels;     // ancestors whose balance was updated
+    size_t rotations;  // single rotations; a double rotation counts as two
+};
+
+/**
+* An AVL tree. In threaded mode every empty child link stores the
+* in-order predecessor/successor, so iterating never climbs parents.
+* saveTo() writes a file that MappedAVLTree (mapped_avl.h) can search
+* in place.
+*
+* beginBurst() switches to relaxed balance for ingest bursts: inserts
+* and removes only link and unlink nodes, and reads stay correct on the
+* unbalanced tree. settle() or repeated settleStep() calls then rebuild
+* the AVL shape in O(n) total, with bounded work per step.
+*
+* Keys beyond the current maximum (or below the minimum) attach directly
+* to the rightmost (leftmost) node cached in the tree header, without a
+* descent. AVL trees need amortized O(1) rebalancing for insert-only
+* sequences, so sorted ingest costs amortized O(1) per key.
+*
+* setHashIndex(true) keeps a hash table from keys to nodes beside the
+* tree, so find(), operator[], remove() and overwriting inserts skip the
+* descent. Ordered operations still use the tree.
+*
+* setTombstoneMode(true) makes remove() only mark the node as removed.
+* Lookups and iteration skip such tombstones, an insert of the same key
+* revives the node, and once tombstones pass a set fraction of the
+* nodes they are all unlinked in one batch.
+*/
 template <class Key, class Value>
 class AVLTree : public BinarySearchTree<Key, Value>
 {
 public:
+    AVLTree();
+    using BinarySearchTree<Key, Value>::insert;
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+    void setThreaded(bool threaded);
+    bool isThreaded() const;
+    void saveTo(const std::string& path) const;
+    AVLFixStats getLastFixStats() const;
+    virtual void clear();
+    virtual size_t eraseRange(const Key& lo, const Key& hi);
+
+    virtual void rebalance();
+    virtual void setScapegoat(bool enable, double alpha = 0.7);
+
+    void beginBurst();
+    virtual bool settleStep(size_t budget);
+    void settle();
+    bool isSettled() const;
+
+    virtual void setHashIndex(bool enable);
+    bool hasHashIndex() const;
+    size_t hashIndexBytes() const;
+
+    virtual void setTombstoneMode(bool enable, double maxDeadFraction = 0.25);
+    bool isTombstoneMode() const;
+    size_t tombstoneCount() const;
+    void compactTombstones();
 protected:
+    virtual Node<Key,Value>* internalFind(const Key& key) const;
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void linkNode(Node<Key,Value>* parent, Node<Key,Value>* n);
+    virtual void unlinkNode(Node<Key,Value>* n);
+    virtual bool acceptsNode(Node<Key,Value>* n) const;
+    virtual AVLNode<Key,Value>* createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent);
 
     // Add helper functions here
-    void rotateRight(AVLNode<Key,Value>* n1);
-    void rotateLeft(AVLNode<Key,Value>* n1);
-    void insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
+    bool insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
     void removeFix(AVLNode<Key,Value>* n, int difference);
+    AVLNode<Key,Value>* fixImbalance(AVLNode<Key,Value>* n);
+    void threadNode(Node<Key,Value>* n);
+    void restartSettle();
+    void revive(Node<Key,Value>* n);
+    AVLNode<Key,Value>* buildBalanced(const std::vector<Node<Key,Value>*>& nodes, size_t lo, size_t hi,
+                                      AVLNode<Key,Value>* parent, int& height);
+    virtual void noteRelinked(Node<Key,Value>* n);
+    virtual bool erasesByNode() const;
+
+    // eraseRange() helpers; heights are worked out from the balances
+    static int heightOf(AVLNode<Key,Value>* n);
+    void split(AVLNode<Key,Value>* top, int height, const Key& key,
+               AVLNode<Key,Value>*& less, int& lessHeight,
+               AVLNode<Key,Value>*& rest, int& restHeight);
+    AVLNode<Key,Value>* join(AVLNode<Key,Value>* left, int leftHeight, AVLNode<Key,Value>* mid,
+                             AVLNode<Key,Value>* right, int rightHeight, int& height);
+
+    // Progress of settling a relaxed tree: a DSW rebuild (vine, then
+    // compress passes), then a post-order walk storing each node's height
+    // in its balance field and a pre-order walk turning heights into
+    // balances. The walks follow parent pointers, so no stack is needed.
+    enum SettlePhase { SETTLED, VINE, COMPRESS, HEIGHTS, BALANCES };
+    struct SettleState
+    {
+        SettlePhase phase;
+        AVLNode<Key, Value>* curr;
+        AVLNode<Key, Value>* prev;
+        size_t count;      // nodes on the vine
+        size_t full;       // size of the full tree the current pass builds
+        size_t remaining;  // rotations left in the current compress pass
+    };
+
+    bool threaded_;
+    AVLFixStats lastFix_;
+    SettleState settle_;
+    // while eraseRange() runs on a threaded tree, the nodes whose links
+    // it changed, so their threads can be redone at the end
+    std::vector<Node<Key,Value>*>* relinked_;
+
+    // key -> node table kept in step by linkNode() and unlinkNode()
+    bool indexed_;
+    NodeHashIndex<Key, Value> index_;
+
+    // lazy deletion (see setTombstoneMode())
+    bool tombstones_;
+    double maxDeadFraction_;
 };
 
+/**
+* Default constructor, which starts with threads turned off.
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>::AVLTree() :
+    threaded_(false), relinked_(NULL), indexed_(false), tombstones_(false), maxDeadFraction_(0.25)
+{
+    lastFix_.levels = 0;
+    lastFix_.rotations = 0;
+    settle_.phase = SETTLED;
+}
+
+/**
+* Turns threaded mode on or off, threading or unthreading every node in O(n).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setThreaded(bool threaded)
+{
+    if(threaded == threaded_){
+      return;
+    }
+    Node<Key, Value>* prev = NULL;
+    Node<Key, Value>* curr = this->getSmallestNode();
+    while(curr != NULL){
+      Node<Key, Value>* next = this->successor(curr);
+      if(threaded){
+        if(curr->getLeft() == NULL){
+          curr->setLeftThread(prev);
+        }
+        if(curr->getRight() == NULL){
+          curr->setRightThread(next);
+        }
+      }
+      else{
+        if(curr->isLeftThread()){
+          curr->setLeft(NULL);
+        }
+        if(curr->isRightThread()){
+          curr->setRight(NULL);
+        }
+      }
+      prev = curr;
+      curr = next;
+    }
+    threaded_ = threaded;
+}
+
+/**
+* Returns true if empty child links hold in-order threads.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::isThreaded() const
+{
+    return threaded_;
+}
+
+/**
+* Recomputes the threads of n's empty child links from the tree
+* structure. Used after edits that are not simple rotations.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::threadNode(Node<Key,Value>* n)
+{
+    if(n == NULL){
+      return;
+    }
+    if(n->getLeft() == NULL){
+      n->setLeftThread(this->predecessor(n));
+    }
+    if(n->getRight() == NULL){
+      n->setRightThread(this->successor(n));
+    }
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
@@ -153,566 +337,980 @@ template<class Key, class Value>
 void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
 {
     // TODO
+    lastFix_.levels = 0;
+    lastFix_.rotations = 0;
     if(this->root_ == NULL){
-      AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-      this->setRoot(static_cast<Node<Key, Value>*>(newNode));
+      linkNode(NULL, createNode(new_item.first, new_item.second, NULL));
       return;
     }
+    if(indexed_){
+      Node<Key, Value>* found = index_.find(new_item.first);
+      if(found != NULL){
+        found->setValue(new_item.second);
+        revive(found);
+        return;
+      }
+    }
     
     AVLNode<Key, Value> *curr = static_cast<AVLNode<Key, Value>*>(this->getRoot());
     AVLNode<Key, Value> *parent = NULL;
     
-    // find where to insert
-    while(curr != NULL){
-      parent = curr;
-      if(new_item.first < curr->getKey()){
-        curr = curr->getLeft();
-      }
-      else if(new_item.first > curr->getKey()){
-        curr = curr->getRight();
-      }
-      else{
-        // overwrites the current value with the updated value
-        curr->setValue(new_item.second);
-        return;
+    AVLNode<Key, Value>* leftmost = static_cast<AVLNode<Key, Value>*>(this->header_.leftmost);
+    AVLNode<Key, Value>* rightmost = static_cast<AVLNode<Key, Value>*>(this->header_.rightmost);
+    if(rightmost->getKey() < new_item.first){
+      // appending past the maximum: it goes right under the rightmost
+      // node, with no descent from the root
+      parent = rightmost;
+    }
+    else if(new_item.first < leftmost->getKey()){
+      parent = leftmost;
+    }
+    else{
+      // find where to insert
+      while(curr != NULL){
+        parent = curr;
+        if(new_item.first < curr->getKey()){
+          curr = curr->getLeft();
+        }
+        else if(curr->getKey() < new_item.first){
+          curr = curr->getRight();
+        }
+        else{
+          // overwrites the current value with the updated value
+          curr->setValue(new_item.second);
+          revive(curr);
+          return;
+        }
       }
     }
 
     //std::cout << "parent: " << parent->getKey() << std::endl;
     // insert into tree
-    AVLNode<Key, Value> *newNode = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
+    linkNode(parent, createNode(new_item.first, new_item.second, parent));
 
-    if(new_item.first < parent->getKey()){
+    // std::cout << "Insert " << new_item.first << std::endl;
+    // BinarySearchTree<Key,Value>::print();
+}
+
+/**
+* Links n as a leaf under parent (or as the root), threads it if the
+* tree is threaded, and rebalances.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::linkNode(Node<Key,Value>* p, Node<Key,Value>* n)
+{
+    lastFix_.levels = 0;
+    lastFix_.rotations = 0;
+    AVLNode<Key, Value>* parent = static_cast<AVLNode<Key, Value>*>(p);
+    AVLNode<Key, Value>* newNode = static_cast<AVLNode<Key, Value>*>(n);
+    newNode->setParent(parent);
+    newNode->setLeft(NULL);
+    newNode->setRight(NULL);
+    newNode->setBalance(0);
+
+    if(parent == NULL){
+      this->setRoot(newNode);
+      if(threaded_){
+        newNode->setLeftThread(NULL);
+        newNode->setRightThread(NULL);
+      }
+      this->noteInserted(newNode);
+      if(indexed_){
+        index_.insert(newNode);
+      }
+      return;
+    }
+    if(newNode->getKey() < parent->getKey()){
       //std::cout << "sets to parent's left child" << std::endl;
+      if(threaded_){
+        // the new node sits between parent and parent's old predecessor
+        newNode->setLeftThread(parent->getLeftThread());
+        newNode->setRightThread(parent);
+      }
       parent->setLeft(newNode);
     }
     else{
       //std::cout << "sets as parent's right child" << std::endl;
+      if(threaded_){
+        newNode->setLeftThread(parent);
+        newNode->setRightThread(parent->getRightThread());
+      }
       parent->setRight(newNode);
     }
+    this->noteInserted(newNode);
+    if(indexed_){
+      index_.insert(newNode);
+    }
 
     // update balances and rotate if needed
-    insertFix(parent, newNode);
-
-    // std::cout << "Insert " << new_item.first << std::endl;
-    // BinarySearchTree<Key,Value>::print();
+    if(settle_.phase == SETTLED){
+      insertFix(parent, newNode);
+    }
+    else{
+      restartSettle();
+    }
 }
 
+/**
+* Only AVL nodes carry a balance, so only they can be linked in.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
-  //std::cout << "gets called" << std::endl;
-  //std::cout << "Inserting: " << std::endl;
-  if(p == NULL){
-    return;
-  }
+bool AVLTree<Key, Value>::acceptsNode(Node<Key,Value>* n) const
+{
+    return typeid(*n) == typeid(AVLNode<Key, Value>);
+}
 
-  if(n == p->getLeft()){
-    p->updateBalance(-1);
-  }
-  else{
-    p->updateBalance(1);
-  }
+/**
+* Allocates the node insert() links in. Trees that keep extra data per
+* node override this along with acceptsNode().
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent)
+{
+    return new AVLNode<Key, Value>(key, value, parent);
+}
 
-  if(p->getBalance() == 0){
-    return;
-  }
-  AVLNode<Key, Value> *g = p->getParent();
-  if(g == NULL){
-    return;
+/**
+* Walks up from p after its child n's subtree grew by one level. Stops
+* as soon as a subtree's height is unchanged: at a node that became
+* balanced, or after the single or double rotation that fixes the
+* first node to reach +-2, which restores that subtree's old height.
+* Returns true if the growth reached the top, so the whole tree is
+* one level taller.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
+  size_t rotationsBefore = this->rotations_;
+  bool grew = true;
+  while(p != NULL){
+    lastFix_.levels++;
+    p->updateBalance((n == p->getLeft()) ? -1 : 1);
+    if(p->getBalance() == 0){
+      grew = false;
+      break;
+    }
+    if(p->getBalance() == 2 || p->getBalance() == -2){
+      fixImbalance(p);
+      grew = false;
+      break;
+    }
+    // p's subtree is one level taller now
+    n = p;
+    p = p->getParent();
   }
+  lastFix_.rotations += this->rotations_ - rotationsBefore;
+  return grew;
+}
 
-  // else if(p->getBalance() == -2 || p->getBalance() == 2){
-  //   AVLNode<Key, Value> *g = p->getParent();
-  //   if(g == NULL){
-  //     return;
-  //   }
-
-  //   if(p->getBalance() == -2){
-  //     if(n->getBalance() == -1){
-  //       rotateRight(g);
-  //       p->setBalance(0);
-  //       g->setBalance(0);
-  //     }
-  //     else if(n->getBalance() == 1){
-  //       rotateLeft(p);
-  //       rotateRight(g);
-  //       if(n->getBalance() == -1){
-  //         p->setBalance(0);
-  //         g->setBalance(1);
-  //         n->setBalance(0);
-  //       }
-  //       else if(n->getBalance() == 0){
-  //         p->setBalance(0);
-  //         g->setBalance(0);
-  //         n->setBalance(0);
-  //       }
-  //       else{
-  //         p->setBalance(-1);
-  //         g->setBalance(0);
-  //         n->setBalance(0);
-  //       }
-  //     }
-  //   }
-  //   else if(p->getBalance() == 2){
-  //     if(n->getBalance() == 1){
-  //       rotateLeft(g);
-  //       p->setBalance(0);
-  //       g->setBalance(0);
-  //     }
-  //     else if(n->getBalance() == -1){
-  //       rotateRight(p);
-  //       rotateLeft(g);
-  //       if(n->getBalance() == 1){
-  //         p->setBalance(0);
-  //         g->setBalance(-1);
-  //         n->setBalance(0);
-  //       }
-  //       else if(n->getBalance() == 0){
-  //         p->setBalance(0);
-  //         g->setBalance(0);
-  //         n->setBalance(0);
-  //       }
-  //       else{
-  //         p->setBalance(1);
-  //         g->setBalance(0);
-  //         n->setBalance(0);
-  //       }
-  //     }
-  //   }
-  //   return;
-  // }
-  // AVLNode<Key, Value>* g = p->getParent();
-  // if(g != NULL){
-  //   insertFix(g, p);
-  // }
-  
-  
-  //std::cout << "starts checking" << std::endl;
-  //check if p is left child of g first
-  if(p == g->getLeft()){
-    g->updateBalance(-1);
-    // std::cout << g->getBalance() << std::endl;
-    if(g->getBalance() == 0){
+/*
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ */
+template<class Key, class Value>
+void AVLTree<Key, Value>:: remove(const Key& key)
+{
+    lastFix_.levels = 0;
+    lastFix_.rotations = 0;
+    Node<Key, Value> *curr = this->internalFind(key);
+    if(curr == NULL){
+      // return if not in tree
       return;
     }
-    else if(g->getBalance() == -1){
-      //std::cout << "here is called" << std::endl;
-      insertFix(g, p);
+    if(tombstones_){
+      curr->setTombstone(true);
+      this->header_.dead++;
+      if(this->header_.dead > maxDeadFraction_ * this->header_.count){
+        compactTombstones();
+      }
       return;
     }
-    else if(g->getBalance() == -2){
-      //std::cout << "gets in" << std::endl;
-      if(p->getBalance() <= 0){
-        // zig-zig case
-        //std::cout << "works" << std::endl;
-        rotateRight(g);
-        p->setBalance(0);
-        g->setBalance(0);
+    this->removeNode(curr);
+}
+
+/**
+* Takes n out where it sits, without deleting it: swaps it with its
+* predecessor if it has two children, unlinks it, and rebalances from
+* its parent up.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::unlinkNode(Node<Key,Value>* n)
+{
+    lastFix_.levels = 0;
+    lastFix_.rotations = 0;
+    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key, Value>*>(n);
+
+    if((curr->getLeft() != NULL) && (curr->getRight() != NULL)){
+      // has 2 children
+      AVLNode<Key, Value> *pre = static_cast<AVLNode<Key, Value>*>(this->predecessor(curr));
+      nodeSwap(curr, pre);
+    }
+
+    // curr now has at most one child, which takes its place
+    AVLNode<Key, Value>* parent = curr->getParent();
+    AVLNode<Key, Value>* child = (curr->getLeft() != NULL) ? curr->getLeft() : curr->getRight();
+    // neighbours whose threads point at curr
+    Node<Key, Value>* pred = threaded_ ? this->predecessor(curr) : NULL;
+    Node<Key, Value>* succ = threaded_ ? this->successor(curr) : NULL;
+    this->noteRemoving(curr);
+    if(indexed_){
+      index_.erase(curr->getKey());
+    }
+
+    int difference = 0;
+    if(child != NULL){
+      child->setParent(parent);
+    }
+    if(parent == NULL){
+      this->setRoot(child);
+    }
+    else if(curr == parent->getLeft()){
+      parent->setLeft(child);
+      difference = 1;
+    }
+    else{
+      parent->setRight(child);
+      difference = -1;
+    }
+
+    threadNode(pred);
+    threadNode(succ);
+
+    if(settle_.phase == SETTLED){
+      removeFix(parent, difference);
+    }
+    else{
+      restartSettle();
+    }
+}
+
+/**
+* Walks up from n after the subtree on one side of it lost a level
+* (difference is +1 for the left side, -1 for the right). Stops as soon
+* as a subtree's height is unchanged: at a node that was balanced
+* before, or after a rotation whose child was balanced. Otherwise the
+* shrink carries on to the parent, so a remove may rotate at several
+* levels.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* n, int difference){
+  size_t rotationsBefore = this->rotations_;
+  while(n != NULL){
+    lastFix_.levels++;
+    // which side of the parent shrinks if n's subtree does, taken
+    // before a rotation moves another node into n's place
+    AVLNode<Key, Value>* p = n->getParent();
+    int parentDifference = (p != NULL && n == p->getLeft()) ? 1 : -1;
+
+    n->updateBalance(difference);
+    if(n->getBalance() == 1 || n->getBalance() == -1){
+      // was balanced, so the height is unchanged
+      break;
+    }
+    if(n->getBalance() == 2 || n->getBalance() == -2){
+      if(fixImbalance(n)->getBalance() != 0){
+        // rotating over a balanced child keeps the old height
+        break;
+      }
+    }
+    n = p;
+    difference = parentDifference;
+  }
+  lastFix_.rotations += this->rotations_ - rotationsBefore;
+}
+
+/**
+* Restores a node whose balance reached -2 or +2 with a single or
+* double rotation, fixes the balances of the nodes involved, and
+* returns the node now on top of the subtree. The subtree is one level
+* shorter afterwards unless the returned node is unbalanced (only
+* possible in remove, when the taller child was balanced).
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::fixImbalance(AVLNode<Key,Value>* n){
+  if(n->getBalance() < 0){
+    AVLNode<Key, Value>* c = n->getLeft();
+    noteRelinked(n);
+    noteRelinked(c);
+    if(c->getBalance() <= 0){
+      // zig-zig case
+      this->rotateRight(n);
+      if(c->getBalance() == 0){
+        n->setBalance(-1);
+        c->setBalance(1);
       }
       else{
-        // zig-zag case
-        rotateLeft(p);
-        rotateRight(g);
-        if(n->getBalance() == -1){
-          p->setBalance(0);
-          g->setBalance(1);
-          n->setBalance(0);
-        }
-        else if(n->getBalance() == 0){
-          p->setBalance(0);
-          g->setBalance(0);
-          n->setBalance(0);
-        }
-        else{
-          p->setBalance(-1);
-          g->setBalance(0);
-          n->setBalance(0);
-        }
+        n->setBalance(0);
+        c->setBalance(0);
       }
+      return c;
     }
+    // zig-zag case
+    AVLNode<Key, Value>* g = c->getRight();
+    noteRelinked(g);
+    this->rotateLeft(c);
+    this->rotateRight(n);
+    n->setBalance((g->getBalance() == -1) ? 1 : 0);
+    c->setBalance((g->getBalance() == 1) ? -1 : 0);
+    g->setBalance(0);
+    return g;
   }
   else{
-    g->updateBalance(1);
-    if(g->getBalance() == 0){
-      return;
-    }
-    else if(g->getBalance() == 1){
-      insertFix(g, p);
-      return;
-    }
-    else if(g->getBalance() == 2){
-      if(p->getBalance() >= 0){
-        // zig-zig case
-        rotateLeft(g);
-        p->setBalance(0);
-        g->setBalance(0);
+    AVLNode<Key, Value>* c = n->getRight();
+    noteRelinked(n);
+    noteRelinked(c);
+    if(c->getBalance() >= 0){
+      // zig-zig case
+      this->rotateLeft(n);
+      if(c->getBalance() == 0){
+        n->setBalance(1);
+        c->setBalance(-1);
       }
       else{
-        // zig-zag case
-        rotateRight(p);
-        rotateLeft(g);
-        if(n->getBalance() == 1){
-          p->setBalance(0);
-          g->setBalance(-1);
-          n->setBalance(0);
-        }
-        else if(n->getBalance() == 0){
-          p->setBalance(0);
-          g->setBalance(0);
-          n->setBalance(0);
-        }
-        else{
-          p->setBalance(1);
-          g->setBalance(0);
-          n->setBalance(0);
-        }
+        n->setBalance(0);
+        c->setBalance(0);
       }
+      return c;
     }
+    // zig-zag case
+    AVLNode<Key, Value>* g = c->getLeft();
+    noteRelinked(g);
+    this->rotateRight(c);
+    this->rotateLeft(n);
+    n->setBalance((g->getBalance() == 1) ? -1 : 0);
+    c->setBalance((g->getBalance() == -1) ? 1 : 0);
+    g->setBalance(0);
+    return g;
   }
 }
 
-/*
- * Recall: The writeup specifies that if a node has 2 children you
- * should swap with the predecessor and then remove.
- */
+/**
+* Returns the rebalancing work done by the last insert(), remove() or
+* eraseRange().
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+AVLFixStats AVLTree<Key, Value>::getLastFixStats() const
 {
-    // TODO
-    // finds node
-    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
-    if(curr == NULL){
-      // return if not in tree
-      return;
-    }
-    
+    return lastFix_;
+}
 
-    AVLNode<Key, Value>* parent = curr->getParent();
-    int difference = 0;
-    // std::cout << "Curr: " << curr->getKey() << std::endl;
-    // std::cout << "LC: " << curr->getLeft()->getKey() << std::endl;
-    // std::cout << "RC: " << curr->getRight()->getKey() << std::endl;
-    //parent = curr->getParent();
-
-    if(curr->getParent() == NULL){
-      // removing root
-      // std::cout << "enters here" << std::endl;
-      if((curr->getLeft() != NULL) && (curr->getRight() != NULL)){
-        // has 2 children
-        // std::cout << "correctly" << std::endl;
-        AVLNode<Key, Value> *pre = static_cast<AVLNode<Key, Value>*>(this->predecessor(curr));
-        nodeSwap(curr, pre);
-        
-        //std::cout << "Current: " << pre->getKey() << std::endl;
-        this->setRoot(static_cast<Node<Key, Value>*>(pre));
-      }
-      else if(curr->getLeft() != NULL){
-          // just has a left child
-          // if(curr->getParent() == NULL){
-              this->setRoot(static_cast<Node<Key, Value>*>(curr->getLeft()));
-              curr->getLeft()->setParent(NULL);
-          // }
-          // else{
-              //nodeSwap(curr, curr->getParent());
-              // if(curr == curr->getParent()->getLeft()){
-              //     curr->getParent()->setLeft(curr->getLeft());
-              // }
-              // else{
-              //     curr->getParent()->setRight(curr->getLeft());
-              // }
-              // curr->getLeft()->setParent(curr->getParent());
-          // }
-      }
-      else if(curr->getRight() != NULL){
-          // just has a right child
-          // if(curr->getParent() == NULL){
-              this->setRoot(static_cast<Node<Key, Value>*>(curr->getRight()));
-              curr->getRight()->setParent(NULL);
-          // }
-          // else{
-          //     //nodeSwap(curr, curr->getParent());
-          //     if(curr == curr->getParent()->getLeft()){
-          //         curr->getParent()->setLeft(curr->getRight());
-          //     }
-          //     else{
-          //         curr->getParent()->setRight(curr->getRight());
-          //     }
-          //     curr->getRight()->setParent(curr->getParent());
-          // }
-      }
-      else{
-        // std::cout << "goes here" << std::endl;
-        this->setRoot(static_cast<Node<Key, Value>*>(NULL));
+/**
+* Empties the tree and leaves relaxed mode.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::clear()
+{
+    BinarySearchTree<Key, Value>::clear();
+    settle_.phase = SETTLED;
+    index_.clear();
+}
+
+/**
+* Turns the hash index on, building it from the tree in O(n), or off,
+* freeing it. While on it is kept in step by every insert and removal.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setHashIndex(bool enable)
+{
+    index_.clear();
+    indexed_ = enable;
+    if(enable){
+      for(Node<Key, Value>* curr = this->getSmallestNode(); curr != NULL; curr = this->nextNode(curr)){
+        index_.insert(curr);
       }
-      
-      if(curr != NULL){
-        if(curr->getParent() != NULL && curr->getParent()->getLeft() == curr){
-          curr->getParent()->setLeft(NULL);
+    }
+}
+
+template<class Key, class Value>
+bool AVLTree<Key, Value>::hasHashIndex() const
+{
+    return indexed_;
+}
+
+/**
+* Bytes held by the hash index's table (0 when it is off).
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::hashIndexBytes() const
+{
+    return index_.memoryBytes();
+}
+
+/**
+* Finds the key through the hash index when it is on, O(1) expected,
+* and by descending the tree otherwise. Tombstones count as missing.
+*/
+template<class Key, class Value>
+Node<Key,Value>* AVLTree<Key, Value>::internalFind(const Key& key) const
+{
+    Node<Key, Value>* found = indexed_ ? index_.find(key) : BinarySearchTree<Key, Value>::internalFind(key);
+    if(found != NULL && found->isTombstone()){
+      return NULL;
+    }
+    return found;
+}
+
+/**
+* Removes every key in [lo, hi) and returns how many were removed. Two
+* splits cut the range out as a subtree, which is freed in one linear
+* sweep, and the outer pieces are joined back together. Split and join
+* rebalance only along the cut paths, so the work is O(log n + k)
+* rather than k separate fix-ups (O(log^2 n + k) on a threaded tree,
+* whose relinked nodes get their threads recomputed). During a burst,
+* or if erasesByNode() says so, the nodes are unlinked one by one.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::eraseRange(const Key& lo, const Key& hi)
+{
+    lastFix_.levels = 0;
+    lastFix_.rotations = 0;
+    if(!(lo < hi) || this->root_ == NULL){
+      return 0;
+    }
+    if(settle_.phase != SETTLED || erasesByNode()){
+      return this->eraseRangeByNode(lo, hi);
+    }
+
+    // tombstones in the range are freed too but were already removed
+    size_t dead = 0;
+    if(indexed_ || this->header_.dead != 0){
+      for(Node<Key, Value>* curr = this->lowerBound(lo); curr != NULL && curr->getKey() < hi;
+          curr = this->nextNode(curr)){
+        if(indexed_){
+          index_.erase(curr->getKey());
         }
-        else if(curr->getParent() != NULL && curr->getParent()->getRight() == curr){
-          curr->getParent()->setRight(NULL);
+        if(curr->isTombstone()){
+          dead++;
         }
       }
-      delete curr;
+    }
 
-      // removeFix(static_cast<AVLNode<Key, Value>*>(this->getRoot()), );
-      return;
+    std::vector<Node<Key, Value>*> relinked;
+    relinked_ = threaded_ ? &relinked : NULL;
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* less;
+    AVLNode<Key, Value>* middle;
+    AVLNode<Key, Value>* more;
+    int lessHeight, middleHeight, moreHeight;
+    split(root, heightOf(root), lo, less, lessHeight, middle, middleHeight);
+    split(middle, middleHeight, hi, middle, middleHeight, more, moreHeight);
+    if(threaded_){
+      // drop the relinked nodes that are about to be freed
+      size_t kept = 0;
+      for(size_t i = 0; i < relinked.size(); i++){
+        if(relinked[i]->getKey() < lo || !(relinked[i]->getKey() < hi)){
+          relinked[kept++] = relinked[i];
+        }
+      }
+      relinked.resize(kept);
     }
+    size_t removed = this->freeSubtree(middle);
 
-    //std::cout << "Parent key is " << parent->getKey() << " curr key is " << curr->getKey() << std::endl;
-    if(curr->getParent() != NULL){
-      //std::cout << "gets here" << std::endl;
-      // std::cout << parent->getLeft()->getKey() << std::endl;
-      //std::cout << curr->getParent()->getKey() << std::endl;
-      if(curr == parent->getLeft()){
-        //std::cout << "goes here" << std::endl;
-        difference = 1;
+    AVLNode<Key, Value>* lessMax = less;
+    while(lessMax != NULL && lessMax->getRight() != NULL){
+      lessMax = lessMax->getRight();
+    }
+    AVLNode<Key, Value>* moreMin = more;
+    while(moreMin != NULL && moreMin->getLeft() != NULL){
+      moreMin = moreMin->getLeft();
+    }
+
+    if(less == NULL || more == NULL){
+      root = (less != NULL) ? less : more;
+    }
+    else{
+      // the smallest node above the range joins the two pieces; unlink
+      // it from its own piece first
+      AVLNode<Key, Value>* parent = moreMin->getParent();
+      AVLNode<Key, Value>* child = moreMin->getRight();
+      if(child != NULL){
+        child->setParent(parent);
+      }
+      if(parent == NULL){
+        more = child;
       }
       else{
-        difference = -1;
+        parent->setLeft(child);
+        noteRelinked(parent);
+        removeFix(parent, 1);
+        more = parent;
+        while(more->getParent() != NULL){
+          more = more->getParent();
+        }
       }
+      int height;
+      root = join(less, lessHeight, moreMin, more, heightOf(more), height);
     }
+    this->root_ = root;
 
-    if((curr->getLeft() != NULL) && (curr->getRight() != NULL)){
-        // has 2 children
-        // std::cout << "correctly" << std::endl;
-        AVLNode<Key, Value> *pre = static_cast<AVLNode<Key, Value>*>(this->predecessor(curr));
-        nodeSwap(curr, pre);
-    }
-    if(curr->getLeft() != NULL){
-        // just has a left child
-        if(curr->getParent() == NULL){
-            this->setRoot(static_cast<Node<Key, Value>*>(curr->getLeft()));
-            curr->getLeft()->setParent(NULL);
-        }
-        else{
-            //nodeSwap(curr, curr->getParent());
-            if(curr == curr->getParent()->getLeft()){
-                curr->getParent()->setLeft(curr->getLeft());
-            }
-            else{
-                curr->getParent()->setRight(curr->getLeft());
-            }
-            curr->getLeft()->setParent(curr->getParent());
-        }
+    this->header_.count -= removed;
+    this->header_.dead -= dead;
+    removed -= dead;
+    if(lessMax == NULL){
+      this->header_.leftmost = moreMin;
     }
-    else if(curr->getRight() != NULL){
-        // just has a right child
-        if(curr->getParent() == NULL){
-            this->setRoot(static_cast<Node<Key, Value>*>(curr->getRight()));
-            curr->getRight()->setParent(NULL);
-        }
-        else{
-            //nodeSwap(curr, curr->getParent());
-            if(curr == curr->getParent()->getLeft()){
-                curr->getParent()->setLeft(curr->getRight());
-            }
-            else{
-                curr->getParent()->setRight(curr->getRight());
-            }
-            curr->getRight()->setParent(curr->getParent());
-        }
+    if(moreMin == NULL){
+      this->header_.rightmost = lessMax;
     }
-    else{
-        if(parent != NULL){
-            if(curr == curr->getParent()->getLeft()){
-                curr->getParent()->setLeft(NULL);
-            }
-            else{
-                curr->getParent()->setRight(NULL);
-            }
-        }
+
+    if(threaded_){
+      // only relinked nodes and the two nodes next to the range can have
+      // an empty link whose thread is wrong
+      relinked.push_back(lessMax);
+      relinked.push_back(moreMin);
+      for(size_t i = 0; i < relinked.size(); i++){
+        threadNode(relinked[i]);
+      }
+      relinked_ = NULL;
     }
+    return removed;
+}
 
-    delete curr;
-    curr = NULL;
+/**
+* Turns lazy deletion on or off. While on, remove() marks the node as a
+* tombstone in O(log n) with no rebalancing, and the tombstones are
+* compacted in one batch once they exceed maxDeadFraction of the nodes.
+* Turning it off compacts first. Throws std::invalid_argument unless
+* maxDeadFraction is positive.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setTombstoneMode(bool enable, double maxDeadFraction)
+{
+    if(!(maxDeadFraction > 0)){
+      throw std::invalid_argument("AVLTree::setTombstoneMode: maxDeadFraction must be positive");
+    }
+    if(!enable){
+      compactTombstones();
+    }
+    tombstones_ = enable;
+    maxDeadFraction_ = maxDeadFraction;
+}
 
-    // check if balanced and rotate if not until you reach node->parent = root
-    //if(parent!= NULL) std::cout << "Passing in " << parent->getKey() << std::endl; 
-    removeFix(parent, difference);
+template<class Key, class Value>
+bool AVLTree<Key, Value>::isTombstoneMode() const
+{
+    return tombstones_;
+}
 
-    // std::cout << "Removing " << key << std::endl;
-    // BinarySearchTree<Key,Value>::print();
+/**
+* Number of removed items whose nodes are still linked in.
+*/
+template<class Key, class Value>
+size_t AVLTree<Key, Value>::tombstoneCount() const
+{
+    return this->header_.dead;
 }
 
+/**
+* Unlinks and frees every tombstone, in one in-order walk. A few are
+* removed one by one with the usual fix-ups; when k removals at
+* O(log n) each would cost more than that, the survivors are linked
+* into a new perfectly balanced tree in O(n) instead, which also ends
+* a burst.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* n, int difference){
-  //std::cout << "Difference: " << difference << std::endl;
-  if(n == NULL){
-    return;
-  }
-  //int bal = static_cast<int>(n->getBalance());
-  //std::cout << "Balance pre update " << bal << std::endl;
-  //n->updateBalance(difference);
-  //bal = static_cast<int>(n->getBalance());
-  //std::cout << "Balance post update " << bal << std::endl;
-
-  // start with difference = 1 case
-  if(n->getBalance() + difference <= -2){
-    AVLNode<Key, Value>* c = n->getLeft();
-    if(c == NULL){
-      //std::cout << "goes here" << std::endl;
+void AVLTree<Key, Value>::compactTombstones()
+{
+    if(this->header_.dead == 0){
       return;
     }
-    //int bal = static_cast<int>(c->getBalance());
-    //std::cout << "LeftChild: " << bal << std::endl;
-    
-    if(c->getBalance() == -1){
-      // zig-zig case
-      rotateRight(n);
-      n->setBalance(0);
-      c->setBalance(0);
-      //removeFix(p, ndiff);
+    std::vector<Node<Key, Value>*> nodes;
+    nodes.reserve(this->header_.count);
+    for(Node<Key, Value>* curr = this->getSmallestNode(); curr != NULL; curr = this->nextNode(curr)){
+      nodes.push_back(curr);
     }
-    else if(c->getBalance() == 0){
-      // zig-zig case
-      rotateRight(n);
-      n->setBalance(-1);
-      c->setBalance(1);
-    }
-    else if (c->getBalance() == 1){
-      // zig-zag case
-      AVLNode<Key, Value>* g = c->getRight();
-      rotateLeft(c);
-      rotateRight(n);
-      if(g->getBalance() == 1){
-        n->setBalance(0);
-        c->setBalance(-1);
-        g->setBalance(0);
+    double n = static_cast<double>(this->header_.count);
+    if(this->header_.dead * std::log2(n) <= n){
+      for(size_t i = 0; i < nodes.size(); i++){
+        if(nodes[i]->isTombstone()){
+          this->removeNode(nodes[i]);
+        }
       }
-      else if(g->getBalance() == 0){
-        n->setBalance(0);
-        c->setBalance(0);
-        g->setBalance(0);
+      return;
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < nodes.size(); i++){
+      if(!nodes[i]->isTombstone()){
+        nodes[kept++] = nodes[i];
+        continue;
       }
-      else if(g->getBalance() == -1){
-        n->setBalance(1);
-        c->setBalance(0);
-        g->setBalance(0);
+      if(indexed_){
+        index_.erase(nodes[i]->getKey());
       }
-      //removeFix(p, ndiff);
+      delete nodes[i];
     }
-  }
-  else if(n->getBalance() + difference >= 2){
-    AVLNode<Key, Value>* c = n->getRight();
-    
-    if(c->getBalance() == 1){
-      // zig-zig case
-      rotateLeft(n);
-      n->setBalance(0);
-      c->setBalance(0);
-      //removeFix(p, ndiff);
+    nodes.resize(kept);
+    int height;
+    this->root_ = buildBalanced(nodes, 0, kept, NULL, height);
+    this->header_.leftmost = (kept > 0) ? nodes.front() : NULL;
+    this->header_.rightmost = (kept > 0) ? nodes.back() : NULL;
+    this->header_.count = kept;
+    this->header_.dead = 0;
+    settle_.phase = SETTLED;
+}
+
+/**
+* Links nodes[lo, hi), which are in key order, into a perfectly
+* balanced subtree under parent, threading its empty links if the tree
+* is threaded. Returns the subtree's root and sets height.
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::buildBalanced(const std::vector<Node<Key,Value>*>& nodes,
+                                                      size_t lo, size_t hi, AVLNode<Key,Value>* parent, int& height)
+{
+    if(lo == hi){
+      height = 0;
+      return NULL;
     }
-    else if(c->getBalance() == 0){
-      // zig-zig case
-      rotateLeft(n);
-      n->setBalance(1);
-      c->setBalance(-1);
-    }
-    else if (c->getBalance() == -1){
-      // zig-zag case
-      AVLNode<Key, Value>* g = c->getLeft();
-      rotateRight(c);
-      rotateLeft(n);
-      if(g->getBalance() == -1){
-        n->setBalance(0);
-        c->setBalance(1);
-        g->setBalance(0);
+    size_t mid = lo + (hi - lo) / 2;
+    AVLNode<Key, Value>* n = static_cast<AVLNode<Key, Value>*>(nodes[mid]);
+    int leftHeight, rightHeight;
+    AVLNode<Key, Value>* left = buildBalanced(nodes, lo, mid, n, leftHeight);
+    AVLNode<Key, Value>* right = buildBalanced(nodes, mid + 1, hi, n, rightHeight);
+    n->setParent(parent);
+    n->setLeft(left);
+    n->setRight(right);
+    if(threaded_ && left == NULL){
+      n->setLeftThread((mid > 0) ? nodes[mid - 1] : NULL);
+    }
+    if(threaded_ && right == NULL){
+      n->setRightThread((mid + 1 < nodes.size()) ? nodes[mid + 1] : NULL);
+    }
+    n->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+    height = std::max(leftHeight, rightHeight) + 1;
+    return n;
+}
+
+/**
+* Clears n's tombstone, if it has one, for an insert that reuses it.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::revive(Node<Key,Value>* n)
+{
+    if(n->isTombstone()){
+      n->setTombstone(false);
+      this->header_.dead--;
+    }
+}
+
+/**
+* Records that n's child links were changed, if eraseRange() is keeping
+* track. Called before every rebalancing rotation, so subclasses that
+* keep per-subtree data can hook it to learn which nodes moved.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::noteRelinked(Node<Key,Value>* n)
+{
+    if(relinked_ != NULL){
+      relinked_->push_back(n);
+    }
+}
+
+/**
+* Whether eraseRange() must unlink the range node by node instead of
+* cutting it out as a subtree. Subclasses whose unlinkNode() keeps data
+* outside the tree shape up to date return true.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::erasesByNode() const
+{
+    return false;
+}
+
+/**
+* Returns the height of the subtree under n (0 if empty) by following
+* the taller child down, as the balances say, in O(log n).
+*/
+template<class Key, class Value>
+int AVLTree<Key, Value>::heightOf(AVLNode<Key,Value>* n)
+{
+    int height = 0;
+    while(n != NULL){
+      height++;
+      n = (n->getBalance() < 0) ? n->getLeft() : n->getRight();
+    }
+    return height;
+}
+
+/**
+* Splits the AVL tree under top, of the given height, into an AVL tree
+* of the keys below key (less) and one of the rest, both with NULL
+* parents. Each node on the search path is used to join the pieces on
+* its side; those joins cost O(difference in heights), which adds up to
+* O(log n) over the whole path.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::split(AVLNode<Key,Value>* top, int height, const Key& key,
+                                AVLNode<Key,Value>*& less, int& lessHeight,
+                                AVLNode<Key,Value>*& rest, int& restHeight)
+{
+    if(top == NULL){
+      less = NULL;
+      rest = NULL;
+      lessHeight = 0;
+      restHeight = 0;
+      return;
+    }
+    AVLNode<Key, Value>* left = top->getLeft();
+    AVLNode<Key, Value>* right = top->getRight();
+    int leftHeight = height - ((top->getBalance() > 0) ? 2 : 1);
+    int rightHeight = height - ((top->getBalance() < 0) ? 2 : 1);
+    if(left != NULL){
+      left->setParent(NULL);
+    }
+    if(right != NULL){
+      right->setParent(NULL);
+    }
+    top->setLeft(NULL);
+    top->setRight(NULL);
+
+    if(top->getKey() < key){
+      AVLNode<Key, Value>* lessRight;
+      int lessRightHeight;
+      split(right, rightHeight, key, lessRight, lessRightHeight, rest, restHeight);
+      less = join(left, leftHeight, top, lessRight, lessRightHeight, lessHeight);
+    }
+    else{
+      AVLNode<Key, Value>* restLeft;
+      int restLeftHeight;
+      split(left, leftHeight, key, less, lessHeight, restLeft, restLeftHeight);
+      rest = join(restLeft, restLeftHeight, top, right, rightHeight, restHeight);
+    }
+}
+
+/**
+* Joins two AVL trees and a node mid, where every key in left is below
+* mid's and every key in right above it, into one AVL tree and returns
+* its top; height is set to the new height. mid goes down the taller
+* tree's inner edge to a subtree about as tall as the other tree, takes
+* its place with the two as children, and the growth is fixed up as in
+* insert, so the cost is O(1 + difference in heights).
+*/
+template<class Key, class Value>
+AVLNode<Key,Value>* AVLTree<Key, Value>::join(AVLNode<Key,Value>* left, int leftHeight, AVLNode<Key,Value>* mid,
+                                              AVLNode<Key,Value>* right, int rightHeight, int& height)
+{
+    noteRelinked(mid);
+    if(leftHeight <= rightHeight + 1 && rightHeight <= leftHeight + 1){
+      mid->setLeft(left);
+      mid->setRight(right);
+      if(left != NULL){
+        left->setParent(mid);
       }
-      else if(g->getBalance() == 0){
-        n->setBalance(0);
-        c->setBalance(0);
-        g->setBalance(0);
+      if(right != NULL){
+        right->setParent(mid);
       }
-      else if(g->getBalance() == 1){
-        n->setBalance(-1);
-        c->setBalance(0);
-        g->setBalance(0);
+      mid->setParent(NULL);
+      mid->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+      height = std::max(leftHeight, rightHeight) + 1;
+      return mid;
+    }
+
+    bool leftTaller = leftHeight > rightHeight;
+    int target = leftTaller ? rightHeight : leftHeight;
+    AVLNode<Key, Value>* p = NULL;
+    AVLNode<Key, Value>* c = leftTaller ? left : right;
+    int cHeight = leftTaller ? leftHeight : rightHeight;
+    while(cHeight > target + 1){
+      p = c;
+      if(leftTaller){
+        cHeight -= (c->getBalance() < 0) ? 2 : 1;
+        c = c->getRight();
+      }
+      else{
+        cHeight -= (c->getBalance() > 0) ? 2 : 1;
+        c = c->getLeft();
       }
-      //removeFix(p, ndiff);
     }
-  }
-  else if(n->getBalance() + difference == -1){
-    n->setBalance(-1);
-  }
-  else if(n->getBalance() + difference == 0){
-    AVLNode<Key, Value>* p = n->getParent();
-    n->setBalance(0);
-    removeFix(p, 0);
-  }
-  else if(n->getBalance() + difference == 1){
-    n->setBalance(1);
-  }
 
-  AVLNode<Key, Value>* p = n->getParent();
-  int ndiff = 0;
-  if(p != NULL){
-    if(n == p->getLeft()){
-      ndiff = 1;
+    // mid replaces c, with c and the shorter tree as its children; its
+    // subtree is one level taller than c's was
+    mid->setParent(p);
+    if(leftTaller){
+      mid->setLeft(c);
+      mid->setRight(right);
+      if(right != NULL){
+        right->setParent(mid);
+      }
+      mid->setBalance(static_cast<int8_t>(rightHeight - cHeight));
+      p->setRight(mid);
     }
     else{
-      ndiff = -1;
+      mid->setLeft(left);
+      mid->setRight(c);
+      if(left != NULL){
+        left->setParent(mid);
+      }
+      mid->setBalance(static_cast<int8_t>(cHeight - leftHeight));
+      p->setLeft(mid);
     }
-    removeFix(p, ndiff);
-  }
+    if(c != NULL){
+      c->setParent(mid);
+    }
+    height = (leftTaller ? leftHeight : rightHeight) + (insertFix(p, mid) ? 1 : 0);
+
+    AVLNode<Key, Value>* top = mid;
+    while(top->getParent() != NULL){
+      top = top->getParent();
+    }
+    return top;
 }
 
+/**
+* Rebuilds the tree into a complete tree through the settle path, which
+* recomputes every balance after the rebuild. O(n).
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* n1){
-  if(n1 == NULL || n1->getLeft() == NULL){
-    return;
-  }
-  AVLNode<Key, Value>* n2 = n1->getLeft();
-  AVLNode<Key, Value>* n3 = n1->getParent();
+void AVLTree<Key, Value>::rebalance()
+{
+    restartSettle();
+    settle();
+}
 
-  n1->setLeft(n2->getRight());
-  if(n2->getRight() != NULL){
-    n2->getRight()->setParent(n1);
-  }
-  n2->setRight(n1);
-  n1->setParent(n2);
-  n2->setParent(n3);
-  if(n3 == NULL){
-    this->setRoot(static_cast<Node<Key, Value>*>(n2));
-    n2->setParent(NULL);
-  }
-  else{
-    if(n1 == n3->getLeft()){
-      n3->setLeft(n2);
-    }
-    else{
-      n3->setRight(n2);
+/**
+* Throws std::logic_error when asked to turn the policy on: the tree
+* already keeps its height within 1.44*log2(n), and a scapegoat rebuild
+* would leave the balances stale.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::setScapegoat(bool enable, double alpha)
+{
+    if(enable){
+        throw std::logic_error("AVLTree: the scapegoat policy is for the plain tree");
     }
-  }
+    BinarySearchTree<Key, Value>::setScapegoat(false, alpha);
 }
 
+/**
+* Starts a write burst: until the tree is settled again, insert() and
+* remove() skip rebalancing, so the tree may grow deep.
+*/
 template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* n1){
-  if(n1 == NULL || n1->getRight() == NULL){
-    return;
-  }
-  AVLNode<Key, Value>* n2 = n1->getRight();
-  AVLNode<Key, Value>* n3 = n1->getParent();
+void AVLTree<Key, Value>::beginBurst()
+{
+    restartSettle();
+}
 
-  n1->setRight(n2->getLeft());
-  if(n2->getLeft() != NULL){
-    n2->getLeft()->setParent(n1);
-  }
-  n2->setLeft(n1);
-  n1->setParent(n2);
-  n2->setParent(n3);
-  if(n3 == NULL){
-    this->setRoot(static_cast<Node<Key, Value>*>(n2));
-    n2->setParent(NULL);
-  }
-  else{
-    if(n1 == n3->getRight()){
-      n3->setRight(n2);
+/**
+* Does at most budget units of settling work (one rotation or one node
+* visited each) and returns true once the tree is a valid AVL tree again,
+* which also ends the burst. Lookups and iteration stay correct between
+* steps; an insert or remove before settling finishes makes the next
+* step start over.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::settleStep(size_t budget)
+{
+    SettleState& st = settle_;
+    for(; budget > 0 && st.phase != SETTLED; budget--){
+      if(st.phase == VINE){
+        if(st.curr == NULL){
+          if(st.count == 0){
+            st.phase = SETTLED;
+            break;
+          }
+          st.full = 1;
+          while(2 * st.full + 1 <= st.count){
+            st.full = 2 * st.full + 1;
+          }
+          st.remaining = st.count - st.full;
+          st.curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+          st.phase = COMPRESS;
+        }
+        else if(st.curr->getLeft() != NULL){
+          AVLNode<Key, Value>* left = st.curr->getLeft();
+          this->rotateRight(st.curr);
+          st.curr = left;
+        }
+        else{
+          st.count++;
+          st.curr = st.curr->getRight();
+        }
+      }
+      else if(st.phase == COMPRESS){
+        if(st.remaining > 0){
+          AVLNode<Key, Value>* up = st.curr->getRight();
+          this->rotateLeft(st.curr);
+          st.curr = up->getRight();
+          st.remaining--;
+        }
+        else if(st.full > 1){
+          st.full /= 2;
+          st.remaining = st.full;
+          st.curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+        }
+        else{
+          st.prev = NULL;
+          st.curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+          st.phase = HEIGHTS;
+        }
+      }
+      else{
+        if(st.curr == NULL){
+          st.prev = NULL;
+          st.curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+          st.phase = (st.phase == HEIGHTS) ? BALANCES : SETTLED;
+          continue;
+        }
+        // one step of a walk over the tree through parent pointers
+        AVLNode<Key, Value>* n = st.curr;
+        AVLNode<Key, Value>* left = n->getLeft();
+        AVLNode<Key, Value>* right = n->getRight();
+        AVLNode<Key, Value>* next;
+        bool fromAbove = (st.prev == n->getParent());
+        if(fromAbove && st.phase == BALANCES){
+          // children still hold heights here; the complete tree built
+          // above is at most 64 levels tall, so heights fit in a balance
+          int hl = (left != NULL) ? left->getBalance() : 0;
+          int hr = (right != NULL) ? right->getBalance() : 0;
+          n->setBalance(static_cast<int8_t>(hr - hl));
+        }
+        if(fromAbove && left != NULL) next = left;
+        else if(fromAbove && right != NULL) next = right;
+        else if(!fromAbove && st.prev == left && right != NULL) next = right;
+        else next = n->getParent();
+        if(next == n->getParent() && st.phase == HEIGHTS){
+          int hl = (left != NULL) ? left->getBalance() : 0;
+          int hr = (right != NULL) ? right->getBalance() : 0;
+          n->setBalance(static_cast<int8_t>(std::max(hl, hr) + 1));
+        }
+        st.prev = n;
+        st.curr = next;
+      }
     }
-    else{
-      n3->setLeft(n2);
+    return st.phase == SETTLED;
+}
+
+/**
+* Finishes settling in one call, O(n).
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::settle()
+{
+    while(!settleStep(static_cast<size_t>(-1))){
     }
-  }
+}
+
+/**
+* Returns true unless a burst is in progress or still being settled.
+*/
+template<class Key, class Value>
+bool AVLTree<Key, Value>::isSettled() const
+{
+    return settle_.phase == SETTLED;
+}
+
+/**
+* Puts settling back at its start, for when the tree changed under it.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::restartSettle()
+{
+    settle_.phase = VINE;
+    settle_.curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    settle_.prev = NULL;
+    settle_.count = 0;
 }
 
 template<class Key, class Value>
@@ -722,7 +1320,46 @@ void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>*
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+
+    if(threaded_ && n1 != n2 && n1 != NULL && n2 != NULL){
+      // the base swap drops threads; rebuild them for both nodes and
+      // for the neighbours that point at either one
+      Node<Key, Value>* touched[6] = {
+        n1, n2,
+        this->predecessor(n1), this->successor(n1),
+        this->predecessor(n2), this->successor(n2)
+      };
+      for(int i = 0; i < 6; i++){
+        threadNode(touched[i]);
+      }
+    }
+}
+
+
+/**
+* A set of keys on AVLTree, with all of its balancing modes. Nodes store
+* only the key (see KeyOnly), so for small keys the balance factor fits
+* in the padding after the key and a node is a word smaller than in an
+* AVLTree<Key, char>.
+*/
+template <typename Key>
+class AVLSet : public AVLTree<Key, KeyOnly>
+{
+public:
+    using AVLTree<Key, KeyOnly>::insert;
+    void insert(const Key& key);
+};
+
+/**
+* Adds key; inserting a key the set holds does nothing.
+*/
+template<class Key>
+void AVLSet<Key>::insert(const Key& key)
+{
+    this->insert(std::pair<const Key, KeyOnly>(key, KeyOnly()));
 }
 
+// saveTo() and the on-disk format live in their own file since they are fairly long
+#include "mapped_avl.h"
 
 #endif
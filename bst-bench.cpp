@@ -0,0 +1,1471 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <list>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "bst.h"
+#include "avlbst.h"
+#include "avl_wal.h"
+#include "lsm_store.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "art.h"
+#include "merkle_avl.h"
+#include "combining_avl.h"
+#include "ordered_cache.h"
+#include "intrusive_avl.h"
+#include "avl_multi.h"
+#include <thread>
+#include <mutex>
+
+using namespace std;
+
+// Wall clock time in seconds
+static double now()
+{
+    return chrono::duration<double>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Returns the keys 0..n-1 in a random order
+static vector<int> shuffledKeys(size_t n, unsigned seed)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; i++){
+        keys[i] = static_cast<int>(i);
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(seed));
+    return keys;
+}
+
+/**
+ * Draws ranks 0..n-1 with P(rank k) proportional to 1/(k+1)^s.
+ */
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double s, unsigned seed) : cdf_(n), gen_(seed)
+    {
+        double sum = 0;
+        for(size_t k = 0; k < n; k++){
+            sum += 1.0 / pow(double(k + 1), s);
+            cdf_[k] = sum;
+        }
+        for(size_t k = 0; k < n; k++){
+            cdf_[k] /= sum;
+        }
+    }
+
+    size_t next()
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(gen_);
+        size_t k = lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+        return k < cdf_.size() ? k : cdf_.size() - 1;
+    }
+
+private:
+    vector<double> cdf_;
+    mt19937 gen_;
+};
+
+/**
+ * Compares a loop of find() calls against findBatch() on batches of
+ * 256 random keys while the tree grows from cache resident to well
+ * past the last level cache.
+ */
+static void benchFindBatch(size_t maxSize)
+{
+    const size_t batchSize = 256;
+    const size_t lookups = 1 << 21;
+
+    cout << "findBatch: " << lookups << " lookups in batches of " << batchSize << endl;
+    cout << setw(10) << "nodes" << setw(14) << "find Mops/s"
+         << setw(16) << "batch Mops/s" << setw(10) << "speedup" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        AVLTree<int, int> tree;
+        vector<int> keys = shuffledKeys(n, 1);
+        for(size_t i = 0; i < n; i++){
+            tree.insert(make_pair(keys[i], keys[i]));
+        }
+
+        mt19937 gen(2);
+        uniform_int_distribution<int> dist(0, static_cast<int>(n) - 1);
+        vector<int> queries(lookups);
+        for(size_t i = 0; i < lookups; i++){
+            queries[i] = dist(gen);
+        }
+
+        long long sum = 0;
+        double start = now();
+        for(size_t i = 0; i < lookups; i++){
+            sum += tree.find(queries[i])->second;
+        }
+        double single = now() - start;
+
+        vector<int> batch(batchSize);
+        vector<AVLTree<int, int>::iterator> found;
+        start = now();
+        for(size_t i = 0; i < lookups; i += batchSize){
+            copy(queries.begin() + i, queries.begin() + i + batchSize, batch.begin());
+            tree.findBatch(batch, found);
+            for(size_t j = 0; j < batchSize; j++){
+                sum -= found[j]->second;
+            }
+        }
+        double batched = now() - start;
+
+        cout << setw(10) << n << fixed << setprecision(2)
+             << setw(14) << lookups / single / 1e6
+             << setw(16) << lookups / batched / 1e6
+             << setw(10) << single / batched
+             << (sum != 0 ? "  (mismatch!)" : "") << endl;
+    }
+}
+
+/**
+ * Compares restarting from a saveTo() file by re-inserting every entry
+ * against mapping it with MappedAVLTree and serving lookups in place.
+ */
+static void benchMapped(size_t maxSize)
+{
+    const char* path = "bst-bench.avl";
+    const size_t lookups = 100000;
+
+    cout << "mapped: restart cost, then " << lookups << " random lookups" << endl;
+    cout << setw(10) << "nodes" << setw(12) << "save s" << setw(14) << "reinsert s"
+         << setw(12) << "open s" << setw(16) << "mapped find s" << endl;
+
+    for(size_t n = 1 << 16; n <= maxSize; n <<= 2){
+        AVLTree<int, int> tree;
+        vector<int> keys = shuffledKeys(n, 1);
+        for(size_t i = 0; i < n; i++){
+            tree.insert(make_pair(keys[i], keys[i]));
+        }
+        double start = now();
+        tree.saveTo(path);
+        double save = now() - start;
+        tree.clear();
+
+        start = now();
+        {
+            MappedAVLTree<int, int> file = MappedAVLTree<int, int>::open(path);
+            AVLTree<int, int> rebuilt;
+            for(MappedAVLTree<int, int>::iterator it = file.begin(); it != file.end(); ++it){
+                rebuilt.insert(make_pair(it.key(), it.value()));
+            }
+        }
+        double reinsert = now() - start;
+
+        start = now();
+        MappedAVLTree<int, int> file = MappedAVLTree<int, int>::open(path);
+        double open = now() - start;
+
+        mt19937 gen(2);
+        long long sum = 0;
+        start = now();
+        for(size_t i = 0; i < lookups; i++){
+            sum += file[static_cast<int>(gen() % n)];
+        }
+        double find = now() - start;
+
+        cout << setw(10) << n << fixed << setprecision(4)
+             << setw(12) << save << setw(14) << reinsert
+             << setw(12) << open << setw(16) << find
+             << (sum < 0 ? "  (mismatch!)" : "") << endl;
+    }
+    remove(path);
+}
+
+/**
+ * Logged insert/remove throughput with fdatasync on, for several group
+ * commit batch sizes, plus the write amplification of the log format.
+ */
+static void benchWal(size_t maxOps)
+{
+    const char* base = "bst-bench-wal";
+    const size_t batches[] = { 1, 8, 64, 512 };
+
+    cout << "wal: 3 inserts per remove, fdatasync on every commit" << endl;
+    cout << setw(8) << "batch" << setw(10) << "ops" << setw(10) << "commits"
+         << setw(12) << "ops/s" << setw(12) << "write amp" << endl;
+
+    for(size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++){
+        // unbatched syncs are slow, so give them fewer operations
+        size_t ops = min(maxOps, batches[b] * 2000);
+        WalOptions options;
+        options.maxBatch = batches[b];
+        options.maxDelayMicros = 1000000;
+
+        string snap = string(base) + ".snap", log = string(base) + ".wal";
+        remove(snap.c_str());
+        remove(log.c_str());
+        DurableAVLTree<int, int> tree(base, options);
+        mt19937 gen(3);
+        double start = now();
+        for(size_t i = 0; i < ops; i++){
+            int key = static_cast<int>(gen() % 100000);
+            if(i % 4 == 3){
+                tree.remove(key);
+            }
+            else{
+                tree.insert(make_pair(key, static_cast<int>(i)));
+            }
+        }
+        tree.sync();
+        double elapsed = now() - start;
+
+        const WalStats& stats = tree.stats();
+        cout << setw(8) << batches[b] << setw(10) << ops << setw(10) << stats.commits
+             << fixed << setprecision(0) << setw(12) << ops / elapsed
+             << setprecision(2) << setw(12) << double(stats.logBytes) / stats.payloadBytes << endl;
+        remove(snap.c_str());
+        remove(log.c_str());
+    }
+}
+
+// Runs the lookups against tree and returns millions of lookups per second
+template<typename Tree>
+static double timeLookups(Tree& tree, const vector<int>& queries)
+{
+    long long sum = 0;
+    double start = now();
+    for(size_t i = 0; i < queries.size(); i++){
+        sum += tree.find(queries[i])->second;
+    }
+    double elapsed = now() - start;
+    if(sum == -1){
+        cout << "impossible" << endl;
+    }
+    return queries.size() / elapsed / 1e6;
+}
+
+/**
+ * Lookup throughput of SplayTree (splaying on every read, and on every
+ * 16th read) against AVLTree on Zipf distributed keys. Hot ranks are
+ * mapped to random keys so they are scattered through the tree.
+ */
+static void benchSplay(size_t maxSize)
+{
+    const size_t lookups = 1 << 21;
+    const double skews[] = { 0.8, 0.99, 1.2 };
+
+    cout << "splay: " << lookups << " Zipf lookups, Mops/s" << endl;
+    cout << setw(10) << "nodes" << setw(8) << "skew" << setw(10) << "AVL"
+         << setw(10) << "splay" << setw(12) << "splay/16" << endl;
+
+    for(size_t n = 1 << 16; n <= maxSize; n <<= 4){
+        vector<int> keys = shuffledKeys(n, 1);
+        for(size_t z = 0; z < sizeof(skews) / sizeof(skews[0]); z++){
+            ZipfGenerator zipf(n, skews[z], 4);
+            vector<int> queries(lookups);
+            for(size_t i = 0; i < lookups; i++){
+                queries[i] = keys[zipf.next()];
+            }
+
+            AVLTree<int, int> avl;
+            SplayTree<int, int> splay, lazy;
+            lazy.setSplayPeriod(16);
+            for(size_t i = 0; i < n; i++){
+                avl.insert(make_pair(keys[i], keys[i]));
+                splay.insert(make_pair(keys[i], keys[i]));
+                lazy.insert(make_pair(keys[i], keys[i]));
+            }
+
+            cout << setw(10) << n << fixed << setprecision(2) << setw(8) << skews[z]
+                 << setw(10) << timeLookups(avl, queries)
+                 << setw(10) << timeLookups(splay, queries)
+                 << setw(12) << timeLookups(lazy, queries) << endl;
+        }
+    }
+}
+
+/**
+ * Fills tree with keys[0..n), then runs one remove and one insert per
+ * step, sliding a window over keys so the size stays at n. Returns the
+ * seconds taken by the mixed phase and its rotations in rotations.
+ */
+template <class Tree>
+static double runMixed(Tree& tree, const vector<int>& keys, size_t n, size_t& rotations)
+{
+    for(size_t i = 0; i < n; i++){
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    size_t before = tree.getRotationCount();
+    double start = now();
+    for(size_t i = n; i < keys.size(); i++){
+        tree.remove(keys[i - n]);
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    double elapsed = now() - start;
+    rotations = tree.getRotationCount() - before;
+    return elapsed;
+}
+
+/**
+ * Rotations and latency of RedBlackTree against AVLTree on a mixed
+ * insert/delete workload.
+ */
+static void benchRBTree(size_t maxSize)
+{
+    cout << "rbtree: one remove + one insert per step" << endl;
+    cout << setw(10) << "nodes" << setw(8) << "engine" << setw(12) << "ns/step"
+         << setw(12) << "rot/step" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        size_t steps = (n < (1 << 20)) ? (1 << 20) : n;
+        vector<int> keys = shuffledKeys(n + steps, 5);
+
+        AVLTree<int, int> avl;
+        RedBlackTree<int, int> rb;
+        size_t avlRot, rbRot;
+        double avlTime = runMixed(avl, keys, n, avlRot);
+        double rbTime = runMixed(rb, keys, n, rbRot);
+
+        cout << fixed;
+        cout << setw(10) << n << setw(8) << "AVL"
+             << setprecision(1) << setw(12) << avlTime / steps * 1e9
+             << setprecision(3) << setw(12) << double(avlRot) / steps << endl;
+        cout << setw(10) << n << setw(8) << "RB"
+             << setprecision(1) << setw(12) << rbTime / steps * 1e9
+             << setprecision(3) << setw(12) << double(rbRot) / steps << endl;
+    }
+}
+
+/**
+ * Fills tree with 0..n-1 in sorted order and returns ns per insert.
+ */
+template <class Tree>
+static double timeSortedIngest(Tree& tree, size_t n)
+{
+    double start = now();
+    for(size_t i = 0; i < n; i++){
+        tree.insert(make_pair(int(i), int(i)));
+    }
+    return (now() - start) / n * 1e9;
+}
+
+/**
+ * Sorted ingest into the plain BinarySearchTree with and without the
+ * scapegoat policy, then random lookups. The plain tree degenerates
+ * into a list, so it is only run on the smaller sizes.
+ */
+static void benchScapegoat(size_t maxSize)
+{
+    const size_t plainLimit = 1 << 14;
+    const size_t lookups = 1 << 18;
+
+    cout << "scapegoat: sorted ingest (ns/insert), then random lookups (Mops/s)" << endl;
+    cout << setw(10) << "nodes" << setw(14) << "plain ins" << setw(12) << "sg ins"
+         << setw(14) << "plain find" << setw(12) << "sg find" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        vector<int> queries = shuffledKeys(n, 6);
+        queries.resize(min(n, lookups));
+
+        BinarySearchTree<int, int> sg;
+        sg.setScapegoat(true);
+        double sgIns = timeSortedIngest(sg, n);
+        double sgFind = timeLookups(sg, queries);
+
+        cout << setw(10) << n << fixed << setprecision(1);
+        if(n <= plainLimit){
+            BinarySearchTree<int, int> plain;
+            double plainIns = timeSortedIngest(plain, n);
+            cout << setw(14) << plainIns << setw(12) << sgIns
+                 << setprecision(2) << setw(14) << timeLookups(plain, queries);
+        }
+        else{
+            cout << setw(14) << "-" << setw(12) << sgIns << setw(14) << "-";
+        }
+        cout << setprecision(2) << setw(12) << sgFind << endl;
+    }
+}
+
+/**
+ * Builds a plain BinarySearchTree from a partially sorted feed (sorted
+ * runs of 64 keys, runs in random order), then times rebalance() and
+ * random lookups before and after it.
+ */
+static void benchRebalance(size_t maxSize)
+{
+    const size_t run = 64;
+    const size_t lookups = 1 << 20;
+
+    cout << "rebalance: feed of sorted runs of " << run << " keys" << endl;
+    cout << setw(10) << "nodes" << setw(10) << "height" << setw(14) << "find Mops/s"
+         << setw(14) << "rebalance ms" << setw(10) << "height" << setw(14) << "find Mops/s" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        vector<int> runs = shuffledKeys(n / run, 7);
+        BinarySearchTree<int, int> tree;
+        for(size_t r = 0; r < runs.size(); r++){
+            for(size_t i = 0; i < run; i++){
+                int key = runs[r] * int(run) + int(i);
+                tree.insert(make_pair(key, key));
+            }
+        }
+        vector<int> queries = shuffledKeys(n, 8);
+        queries.resize(min(n, lookups));
+
+        int before = tree.height();
+        double findBefore = timeLookups(tree, queries);
+        double start = now();
+        tree.rebalance();
+        double elapsed = now() - start;
+        int after = tree.height();
+        double findAfter = timeLookups(tree, queries);
+
+        cout << setw(10) << n << setw(10) << before << fixed << setprecision(2)
+             << setw(14) << findBefore << setw(14) << elapsed * 1e3
+             << setw(10) << after << setw(14) << findAfter << endl;
+    }
+}
+
+/**
+ * Average and worst-case rebalancing work per AVLTree insert and
+ * remove, from getLastFixStats(), next to log2(n).
+ */
+static void benchAVLFix(size_t maxSize)
+{
+    cout << "avlfix: levels visited and rotations per operation (avg / max)" << endl;
+    cout << setw(10) << "nodes" << setw(8) << "log2 n" << setw(16) << "insert levels"
+         << setw(16) << "insert rots" << setw(16) << "remove levels" << setw(16) << "remove rots" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 10);
+        AVLTree<int, int> tree;
+        size_t insLevels = 0, insRots = 0, maxInsLevels = 0, maxInsRots = 0;
+        for(size_t i = 0; i < n; i++){
+            tree.insert(make_pair(keys[i], keys[i]));
+            AVLFixStats stats = tree.getLastFixStats();
+            insLevels += stats.levels;
+            insRots += stats.rotations;
+            maxInsLevels = max(maxInsLevels, stats.levels);
+            maxInsRots = max(maxInsRots, stats.rotations);
+        }
+        shuffle(keys.begin(), keys.end(), mt19937(11));
+        size_t remLevels = 0, remRots = 0, maxRemLevels = 0, maxRemRots = 0;
+        for(size_t i = 0; i < n; i++){
+            tree.remove(keys[i]);
+            AVLFixStats stats = tree.getLastFixStats();
+            remLevels += stats.levels;
+            remRots += stats.rotations;
+            maxRemLevels = max(maxRemLevels, stats.levels);
+            maxRemRots = max(maxRemRots, stats.rotations);
+        }
+
+        cout << setw(10) << n << fixed << setprecision(1) << setw(8) << log2(double(n))
+             << setprecision(2)
+             << setw(10) << double(insLevels) / n << " / " << setw(3) << maxInsLevels
+             << setw(10) << double(insRots) / n << " / " << setw(3) << maxInsRots
+             << setw(10) << double(remLevels) / n << " / " << setw(3) << maxRemLevels
+             << setw(10) << double(remRots) / n << " / " << setw(3) << maxRemRots << endl;
+    }
+}
+
+/**
+ * Random-key ingest into a settled AVLTree against a burst followed by
+ * settle(), plus the slowest settleStep() with a fixed budget.
+ */
+static void benchBurst(size_t maxSize)
+{
+    const size_t budget = 4096;
+
+    cout << "burst: random ingest, ns/insert; settle step budget " << budget << endl;
+    cout << setw(10) << "nodes" << setw(10) << "strict" << setw(10) << "burst"
+         << setw(14) << "settle/key" << setw(10) << "total" << setw(14) << "max step us" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 12);
+
+        AVLTree<int, int> strict;
+        double start = now();
+        for(size_t i = 0; i < n; i++){
+            strict.insert(make_pair(keys[i], keys[i]));
+        }
+        double strictTime = now() - start;
+
+        AVLTree<int, int> relaxed;
+        relaxed.beginBurst();
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            relaxed.insert(make_pair(keys[i], keys[i]));
+        }
+        double burstTime = now() - start;
+        double maxStep = 0;
+        double settleStart = now();
+        bool done = false;
+        while(!done){
+            double stepStart = now();
+            done = relaxed.settleStep(budget);
+            maxStep = max(maxStep, now() - stepStart);
+        }
+        double settleTime = now() - settleStart;
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(10) << strictTime / n * 1e9 << setw(10) << burstTime / n * 1e9
+             << setw(14) << settleTime / n * 1e9 << setw(10) << (burstTime + settleTime) / n * 1e9
+             << setw(14) << maxStep * 1e6 << endl;
+    }
+}
+
+/**
+ * Time-series style ingest into AVLTree: strictly increasing keys, and
+ * increasing keys with 1% arriving late, against random order. Also
+ * reports the average fix-up levels per increasing insert.
+ */
+static void benchAppend(size_t maxSize)
+{
+    cout << "append: AVLTree ingest, ns/insert" << endl;
+    cout << setw(10) << "nodes" << setw(12) << "increasing" << setw(12) << "1% late"
+         << setw(10) << "random" << setw(14) << "fix levels" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        AVLTree<int, int> sorted;
+        size_t levels = 0;
+        double start = now();
+        for(size_t i = 0; i < n; i++){
+            sorted.insert(make_pair(int(i), int(i)));
+            levels += sorted.getLastFixStats().levels;
+        }
+        double sortedTime = now() - start;
+
+        // every 100th key is held back and inserted 50 keys later
+        vector<int> late(n);
+        for(size_t i = 0; i < n; i++){
+            late[i] = int(i);
+        }
+        for(size_t i = 0; i + 50 < n; i += 100){
+            rotate(late.begin() + i, late.begin() + i + 1, late.begin() + i + 51);
+        }
+        AVLTree<int, int> mostly;
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            mostly.insert(make_pair(late[i], late[i]));
+        }
+        double lateTime = now() - start;
+
+        vector<int> keys = shuffledKeys(n, 13);
+        AVLTree<int, int> random;
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            random.insert(make_pair(keys[i], keys[i]));
+        }
+        double randomTime = now() - start;
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(12) << sortedTime / n * 1e9 << setw(12) << lateTime / n * 1e9
+             << setw(10) << randomTime / n * 1e9
+             << setprecision(2) << setw(14) << double(levels) / n << endl;
+    }
+}
+
+// Expiry predicate for benchSweep: drops every other key
+static bool isOdd(const pair<const int, int>& item)
+{
+    return (item.first & 1) != 0;
+}
+
+/**
+ * Expiry sweep over an AVLTree removing half of the keys: collecting
+ * the keys and calling remove() on each, against erase_if().
+ */
+static void benchSweep(size_t maxSize)
+{
+    cout << "sweep: remove every odd key from an AVLTree, ns/removed key" << endl;
+    cout << setw(10) << "nodes" << setw(14) << "remove(key)" << setw(12) << "erase_if" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 14);
+        AVLTree<int, int> byKey, inPlace;
+        for(size_t i = 0; i < n; i++){
+            byKey.insert(make_pair(keys[i], keys[i]));
+            inPlace.insert(make_pair(keys[i], keys[i]));
+        }
+
+        double start = now();
+        vector<int> expired;
+        for(AVLTree<int, int>::iterator it = byKey.begin(); it != byKey.end(); ++it){
+            if(isOdd(*it)){
+                expired.push_back(it->first);
+            }
+        }
+        for(size_t i = 0; i < expired.size(); i++){
+            byKey.remove(expired[i]);
+        }
+        double byKeyTime = now() - start;
+
+        start = now();
+        size_t removed = inPlace.erase_if(isOdd);
+        double inPlaceTime = now() - start;
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(14) << byKeyTime / expired.size() * 1e9
+             << setw(12) << inPlaceTime / removed * 1e9 << endl;
+    }
+}
+
+/**
+ * Drops the oldest quarter of an AVLTree keyed by time, as a window
+ * expiry would: one remove() per key against a single eraseRange().
+ */
+static void benchRange(size_t maxSize)
+{
+    cout << "range: erase the lowest quarter of an AVLTree, ns/removed key" << endl;
+    cout << setw(10) << "nodes" << setw(14) << "remove(key)" << setw(12) << "eraseRange" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 15);
+        AVLTree<int, int> byKey, byRange;
+        for(size_t i = 0; i < n; i++){
+            byKey.insert(make_pair(keys[i], keys[i]));
+            byRange.insert(make_pair(keys[i], keys[i]));
+        }
+        int cutoff = static_cast<int>(n / 4);
+
+        double start = now();
+        for(int k = 0; k < cutoff; k++){
+            byKey.remove(k);
+        }
+        double byKeyTime = now() - start;
+
+        start = now();
+        size_t removed = byRange.eraseRange(0, cutoff);
+        double byRangeTime = now() - start;
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(14) << byKeyTime / cutoff * 1e9
+             << setw(12) << byRangeTime / removed * 1e9 << endl;
+    }
+}
+
+/**
+ * Moves every key from a "recent" AVLTree to an "archive" one, with
+ * string values so copies cost something: remove() plus insert() of a
+ * copied pair, against extract() plus insert() of the node handle.
+ */
+static void benchMigrate(size_t maxSize)
+{
+    cout << "migrate: move all keys between AVLTrees, ns/key" << endl;
+    cout << setw(10) << "nodes" << setw(14) << "copy+remove" << setw(12) << "extract" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 16);
+        string payload(48, 'x');
+        AVLTree<int, string> recentA, archiveA, recentB, archiveB;
+        for(size_t i = 0; i < n; i++){
+            recentA.insert(make_pair(keys[i], payload));
+            recentB.insert(make_pair(keys[i], payload));
+        }
+
+        double start = now();
+        for(size_t i = 0; i < n; i++){
+            archiveA.insert(make_pair(keys[i], recentA[keys[i]]));
+            recentA.remove(keys[i]);
+        }
+        double copyTime = now() - start;
+
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            archiveB.insert(recentB.extract(keys[i]));
+        }
+        double extractTime = now() - start;
+
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(14) << copyTime / n * 1e9
+             << setw(12) << extractTime / n * 1e9 << endl;
+    }
+}
+
+/**
+ * Uniform random point lookups on an AVLTree with and without the hash
+ * index, and what the index costs in memory per key.
+ */
+static void benchHashIndex(size_t maxSize)
+{
+    const size_t lookups = 1 << 21;
+    cout << "hashindex: AVLTree find(), millions of lookups/sec" << endl;
+    cout << setw(10) << "nodes" << setw(10) << "tree" << setw(10) << "indexed"
+         << setw(10) << "speedup" << setw(14) << "index B/key" << setw(13) << "node B/key" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 17);
+        AVLTree<int, int> tree;
+        for(size_t i = 0; i < n; i++){
+            tree.insert(make_pair(keys[i], keys[i]));
+        }
+        mt19937 gen(18);
+        vector<int> queries(lookups);
+        for(size_t i = 0; i < lookups; i++){
+            queries[i] = keys[gen() % n];
+        }
+
+        double plain = timeLookups(tree, queries);
+        tree.setHashIndex(true);
+        double indexed = timeLookups(tree, queries);
+
+        cout << setw(10) << n << fixed << setprecision(2)
+             << setw(10) << plain << setw(10) << indexed
+             << setw(10) << indexed / plain
+             << setw(14) << double(tree.hashIndexBytes()) / n
+             << setw(13) << sizeof(AVLNode<int, int>) << endl;
+    }
+}
+
+/**
+ * LSMStore on local files for several compaction fanouts: ingest with
+ * one remove per 8 operations, then lookups of present and of missing
+ * keys, with the write and read amplification of each phase.
+ */
+static void benchLsm(size_t maxOps)
+{
+    const char* base = "bst-bench-lsm";
+    const size_t fanouts[] = { 2, 4, 8 };
+    size_t ops = min(maxOps, size_t(1) << 20);
+    const size_t lookups = 1 << 16;
+
+    cout << "lsm: " << ops << " writes through a 256 KB memtable, " << lookups
+         << " lookups per column" << endl;
+    cout << setw(8) << "fanout" << setw(12) << "writes/s" << setw(7) << "runs"
+         << setw(12) << "write amp" << setw(12) << "hits/s" << setw(10) << "read amp"
+         << setw(12) << "misses/s" << setw(10) << "read amp" << endl;
+
+    for(size_t f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); f++){
+        string manifest = string(base) + ".manifest";
+        remove(manifest.c_str());
+        LsmOptions options;
+        options.memtableBytes = 256 << 10;
+        options.fanout = fanouts[f];
+        LSMStore<int, int> store(base, options);
+
+        vector<int> keys;
+        mt19937 gen(21);
+        double start = now();
+        for(size_t i = 0; i < ops; i++){
+            int key = static_cast<int>(gen() % (4 * ops));
+            if(i % 8 == 7){
+                store.remove(key);
+            }
+            else{
+                store.insert(make_pair(key, static_cast<int>(i)));
+                keys.push_back(key);
+            }
+        }
+        store.flush();
+        store.waitForCompaction();
+        double ingest = ops / (now() - start);
+        LsmStats written = store.stats();
+
+        // odd keys past the key range are never present
+        double rate[2], amp[2];
+        for(int miss = 0; miss < 2; miss++){
+            LsmStats before = store.stats();
+            int value;
+            start = now();
+            for(size_t i = 0; i < lookups; i++){
+                int key = miss ? static_cast<int>(4 * ops + 2 * i + 1) : keys[gen() % keys.size()];
+                store.find(key, value);
+            }
+            rate[miss] = lookups / (now() - start);
+            amp[miss] = double(store.stats().blockReads - before.blockReads) / lookups;
+        }
+
+        cout << setw(8) << fanouts[f] << fixed << setprecision(0) << setw(12) << ingest
+             << setw(7) << store.runCount()
+             << setprecision(2) << setw(12)
+             << double(written.flushBytes + written.compactionBytes) / written.userBytes
+             << setprecision(0) << setw(12) << rate[0] << setprecision(2) << setw(10) << amp[0]
+             << setprecision(0) << setw(12) << rate[1] << setprecision(2) << setw(10) << amp[1] << endl;
+    }
+    // the last store has closed; drop its files
+    string cleanup = string("rm -f ") + base + "-*.run " + base + ".manifest";
+    if(system(cleanup.c_str()) != 0){
+        cout << "could not remove " << base << " files" << endl;
+    }
+}
+
+/**
+ * Lookups of URL-like string keys that share long prefixes, in an
+ * AVLTree (whole-key comparisons at every level) and in an ArtMap (one
+ * node per key byte), with the memory each uses per key.
+ */
+static void benchArt(size_t maxSize)
+{
+    const size_t lookups = 1 << 20;
+    cout << "art: URL keys, millions of lookups/sec" << endl;
+    cout << setw(10) << "keys" << setw(10) << "avl" << setw(10) << "art"
+         << setw(10) << "speedup" << setw(12) << "art B/key" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        vector<int> ids = shuffledKeys(n, 23);
+        vector<string> keys(n);
+        for(size_t i = 0; i < n; i++){
+            keys[i] = "https://www.example.com/catalog/section-" + to_string(ids[i] % 64)
+                    + "/product/" + to_string(ids[i]) + "?ref=homepage";
+        }
+        AVLTree<string, int> tree;
+        ArtMap<int> art;
+        for(size_t i = 0; i < n; i++){
+            tree.insert(make_pair(keys[i], ids[i]));
+            art.insert(make_pair(keys[i], ids[i]));
+        }
+        mt19937 gen(24);
+        vector<string> queries(lookups);
+        for(size_t i = 0; i < lookups; i++){
+            queries[i] = keys[gen() % n];
+        }
+
+        long sum = 0;
+        double start = now();
+        for(size_t i = 0; i < lookups; i++){
+            sum += tree.find(queries[i])->second;
+        }
+        double avl = lookups / (now() - start) / 1e6;
+        start = now();
+        for(size_t i = 0; i < lookups; i++){
+            sum -= art.find(queries[i])->second;
+        }
+        double radix = lookups / (now() - start) / 1e6;
+        if(sum != 0){
+            cout << "lookups disagree" << endl;
+        }
+
+        cout << setw(10) << n << fixed << setprecision(2)
+             << setw(10) << avl << setw(10) << radix << setw(10) << radix / avl
+             << setprecision(1) << setw(12) << double(art.memoryBytes()) / n << endl;
+    }
+}
+
+/**
+ * Finding the keys two replicas disagree on: MerkleAVLTree::diff(), in
+ * process and over a pipe to a server thread, against walking both
+ * trees in full. The replicas are built in different orders, so their
+ * shapes differ.
+ */
+static void benchMerkle(size_t maxSize)
+{
+    size_t n = min(maxSize, size_t(1) << 20);
+    const size_t diffs[] = { 1, 10, 100, 1000 };
+    cout << "merkle: " << n << " keys per replica, times in ms" << endl;
+    cout << setw(8) << "diffs" << setw(10) << "walk" << setw(10) << "diff" << setw(10) << "ranges"
+         << setw(10) << "pipe" << setw(12) << "pipe KB" << endl;
+
+    vector<int> keys = shuffledKeys(n, 31);
+    MerkleAVLTree<int, int> here, there;
+    for(size_t i = 0; i < n; i++){
+        here.insert(make_pair(keys[i], keys[i]));
+        there.insert(make_pair(keys[n - 1 - i], keys[n - 1 - i]));
+    }
+    mt19937 gen(32);
+    size_t changed = 0;
+    for(size_t d = 0; d < sizeof(diffs) / sizeof(diffs[0]); d++){
+        for(; changed < diffs[d]; changed++){
+            there.insert(make_pair(keys[gen() % n], -1 - static_cast<int>(changed)));
+        }
+
+        double start = now();
+        size_t walked = 0;
+        MerkleAVLTree<int, int>::iterator a = here.begin(), b = there.begin();
+        for(; a != here.end(); ++a, ++b){
+            if(a->first != b->first || a->second != b->second){
+                walked++;
+            }
+        }
+        double walk = now() - start;
+
+        vector<MerkleDelta<int, int> > deltas;
+        start = now();
+        size_t ranges = here.diff(there, deltas);
+        double local = now() - start;
+
+        int request[2], reply[2];
+        if(pipe(request) != 0 || pipe(reply) != 0){
+            cout << "pipe failed" << endl;
+            return;
+        }
+        thread server(serveMerkle<int, int>, std::cref(there), request[0], reply[1]);
+        vector<MerkleDelta<int, int> > remote;
+        double piped;
+        uint64_t bytes;
+        {
+            MerklePipePeer<int, int> peer(reply[0], request[1]);
+            start = now();
+            here.diff(peer, remote);
+            piped = now() - start;
+            bytes = peer.bytesSent() + peer.bytesReceived();
+        }
+        server.join();
+        close(request[0]);
+        close(request[1]);
+        close(reply[0]);
+        close(reply[1]);
+        if(walked != deltas.size() || remote.size() != deltas.size()){
+            cout << "diffs disagree" << endl;
+        }
+
+        cout << setw(8) << deltas.size() << fixed << setprecision(2)
+             << setw(10) << walk * 1e3 << setw(10) << local * 1e3 << setw(10) << ranges
+             << setw(10) << piped * 1e3 << setprecision(1) << setw(12) << bytes / 1024.0 << endl;
+    }
+}
+
+/**
+ * The runMixed() workload with every remove timed on its own. Fills
+ * latencies with the remove times in seconds and returns the seconds
+ * taken by the whole mixed phase.
+ */
+static double runTimedRemoves(AVLTree<int, int>& tree, const vector<int>& keys, size_t n,
+                              vector<double>& latencies)
+{
+    for(size_t i = 0; i < n; i++){
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    latencies.clear();
+    latencies.reserve(keys.size() - n);
+    double start = now();
+    for(size_t i = n; i < keys.size(); i++){
+        double t = now();
+        tree.remove(keys[i - n]);
+        latencies.push_back(now() - t);
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    double elapsed = now() - start;
+    sort(latencies.begin(), latencies.end());
+    return elapsed;
+}
+
+/**
+ * Eager removal against tombstones with batched compaction on the
+ * mixed workload: ns per remove+insert step and the remove latency
+ * percentiles. The max includes the compactions.
+ */
+static void benchTombstone(size_t maxSize)
+{
+    cout << "tombstone: one remove + one insert per step, remove latency in ns" << endl;
+    cout << setw(10) << "nodes" << setw(11) << "mode" << setw(10) << "ns/step"
+         << setw(8) << "p50" << setw(8) << "p99" << setw(9) << "p99.9" << setw(12) << "max" << endl;
+
+    const char* modes[] = { "eager", "tomb 0.1", "tomb 0.25" };
+    const double fractions[] = { 0, 0.1, 0.25 };
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        size_t steps = (n < (1 << 20)) ? (1 << 20) : n;
+        vector<int> keys = shuffledKeys(n + steps, 5);
+
+        for(int m = 0; m < 3; m++){
+            AVLTree<int, int> tree;
+            if(fractions[m] > 0){
+                tree.setTombstoneMode(true, fractions[m]);
+            }
+            vector<double> lat;
+            double elapsed = runTimedRemoves(tree, keys, n, lat);
+            cout << setw(10) << n << setw(11) << modes[m] << fixed << setprecision(1)
+                 << setw(10) << elapsed / steps * 1e9
+                 << setprecision(0)
+                 << setw(8) << lat[lat.size() / 2] * 1e9
+                 << setw(8) << lat[lat.size() * 99 / 100] * 1e9
+                 << setw(9) << lat[lat.size() * 999 / 1000] * 1e9
+                 << setw(12) << lat.back() * 1e9 << endl;
+        }
+    }
+}
+
+/**
+ * One thread's share of the hot-set workload: half inserts, a quarter
+ * removes and a quarter finds, all on keys below hot.
+ */
+template <class Apply>
+static void hotSetWorker(Apply& apply, size_t ops, size_t hot, unsigned seed)
+{
+    mt19937 gen(seed);
+    for(size_t i = 0; i < ops; i++){
+        unsigned r = gen();
+        int key = static_cast<int>((r >> 2) % hot);
+        apply(r & 3, key);
+    }
+}
+
+// Hot-set operations on an AVLTree behind one mutex
+struct MutexTreeOps
+{
+    AVLTree<int, int>* tree;
+    mutex* lock;
+    void operator()(unsigned op, int key)
+    {
+        lock_guard<mutex> guard(*lock);
+        if(op < 2){
+            tree->insert(make_pair(key, key));
+        }
+        else if(op == 2){
+            tree->remove(key);
+        }
+        else{
+            tree->find(key);
+        }
+    }
+};
+
+// Hot-set operations through a CombiningAVLTree session
+struct CombiningOps
+{
+    CombiningAVLTree<int, int>::Session* session;
+    void operator()(unsigned op, int key)
+    {
+        int value;
+        if(op < 2){
+            session->insert(make_pair(key, key));
+        }
+        else if(op == 2){
+            session->remove(key);
+        }
+        else{
+            session->find(key, value);
+        }
+    }
+};
+
+/**
+ * A write-heavy workload on a small hot set of keys in a large tree,
+ * shared by 1 to 32 threads: a mutex around AVLTree against the
+ * flat-combining front end, in millions of operations per second, with
+ * the average number of requests each combining pass applied.
+ */
+static void benchCombining(size_t maxOps)
+{
+    const size_t treeSize = 1 << 18;
+    const size_t hot = 1024;
+    vector<int> keys = shuffledKeys(treeSize, 23);
+    cout << "combining: " << maxOps << " ops on " << hot << " hot keys of " << treeSize
+         << ", " << thread::hardware_concurrency() << " hardware threads" << endl;
+    cout << setw(8) << "threads" << setw(10) << "mutex" << setw(12) << "combining"
+         << setw(10) << "speedup" << setw(10) << "batch" << endl;
+
+    for(size_t threads = 1; threads <= 32; threads *= 2){
+        size_t ops = maxOps / threads;
+
+        AVLTree<int, int> plain;
+        mutex plainLock;
+        CombiningAVLTree<int, int> combined;
+        for(size_t i = 0; i < treeSize; i++){
+            plain.insert(make_pair(keys[i], keys[i]));
+            combined.tree().insert(make_pair(keys[i], keys[i]));
+        }
+
+        vector<thread> workers;
+        double start = now();
+        for(size_t t = 0; t < threads; t++){
+            workers.push_back(thread([&, t]{
+                MutexTreeOps apply = { &plain, &plainLock };
+                hotSetWorker(apply, ops, hot, 100 + t);
+            }));
+        }
+        for(size_t t = 0; t < threads; t++){
+            workers[t].join();
+        }
+        double mutexRate = ops * threads / (now() - start) / 1e6;
+
+        workers.clear();
+        start = now();
+        for(size_t t = 0; t < threads; t++){
+            workers.push_back(thread([&, t]{
+                CombiningAVLTree<int, int>::Session session(combined);
+                CombiningOps apply = { &session };
+                hotSetWorker(apply, ops, hot, 100 + t);
+            }));
+        }
+        for(size_t t = 0; t < threads; t++){
+            workers[t].join();
+        }
+        double combinedRate = ops * threads / (now() - start) / 1e6;
+        CombiningStats st = combined.stats();
+
+        cout << setw(8) << threads << fixed << setprecision(2)
+             << setw(10) << mutexRate << setw(12) << combinedRate
+             << setw(10) << combinedRate / mutexRate
+             << setw(10) << double(st.operations) / st.passes << endl;
+    }
+}
+
+/**
+ * Draws keys below n from a skewed distribution: low keys are hot.
+ */
+static vector<int> skewedKeys(size_t count, size_t n, unsigned seed)
+{
+    mt19937 gen(seed);
+    uniform_real_distribution<double> u(0, 1);
+    vector<int> keys(count);
+    for(size_t i = 0; i < count; i++){
+        double x = u(gen);
+        keys[i] = static_cast<int>(x * x * x * n);
+    }
+    return keys;
+}
+
+/**
+ * Runs get-or-load over keys on an OrderedCache and returns the seconds
+ * taken; a miss inserts the key.
+ */
+static double runOrderedCache(OrderedCache<int, int>& cache, const vector<int>& keys)
+{
+    double start = now();
+    for(size_t i = 0; i < keys.size(); i++){
+        if(cache.find(keys[i]) == cache.end()){
+            cache.insert(make_pair(keys[i], keys[i]));
+        }
+    }
+    return now() - start;
+}
+
+// A list position stored as a tree value; print() needs operator<<
+struct ListPosition
+{
+    list<int>::iterator pos;
+    friend ostream& operator<<(ostream& out, const ListPosition&) { return out << "pos"; }
+};
+
+/**
+ * The same get-or-load loop on the setup OrderedCache replaces: an
+ * AVLTree whose values hold a position in a separate std::list kept in
+ * recency order, with a second tree lookup to remove each victim.
+ */
+static double runListCache(size_t capacity, const vector<int>& keys, size_t& hits)
+{
+    AVLTree<int, ListPosition> tree;
+    list<int> recency;
+    hits = 0;
+    double start = now();
+    for(size_t i = 0; i < keys.size(); i++){
+        AVLTree<int, ListPosition>::iterator it = tree.find(keys[i]);
+        if(it != tree.end()){
+            recency.splice(recency.begin(), recency, it->second.pos);
+            hits++;
+            continue;
+        }
+        if(tree.size() >= capacity){
+            tree.remove(recency.back());
+            recency.pop_back();
+        }
+        recency.push_front(keys[i]);
+        ListPosition p = { recency.begin() };
+        tree.insert(make_pair(keys[i], p));
+    }
+    return now() - start;
+}
+
+/**
+ * Get-or-load on a skewed key stream for several cache sizes: the
+ * AVLTree + std::list LRU against OrderedCache with LRU and LFU
+ * eviction, in millions of requests per second, with hit rates.
+ */
+static void benchCache(size_t maxSize)
+{
+    const size_t requests = 1 << 22;
+    cout << "cache: get-or-load, Mreq/s (hit %)" << endl;
+    cout << setw(10) << "capacity" << setw(18) << "tree+list LRU" << setw(18) << "OrderedCache LRU"
+         << setw(18) << "OrderedCache LFU" << endl;
+
+    for(size_t capacity = 1 << 10; capacity <= maxSize; capacity <<= 2){
+        vector<int> keys = skewedKeys(requests, capacity * 16, 31);
+        size_t listHits;
+        double listTime = runListCache(capacity, keys, listHits);
+        OrderedCache<int, int> lru(capacity, CACHE_LRU);
+        OrderedCache<int, int> lfu(capacity, CACHE_LFU);
+        double lruTime = runOrderedCache(lru, keys);
+        double lfuTime = runOrderedCache(lfu, keys);
+
+        cout << setw(10) << capacity << fixed << setprecision(2)
+             << setw(10) << requests / listTime / 1e6
+             << " (" << setw(4) << setprecision(1) << 100.0 * listHits / requests << ")"
+             << setprecision(2) << setw(10) << requests / lruTime / 1e6
+             << " (" << setw(4) << setprecision(1) << 100.0 * lru.stats().hits / requests << ")"
+             << setprecision(2) << setw(10) << requests / lfuTime / 1e6
+             << " (" << setw(4) << setprecision(1) << 100.0 * lfu.stats().hits / requests << ")" << endl;
+    }
+}
+
+// An order record: the key, a 64-byte payload, and a hook for the
+// intrusive tree
+struct OrderRecord
+{
+    int id;
+    char payload[64];
+    AVLHook hook;
+    friend ostream& operator<<(ostream& out, const OrderRecord& r) { return out << r.id; }
+};
+
+typedef IntrusiveAVLTree<OrderRecord, int, &OrderRecord::id, &OrderRecord::hook> OrderIndex;
+
+/**
+ * Indexing records that already live in an arena: AVLTree<int,
+ * OrderRecord>, which allocates a node and copies each record, against
+ * IntrusiveAVLTree linking the records in place. ns per insert and per
+ * remove, and heap bytes per record beyond the arena.
+ */
+static void benchIntrusive(size_t maxSize)
+{
+    cout << "intrusive: index arena records by id" << endl;
+    cout << setw(10) << "records" << setw(11) << "engine" << setw(10) << "insert"
+         << setw(10) << "remove" << setw(12) << "heap B/rec" << endl;
+
+    for(size_t n = 1 << 12; n <= maxSize; n <<= 2){
+        vector<int> keys = shuffledKeys(n, 37);
+        vector<OrderRecord> arena(n);
+        for(size_t i = 0; i < n; i++){
+            arena[i].id = keys[i];
+            memset(arena[i].payload, 0, sizeof(arena[i].payload));
+        }
+        vector<size_t> order(n);
+        for(size_t i = 0; i < n; i++){
+            order[i] = (keys[i] * 7919u) % n;
+        }
+
+        AVLTree<int, OrderRecord> copied;
+        double start = now();
+        for(size_t i = 0; i < n; i++){
+            copied.insert(make_pair(arena[i].id, arena[i]));
+        }
+        double copyInsert = now() - start;
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            copied.remove(arena[order[i]].id);
+        }
+        double copyRemove = now() - start;
+
+        OrderIndex linked;
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            linked.insert(arena[i]);
+        }
+        double linkInsert = now() - start;
+        start = now();
+        for(size_t i = 0; i < n; i++){
+            linked.remove(arena[order[i]]);
+        }
+        double linkRemove = now() - start;
+
+        cout << fixed << setprecision(1);
+        cout << setw(10) << n << setw(11) << "AVLTree"
+             << setw(10) << copyInsert / n * 1e9 << setw(10) << copyRemove / n * 1e9
+             << setw(12) << sizeof(AVLNode<int, OrderRecord>) << endl;
+        cout << setw(10) << n << setw(11) << "intrusive"
+             << setw(10) << linkInsert / n * 1e9 << setw(10) << linkRemove / n * 1e9
+             << setw(12) << 0 << endl;
+    }
+}
+
+static void benchMultimap(size_t maxSize)
+{
+    cout << "multimap: n items over n/dups distinct keys" << endl;
+    cout << setw(10) << "items" << setw(6) << "dups" << setw(13) << "engine" << setw(10) << "insert"
+         << setw(10) << "count" << setw(8) << "nodes" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        for(size_t dups = 1; dups <= 64; dups <<= 3){
+            size_t distinct = n / dups;
+            vector<int> keys(n);
+            mt19937 gen(41);
+            for(size_t i = 0; i < n; i++){
+                keys[i] = static_cast<int>(gen() % distinct);
+            }
+
+            AVLMultiMap<int, int> items;
+            double start = now();
+            for(size_t i = 0; i < n; i++){
+                items.insert(make_pair(keys[i], static_cast<int>(i)));
+            }
+            double mapInsert = now() - start;
+            size_t total = 0;
+            start = now();
+            for(size_t k = 0; k < distinct; k++){
+                total += items.count(static_cast<int>(k));
+            }
+            double mapCount = now() - start;
+
+            double setInsert[2], setCount[2];
+            size_t setNodes[2];
+            for(int compressed = 0; compressed < 2; compressed++){
+                AVLMultiSet<int> copies(compressed != 0);
+                start = now();
+                for(size_t i = 0; i < n; i++){
+                    copies.insert(keys[i]);
+                }
+                setInsert[compressed] = now() - start;
+                start = now();
+                for(size_t k = 0; k < distinct; k++){
+                    total += copies.count(static_cast<int>(k));
+                }
+                setCount[compressed] = now() - start;
+                setNodes[compressed] = copies.AVLTree<int, size_t>::size();
+            }
+            if(total != 3 * n){
+                cout << "count mismatch" << endl;
+            }
+
+            cout << fixed << setprecision(1);
+            cout << setw(10) << n << setw(6) << dups << setw(13) << "multimap"
+                 << setw(10) << mapInsert / n * 1e9 << setw(10) << mapCount / distinct * 1e9
+                 << setw(8) << items.size() << endl;
+            cout << setw(10) << n << setw(6) << dups << setw(13) << "multiset"
+                 << setw(10) << setInsert[0] / n * 1e9 << setw(10) << setCount[0] / distinct * 1e9
+                 << setw(8) << setNodes[0] << endl;
+            cout << setw(10) << n << setw(6) << dups << setw(13) << "compressed"
+                 << setw(10) << setInsert[1] / n * 1e9 << setw(10) << setCount[1] / distinct * 1e9
+                 << setw(8) << setNodes[1] << endl;
+        }
+    }
+}
+
+// Inserts keys into a set-like tree and times inserts and lookups
+template<typename Tree, typename Item>
+static void runSet(const vector<Item>& items, double& insertTime, double& findTime)
+{
+    Tree t;
+    double start = now();
+    for(size_t i = 0; i < items.size(); i++){
+        t.insert(items[i]);
+    }
+    insertTime = (now() - start) / items.size() * 1e9;
+    size_t hits = 0;
+    start = now();
+    for(size_t i = 0; i < items.size(); i++){
+        hits += (t.find(items[(i * 7919) % items.size()].first) != t.end());
+    }
+    findTime = (now() - start) / items.size() * 1e9;
+    if(hits != items.size()){
+        cout << "lookup mismatch" << endl;
+    }
+}
+
+// Times AVLTree<Key, char> against AVLSet<Key> and prints node sizes
+template<typename Key>
+static void compareSet(const char* keyName, const vector<Key>& keys)
+{
+    vector<pair<const Key, char> > pairs;
+    vector<pair<const Key, KeyOnly> > bare;
+    for(size_t i = 0; i < keys.size(); i++){
+        pairs.push_back(make_pair(keys[i], char(0)));
+        bare.push_back(make_pair(keys[i], KeyOnly()));
+    }
+    double mapInsert, mapFind, setInsert, setFind;
+    runSet<AVLTree<Key, char> >(pairs, mapInsert, mapFind);
+    runSet<AVLSet<Key> >(bare, setInsert, setFind);
+
+    cout << fixed << setprecision(1);
+    cout << setw(10) << keys.size() << setw(8) << keyName << setw(18) << "AVLTree<Key,char>"
+         << setw(10) << mapInsert << setw(10) << mapFind
+         << setw(8) << sizeof(AVLNode<Key, char>) << setw(8) << sizeof(Node<Key, char>) << endl;
+    cout << setw(10) << keys.size() << setw(8) << keyName << setw(18) << "AVLSet<Key>"
+         << setw(10) << setInsert << setw(10) << setFind
+         << setw(8) << sizeof(AVLNode<Key, KeyOnly>) << setw(8) << sizeof(Node<Key, KeyOnly>) << endl;
+}
+
+static void benchSet(size_t maxSize)
+{
+    cout << "set: key-only nodes against a char value" << endl;
+    cout << setw(10) << "keys" << setw(8) << "key" << setw(18) << "engine" << setw(10) << "insert"
+         << setw(10) << "find" << setw(8) << "AVL B" << setw(8) << "BST B" << endl;
+
+    for(size_t n = 1 << 14; n <= maxSize; n <<= 2){
+        vector<int> ints = shuffledKeys(n, 43);
+        vector<long long> longs(ints.begin(), ints.end());
+        vector<string> strings;
+        for(size_t i = 0; i < n; i++){
+            strings.push_back("user:" + to_string(ints[i]));
+        }
+        compareSet("int", ints);
+        compareSet("int64", longs);
+        compareSet("string", strings);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2){
+        cout << "usage: " << argv[0] << " <benchmark> [max nodes/ops]" << endl;
+        cout << "benchmarks: findbatch mapped wal splay rbtree scapegoat rebalance avlfix burst append sweep range migrate hashindex lsm art merkle tombstone combining cache intrusive multimap set" << endl;
+        return 1;
+    }
+    string name = argv[1];
+    size_t maxSize = (argc > 2) ? strtoul(argv[2], NULL, 10) : (1 << 22);
+
+    if(name == "findbatch"){
+        benchFindBatch(maxSize);
+    }
+    else if(name == "mapped"){
+        benchMapped(maxSize);
+    }
+    else if(name == "wal"){
+        benchWal(maxSize);
+    }
+    else if(name == "splay"){
+        benchSplay(maxSize);
+    }
+    else if(name == "rbtree"){
+        benchRBTree(maxSize);
+    }
+    else if(name == "scapegoat"){
+        benchScapegoat(maxSize);
+    }
+    else if(name == "rebalance"){
+        benchRebalance(maxSize);
+    }
+    else if(name == "avlfix"){
+        benchAVLFix(maxSize);
+    }
+    else if(name == "burst"){
+        benchBurst(maxSize);
+    }
+    else if(name == "append"){
+        benchAppend(maxSize);
+    }
+    else if(name == "sweep"){
+        benchSweep(maxSize);
+    }
+    else if(name == "range"){
+        benchRange(maxSize);
+    }
+    else if(name == "migrate"){
+        benchMigrate(maxSize);
+    }
+    else if(name == "hashindex"){
+        benchHashIndex(maxSize);
+    }
+    else if(name == "lsm"){
+        benchLsm(maxSize);
+    }
+    else if(name == "art"){
+        benchArt(maxSize);
+    }
+    else if(name == "merkle"){
+        benchMerkle(maxSize);
+    }
+    else if(name == "tombstone"){
+        benchTombstone(maxSize);
+    }
+    else if(name == "combining"){
+        benchCombining(maxSize);
+    }
+    else if(name == "cache"){
+        benchCache(maxSize);
+    }
+    else if(name == "intrusive"){
+        benchIntrusive(maxSize);
+    }
+    else if(name == "multimap"){
+        benchMultimap(maxSize);
+    }
+    else if(name == "set"){
+        benchSet(maxSize);
+    }
+    else{
+        cout << "unknown benchmark " << name << endl;
+        return 1;
+    }
+    return 0;
+}
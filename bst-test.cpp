@@ -1,10 +1,29 @@
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
 #include <map>
+#include <vector>
 #include "bst.h"
 #include "avlbst.h"
+#include "splaybst.h"
+#include "rbbst.h"
+#include "art.h"
+#include "merkle_avl.h"
+#include "ordered_cache.h"
+#include "intrusive_avl.h"
+#include "avl_multi.h"
+#include "avl_wal.h"
+#include "lsm_store.h"
 
 using namespace std;
 
+// A record indexed in place by an IntrusiveAVLTree
+struct Account
+{
+    int id;
+    AVLHook hook;
+};
+
 
 int main(int argc, char *argv[])
 {
@@ -26,10 +45,36 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     bt.remove('b');
 
+    // Sorted inserts stay shallow with the scapegoat policy on
+    BinarySearchTree<int,int> sg;
+    sg.setScapegoat(true);
+    for(int i = 0; i < 100; i++) {
+        sg.insert(std::make_pair(i, i));
+    }
+    cout << "Scapegoat tree lookup of 99 gives " << sg[99] << endl;
+    cout << "Scapegoat tree holds " << sg.size() << " keys, latest three:";
+    int shown = 0;
+    for(BinarySearchTree<int,int>::reverse_iterator it = sg.rbegin(); it != sg.rend() && shown < 3; ++it, ++shown) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // rebalance() turns a chain into a complete tree
+    BinarySearchTree<int,int> chain;
+    for(int i = 0; i < 15; i++) {
+        chain.insert(std::make_pair(i, i));
+    }
+    cout << "Chain height " << chain.height();
+    chain.rebalance();
+    cout << ", after rebalance " << chain.height() << endl;
+
     // AVL Tree Tests
     AVLTree<char,int> at;
     at.insert(std::make_pair('a',1));
     at.insert(std::make_pair('b',2));
+    AVLFixStats fix = at.getLastFixStats();
+    cout << "Inserting b updated " << fix.levels << " levels with "
+         << fix.rotations << " rotations" << endl;
 
     cout << "\nAVLTree contents:" << endl;
     for(AVLTree<char,int>::iterator it = at.begin(); it != at.end(); ++it) {
@@ -41,8 +86,233 @@ int main(int argc, char *argv[])
     else {
         cout << "Did not find b" << endl;
     }
+    vector<char> batch;
+    batch.push_back('b');
+    batch.push_back('z');
+    vector<AVLTree<char,int>::iterator> found;
+    at.findBatch(batch, found);
+    cout << "Batch lookup of b and z found "
+         << (found[0] != at.end()) << " " << (found[1] != at.end()) << endl;
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Erase while iterating, without searching by key again
+    AVLTree<int,int> sweep;
+    for(int i = 0; i < 10; i++) {
+        sweep.insert(std::make_pair(i, i));
+    }
+    for(AVLTree<int,int>::iterator it = sweep.begin(); it != sweep.end(); ) {
+        if(it->first % 3 == 0) {
+            it = sweep.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    cout << "After erasing multiples of 3, " << sweep.size() << " keys remain" << endl;
+
+    // Drop a window of keys at once
+    AVLTree<int,int> window;
+    for(int i = 0; i < 100; i++) {
+        window.insert(std::make_pair(i, i));
+    }
+    size_t dropped = window.eraseRange(10, 90);
+    cout << "Dropped " << dropped << " keys, " << window.size() << " remain, balanced: "
+         << window.isBalanced() << endl;
+
+    // Move an entry to another tree without copying it
+    AVLTree<int,int> archive;
+    AVLTree<int,int>::node_type handle = window.extract(95);
+    archive.insert(std::move(handle));
+    cout << "Moved key 95: " << window.size() << " left, archive holds " << archive.size() << endl;
+
+    // Point lookups through the hash index
+    window.setHashIndex(true);
+    cout << "Indexed lookup of 97: " << window[97] << endl;
+
+    // Relaxed balance during a burst of sorted inserts, then settle
+    AVLTree<int,int> burst;
+    burst.beginBurst();
+    for(int i = 0; i < 31; i++) {
+        burst.insert(std::make_pair(i, i));
+    }
+    cout << "Burst height " << burst.height();
+    burst.settle();
+    cout << ", settled height " << burst.height() << endl;
+
+    // Removes only mark nodes until a quarter of them are tombstones
+    burst.setTombstoneMode(true, 0.25);
+    for(int i = 0; i < 10; i++) {
+        burst.remove(i);
+    }
+    cout << "Removed 10 keys lazily: " << burst.size() << " left, "
+         << burst.tombstoneCount() << " tombstones, smallest " << burst.begin()->first << endl;
+
+    // two replicas filled in opposite orders, then one key changed
+    MerkleAVLTree<int,int> primary, replica;
+    for(int i = 0; i < 100; i++) {
+        primary.insert(std::make_pair(i, i));
+        replica.insert(std::make_pair(99 - i, 99 - i));
+    }
+    replica.insert(std::make_pair(42, -42));
+    std::vector<MerkleDelta<int,int> > deltas;
+    size_t ranges = primary.diff(replica, deltas);
+    cout << "Replicas differ in " << deltas.size() << " key (" << deltas[0].key
+         << "), found in " << ranges << " range comparisons" << endl;
+
+    // A three-entry LRU cache: using 1 makes 2 the one evicted for 4
+    OrderedCache<int,int> cache(3);
+    for(int i = 1; i <= 3; i++) {
+        cache.insert(std::make_pair(i, i * 10));
+    }
+    cache.find(1);
+    cache.insert(std::make_pair(4, 40));
+    cout << "Cache holds";
+    for(OrderedCache<int,int>::iterator it = cache.begin(); it != cache.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", next victim " << cache.victim()->first << endl;
+
+    // Link records that live in an array, with no allocation or copy
+    Account accounts[5] = { {30}, {10}, {50}, {20}, {40} };
+    IntrusiveAVLTree<Account, int, &Account::id, &Account::hook> byId;
+    for(int i = 0; i < 5; i++) {
+        byId.insert(accounts[i]);
+    }
+    byId.remove(accounts[0]);
+    cout << "Accounts by id:";
+    for(IntrusiveAVLTree<Account, int, &Account::id, &Account::hook>::iterator it = byId.begin(); it != byId.end(); ++it) {
+        cout << " " << it->id;
+    }
+    cout << endl;
+
+    // Duplicate keys keep their insertion order
+    AVLMultiMap<string,int> visits;
+    visits.insert(std::make_pair(string("bob"), 1));
+    visits.insert(std::make_pair(string("amy"), 2));
+    visits.insert(std::make_pair(string("bob"), 3));
+    visits.insert(std::make_pair(string("bob"), 4));
+    cout << "bob visited " << visits.count("bob") << " times:";
+    std::pair<AVLMultiMap<string,int>::iterator, AVLMultiMap<string,int>::iterator> bob = visits.equalRange("bob");
+    for(AVLMultiMap<string,int>::iterator it = bob.first; it != bob.second; ++it) {
+        cout << " " << it->second;
+    }
+    cout << endl;
+    AVLMultiSet<char> letters(true);
+    for(const char* c = "mississippi"; *c != 0; c++) {
+        letters.insert(*c);
+    }
+    cout << "mississippi has " << letters.count('s') << " s in " << letters.size()
+         << " letters, stored in " << letters.AVLTree<char,size_t>::size() << " nodes" << endl;
+
+    // A key-only set: iterators give the key itself
+    AVLSet<string> tags;
+    tags.insert("red");
+    tags.insert("blue");
+    tags.insert("red");
+    cout << "Tags:";
+    for(AVLSet<string>::iterator it = tags.begin(); it != tags.end(); ++it) {
+        cout << " " << *it;
+    }
+    cout << " (" << sizeof(AVLNode<int,KeyOnly>) << " bytes per int node, "
+         << sizeof(AVLNode<int,char>) << " with a char value)" << endl;
+
+    // Splay Tree Tests
+    SplayTree<char,int> st;
+    st.insert(std::make_pair('a',1));
+    st.insert(std::make_pair('b',2));
+    st.insert(std::make_pair('c',3));
+
+    cout << "\nSplayTree contents:" << endl;
+    for(SplayTree<char,int>::iterator it = st.begin(); it != st.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    if(st.find('a') != st.end()) {
+        cout << "Found a" << endl;
+    }
+    else {
+        cout << "Did not find a" << endl;
+    }
+    cout << "Erasing b" << endl;
+    st.remove('b');
+
+    // Red-Black Tree Tests
+    RedBlackTree<char,int> rbt;
+    rbt.insert(std::make_pair('a',1));
+    rbt.insert(std::make_pair('b',2));
+    rbt.insert(std::make_pair('c',3));
+
+    cout << "\nRedBlackTree contents:" << endl;
+    for(RedBlackTree<char,int>::iterator it = rbt.begin(); it != rbt.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Erasing b" << endl;
+    rbt.remove('b');
+    cout << "Valid red-black tree: " << rbt.isValidRedBlack() << endl;
+
+    // Adaptive Radix Tree Tests
+    ArtMap<int> art;
+    art.insert(std::make_pair(std::string("https://example.com/a"), 1));
+    art.insert(std::make_pair(std::string("https://example.com/"), 2));
+    art.insert(std::make_pair(std::string("https://example.com/b/c"), 3));
+    art.insert(std::make_pair(std::string("https://example.org/"), 4));
+
+    cout << "\nArtMap contents:" << endl;
+    for(ArtMap<int>::iterator it = art.begin(); it != art.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Erasing https://example.com/a" << endl;
+    art.remove("https://example.com/a");
+    cout << "ArtMap size: " << art.size() << endl;
+
+    // Durable AVL Tree Tests: a checkpoint plus logged writes survive a reopen
+    remove("bst-test-wal.snap");
+    remove("bst-test-wal.wal");
+    {
+        DurableAVLTree<int,string> durable("bst-test-wal");
+        durable.insert(make_pair(1, string("one")));
+        durable.insert(make_pair(2, string("two")));
+        durable.checkpoint();
+        durable.insert(make_pair(3, string("three")));
+        durable.remove(1);
+        durable.sync();
+    }
+    {
+        DurableAVLTree<int,string> durable("bst-test-wal");
+        cout << "\nDurableAVLTree after reopening: " << durable.tree().size() << " keys, 3 -> "
+             << durable.tree().find(3)->second << endl;
+    }
+    remove("bst-test-wal.snap");
+    remove("bst-test-wal.wal");
+
+    // LSM Store Tests: flushed and compacted runs survive a reopen
+    LsmOptions lsmOptions;
+    lsmOptions.memtableBytes = 64;
+    lsmOptions.fanout = 2;
+    lsmOptions.background = false;
+    remove("bst-test-lsm.manifest");
+    {
+        LSMStore<int,int> lsm("bst-test-lsm", lsmOptions);
+        for(int i = 0; i < 100; i++) {
+            lsm.insert(make_pair(i, i * i));
+        }
+        lsm.remove(7);
+        lsm.flush();
+        lsm.waitForCompaction();
+        cout << "\nLSMStore: " << lsm.runCount() << " runs after "
+             << lsm.stats().compactions << " compactions" << endl;
+    }
+    {
+        LSMStore<int,int> lsm("bst-test-lsm", lsmOptions);
+        int value = 0;
+        if(lsm.find(9, value)) {
+            cout << "After reopening, 9 -> " << value << endl;
+        }
+        cout << "Found 7 after removing it: " << lsm.find(7, value) << endl;
+    }
+    if(system("rm -f bst-test-lsm-*.run bst-test-lsm.manifest") != 0) {
+        cout << "Could not remove the LSMStore files" << endl;
+    }
+
     return 0;
 }
@@ -5,6 +5,83 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <vector>
+#include <iterator>
+#include <cstddef>
+#include <cmath>
+#include <stdexcept>
+#include <typeinfo>
+#include <type_traits>
+
+/**
+ * Hint the hardware to start loading the node at addr into cache.
+ * Compiles away on compilers without __builtin_prefetch.
+ */
+#if defined(__GNUC__)
+#define BST_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define BST_PREFETCH(addr) ((void)0)
+#endif
+
+/**
+ * The Value of a key-only tree such as BSTSet or AVLSet. Its nodes
+ * store the key alone, and its iterators point at the key.
+ */
+struct KeyOnly
+{
+};
+
+inline std::ostream& operator<<(std::ostream& out, const KeyOnly&)
+{
+    return out << "-";
+}
+
+/**
+ * What a node stores for its item: the key-value pair, or for a
+ * KeyOnly tree just the key, so sets do not pay for a padded value slot.
+ */
+template <typename Key, typename Value>
+struct NodeItem
+{
+    typedef std::pair<const Key, Value> type;
+
+    static type make(const Key& key, const Value& value)
+    {
+        return type(key, value);
+    }
+    static const Key& key(const type& item)
+    {
+        return item.first;
+    }
+    static const Value& value(const type& item)
+    {
+        return item.second;
+    }
+    static Value& value(type& item)
+    {
+        return item.second;
+    }
+};
+
+template <typename Key>
+struct NodeItem<Key, KeyOnly>
+{
+    typedef const Key type;
+
+    static const Key& make(const Key& key, const KeyOnly&)
+    {
+        return key;
+    }
+    static const Key& key(const Key& item)
+    {
+        return item;
+    }
+    static KeyOnly& value(const Key&)
+    {
+        static KeyOnly none;
+        return none;
+    }
+};
 
 /**
  * A templated class for a Node in a search tree.
@@ -20,8 +97,10 @@ public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
     virtual ~Node();
 
-    const std::pair<const Key, Value>& getItem() const;
-    std::pair<const Key, Value>& getItem();
+    typedef typename NodeItem<Key, Value>::type item_type;
+
+    const item_type& getItem() const;
+    item_type& getItem();
     const Key& getKey() const;
     const Value& getValue() const;
     Value& getValue();
@@ -35,11 +114,31 @@ public:
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
 
+    // Threads reuse an empty child link to point at the in-order
+    // predecessor (left) or successor (right). getLeft()/getRight()
+    // report a threaded link as NULL.
+    bool isLeftThread() const;
+    bool isRightThread() const;
+    Node<Key, Value>* getLeftThread() const;
+    Node<Key, Value>* getRightThread() const;
+    void setLeftThread(Node<Key, Value>* pred);
+    void setRightThread(Node<Key, Value>* succ);
+
+    // A tombstone is a removed item whose node is still linked in,
+    // waiting for a batched compaction (see AVLTree::setTombstoneMode()).
+    bool isTombstone() const;
+    void setTombstone(bool dead);
+
 protected:
-    std::pair<const Key, Value> item_;
+    enum { LEFT_THREAD = 1, RIGHT_THREAD = 2, TOMBSTONE = 4 };
+
+    // The links come first so that flags_, and a subclass's first small
+    // field, can share the padding after a key-only item.
     Node<Key, Value>* parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
+    item_type item_;
+    unsigned char flags_;
 };
 
 /*
@@ -53,10 +152,11 @@ protected:
 */
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
-    item_(key, value),
     parent_(parent),
     left_(NULL),
-    right_(NULL)
+    right_(NULL),
+    item_(NodeItem<Key, Value>::make(key, value)),
+    flags_(0)
 {
 
 }
@@ -76,7 +176,7 @@ Node<Key, Value>::~Node()
 * A const getter for the item.
 */
 template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+const typename Node<Key, Value>::item_type& Node<Key, Value>::getItem() const
 {
     return item_;
 }
@@ -85,7 +185,7 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 * A non-const getter for the item.
 */
 template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+typename Node<Key, Value>::item_type& Node<Key, Value>::getItem()
 {
     return item_;
 }
@@ -96,7 +196,7 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 template<typename Key, typename Value>
 const Key& Node<Key, Value>::getKey() const
 {
-    return item_.first;
+    return NodeItem<Key, Value>::key(item_);
 }
 
 /**
@@ -105,7 +205,7 @@ const Key& Node<Key, Value>::getKey() const
 template<typename Key, typename Value>
 const Value& Node<Key, Value>::getValue() const
 {
-    return item_.second;
+    return NodeItem<Key, Value>::value(item_);
 }
 
 /**
@@ -114,7 +214,7 @@ const Value& Node<Key, Value>::getValue() const
 template<typename Key, typename Value>
 Value& Node<Key, Value>::getValue()
 {
-    return item_.second;
+    return NodeItem<Key, Value>::value(item_);
 }
 
 /**
@@ -132,7 +232,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
 {
-    return left_;
+    return (flags_ & LEFT_THREAD) ? NULL : left_;
 }
 
 /**
@@ -141,7 +241,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
 {
-    return right_;
+    return (flags_ & RIGHT_THREAD) ? NULL : right_;
 }
 
 /**
@@ -160,6 +260,7 @@ template<typename Key, typename Value>
 void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 {
     left_ = left;
+    flags_ &= ~LEFT_THREAD;
 }
 
 /**
@@ -169,6 +270,7 @@ template<typename Key, typename Value>
 void Node<Key, Value>::setRight(Node<Key, Value>* right)
 {
     right_ = right;
+    flags_ &= ~RIGHT_THREAD;
 }
 
 /**
@@ -177,7 +279,87 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
 template<typename Key, typename Value>
 void Node<Key, Value>::setValue(const Value& value)
 {
-    item_.second = value;
+    NodeItem<Key, Value>::value(item_) = value;
+}
+
+/**
+* Returns true if the left link is a predecessor thread rather than a child.
+*/
+template<typename Key, typename Value>
+bool Node<Key, Value>::isLeftThread() const
+{
+    return (flags_ & LEFT_THREAD) != 0;
+}
+
+/**
+* Returns true if the right link is a successor thread rather than a child.
+*/
+template<typename Key, typename Value>
+bool Node<Key, Value>::isRightThread() const
+{
+    return (flags_ & RIGHT_THREAD) != 0;
+}
+
+/**
+* Returns the in-order predecessor stored in the left link, or NULL if
+* the left link is not a thread.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getLeftThread() const
+{
+    return (flags_ & LEFT_THREAD) ? left_ : NULL;
+}
+
+/**
+* Returns the in-order successor stored in the right link, or NULL if
+* the right link is not a thread.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* Node<Key, Value>::getRightThread() const
+{
+    return (flags_ & RIGHT_THREAD) ? right_ : NULL;
+}
+
+/**
+* Marks the (empty) left link as a thread to pred, which may be NULL
+* for the smallest node.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setLeftThread(Node<Key, Value>* pred)
+{
+    left_ = pred;
+    flags_ |= LEFT_THREAD;
+}
+
+/**
+* Marks the (empty) right link as a thread to succ, which may be NULL
+* for the largest node.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setRightThread(Node<Key, Value>* succ)
+{
+    right_ = succ;
+    flags_ |= RIGHT_THREAD;
+}
+
+/**
+* Returns true if the node's item has been removed but the node not yet unlinked.
+*/
+template<typename Key, typename Value>
+bool Node<Key, Value>::isTombstone() const
+{
+    return (flags_ & TOMBSTONE) != 0;
+}
+
+template<typename Key, typename Value>
+void Node<Key, Value>::setTombstone(bool dead)
+{
+    if(dead){
+        flags_ |= TOMBSTONE;
+    }
+    else{
+        flags_ &= ~TOMBSTONE;
+    }
 }
 
 /*
@@ -197,66 +379,224 @@ public:
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
+    virtual void clear(); //TODO
     bool isBalanced() const; //TODO
+    size_t getRotationCount() const;
+    virtual void setScapegoat(bool enable, double alpha = 0.7);
+    bool isScapegoat() const;
+    virtual void rebalance();
+    int height() const;
     void print() const;
     bool empty() const;
 
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+protected:
+    /**
+    * Bookkeeping shared by the tree and its iterators, kept beside the
+    * root like the header node of libstdc++'s trees: the smallest and
+    * largest nodes and the node count. end() iterators carry a pointer
+    * to it, which is how --end() finds the largest node in O(1).
+    * count includes tombstones; dead is how many of them there are.
+    */
+    struct TreeHeader
+    {
+        Node<Key, Value>* leftmost;
+        Node<Key, Value>* rightmost;
+        size_t count;
+        size_t dead;
+    };
+
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename std::remove_const<typename Node<Key, Value>::item_type>::type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename Node<Key, Value>::item_type* pointer;
+        typedef typename Node<Key, Value>::item_type& reference;
+
         iterator();
 
-        std::pair<const Key,Value>& operator*() const;
-        std::pair<const Key,Value>* operator->() const;
+        reference operator*() const;
+        pointer operator->() const;
 
         bool operator==(const iterator& rhs) const;
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        friend class const_iterator;
+        iterator(Node<Key,Value>* ptr, const TreeHeader* header);
+        Node<Key, Value> *current_;
+        const TreeHeader* header_;
+    };
+
+    /**
+    * Like iterator, but gives read-only access to the items.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename std::remove_const<typename Node<Key, Value>::item_type>::type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const typename Node<Key, Value>::item_type* pointer;
+        typedef const typename Node<Key, Value>::item_type& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
 
     protected:
         friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
         Node<Key, Value> *current_;
+        const TreeHeader* header_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    /**
+    * Owns a node taken out of a tree by extract(), until insert() links
+    * it into a tree again or the handle is destroyed. Moving an item
+    * this way allocates nothing and copies neither key nor value.
+    * Handles are move-only. The key is read-only, since nodes store it
+    * as const.
+    */
+    class node_type
+    {
+    public:
+        typedef Key key_type;
+        typedef Value mapped_type;
+
+        node_type();
+        node_type(node_type&& other);
+        node_type& operator=(node_type&& other);
+        ~node_type();
+
+        bool empty() const;
+        explicit operator bool() const;
+        const Key& key() const;
+        Value& mapped() const;
+
+    protected:
+        friend class BinarySearchTree<Key, Value>;
+        explicit node_type(Node<Key, Value>* node);
+        node_type(const node_type&) = delete;
+        node_type& operator=(const node_type&) = delete;
+        Node<Key, Value>* release();
+
+        Node<Key, Value>* node_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator min() const;
+    iterator max() const;
+    size_t size() const;
     iterator find(const Key& key) const;
+    iterator erase(iterator pos);
+    template<typename Predicate>
+    size_t erase_if(Predicate pred);
+    virtual size_t eraseRange(const Key& lo, const Key& hi);
+    node_type extract(const Key& key);
+    node_type extract(iterator pos);
+    std::pair<iterator, bool> insert(node_type&& handle);
+    virtual void findBatch(const std::vector<Key>& keys, std::vector<iterator>& out) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    virtual Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    static Node<Key, Value>* successor(Node<Key, Value>* current);
+    static Node<Key, Value>* nextNode(Node<Key, Value>* current);
+    static Node<Key, Value>* prevNode(Node<Key, Value>* current, const TreeHeader* header);
+    static Node<Key, Value>* liveForward(Node<Key, Value>* current, const TreeHeader* header);
+    static Node<Key, Value>* liveBackward(Node<Key, Value>* current, const TreeHeader* header);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
     virtual void printRoot (Node<Key, Value> *r) const;
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    virtual void linkNode(Node<Key, Value>* parent, Node<Key, Value>* n);
+    virtual void unlinkNode(Node<Key, Value>* curr);
+    virtual bool acceptsNode(Node<Key, Value>* n) const;
+    void removeNode(Node<Key, Value>* curr);
+    void rotateRight(Node<Key,Value>* n1);
+    void rotateLeft(Node<Key,Value>* n1);
+    iterator makeIterator(Node<Key, Value>* n) const;
+    static Node<Key, Value>* handleNode(const node_type& handle);
+    static Node<Key, Value>* releaseHandle(node_type& handle);
+    void noteInserted(Node<Key, Value>* n);
+    void noteRemoving(Node<Key, Value>* n);
 
     // Add helper functions here
-    void clearSub(Node<Key, Value>* curr);
     int getHeight(Node<Key, Value>* curr) const;
     bool balancedHelper(Node<Key, Value>* curr) const;
     Node<Key, Value>* getRoot() const;
     void setRoot(Node<Key, Value>* newRoot);
-    
+
+    // Scapegoat and rebalance() helpers
+    size_t subtreeSize(Node<Key, Value>* curr) const;
+    void rebuildAboveScapegoat(Node<Key, Value>* newNode);
+    void rebuildAboveJoin(Node<Key, Value>* joined);
+    void rebuild(Node<Key, Value>* top);
+    Node<Key, Value>* treeToVine(Node<Key, Value>* top, size_t& count);
+    Node<Key, Value>* compress(Node<Key, Value>* top, size_t count);
+
+    // eraseRange() helpers
+    Node<Key, Value>* lowerBound(const Key& key) const;
+    static void splitAt(Node<Key, Value>* top, const Key& key, Node<Key, Value>*& less, Node<Key, Value>*& rest);
+    static size_t freeSubtree(Node<Key, Value>* top);
+    size_t eraseRangeByNode(const Key& lo, const Key& hi);
 
 protected:
     Node<Key, Value>* root_;
     // You should not need other data members
+    TreeHeader header_;
+    size_t rotations_;  // rotations done over the tree's lifetime
+
+    // Scapegoat policy state (see setScapegoat()); the high-water mark of
+    // the node count is only maintained while the policy is on
+    bool scapegoat_;
+    double alpha_;
+    size_t sgMaxCount_;
+
+    // Number of searches findBatch() advances together
+    static const size_t BATCH_LANES = 16;
 };
 
 /*
@@ -266,13 +606,15 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* and the header of the tree it belongs to.
 */
 template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr, const TreeHeader* header)
 {
     // TODO
     current_ = ptr;
+    header_ = header;
 }
 
 /**
@@ -283,13 +625,14 @@ BinarySearchTree<Key, Value>::iterator::iterator()
 {
     // TODO
     current_ = NULL;
+    header_ = NULL;
 }
 
 /**
 * Provides access to the item.
 */
 template<class Key, class Value>
-std::pair<const Key,Value> &
+typename BinarySearchTree<Key, Value>::iterator::reference
 BinarySearchTree<Key, Value>::iterator::operator*() const
 {
     return current_->getItem();
@@ -299,7 +642,7 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 * Provides access to the address of the item.
 */
 template<class Key, class Value>
-std::pair<const Key,Value> *
+typename BinarySearchTree<Key, Value>::iterator::pointer
 BinarySearchTree<Key, Value>::iterator::operator->() const
 {
     return &(current_->getItem());
@@ -341,35 +684,40 @@ typename BinarySearchTree<Key, Value>::iterator&
 BinarySearchTree<Key, Value>::iterator::operator++()
 {
     // TODO
-    if(current_ == NULL){
-        return *this;
-    }
-    Node<Key, Value>* next = NULL;
+    current_ = liveForward(nextNode(current_), header_);
+    return *this;
+}
 
-    // go to right subtree
-    if(current_->getRight() != NULL){
-        next = current_->getRight();
-        // get to the left
-        while(next->getLeft() != NULL){
-            next = next->getLeft();
-        }
-        current_ = next;
-    }
-    else{
-        // store parent as next
-        next = current_->getParent();
-        // go until there are no more parent nodes or there
-        // is a parent in which current was its left child
-        while((next != NULL) && (next->getRight() == current_)){
-            current_ = next;
-            next = next->getParent();
-        }
-        current_ = next;
-    }
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
 
+/**
+* Moves the iterator back one item; decrementing end() gives the
+* largest item.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator&
+BinarySearchTree<Key, Value>::iterator::operator--()
+{
+    current_ = liveBackward(prevNode(current_, header_), header_);
     return *this;
 }
 
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -378,120 +726,450 @@ End implementations for the BinarySearchTree::iterator class.
 */
 
 /*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+--------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+--------------------------------------------------------------------
 */
 
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::const_iterator::const_iterator() :
+    current_(NULL), header_(NULL)
+{
+
+}
+
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* Converts a mutable iterator into a read-only one.
 */
 template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+BinarySearchTree<Key, Value>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_), header_(it.header_)
 {
-    // TODO
-    root_ = NULL;
+
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator::reference
+BinarySearchTree<Key, Value>::const_iterator::operator*() const
 {
-    // TODO
-    clear();
+    return current_->getItem();
 }
 
-/**
- * Returns true if tree is empty
-*/
 template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+typename BinarySearchTree<Key, Value>::const_iterator::pointer
+BinarySearchTree<Key, Value>::const_iterator::operator->() const
 {
-    return root_ == NULL;
+    return &(current_->getItem());
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<class Key, class Value>
+bool
+BinarySearchTree<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return current_ == rhs.current_;
 }
 
-/**
-* Returns an iterator to the "smallest" item in the tree
-*/
 template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+bool
+BinarySearchTree<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    return current_ != rhs.current_;
 }
 
-/**
-* Returns an iterator whose value means INVALID
-*/
 template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+typename BinarySearchTree<Key, Value>::const_iterator&
+BinarySearchTree<Key, Value>::const_iterator::operator++()
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    current_ = liveForward(nextNode(current_), header_);
+    return *this;
 }
 
-/**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
-*/
 template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::const_iterator::operator++(int)
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    const_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator&
+BinarySearchTree<Key, Value>::const_iterator::operator--()
+{
+    current_ = liveBackward(prevNode(current_, header_), header_);
+    return *this;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --(*this);
+    return old;
 }
 
+/*
+------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
+/*
+-------------------------------------------------------------
+Begin implementations for the BinarySearchTree::node_type class.
+-------------------------------------------------------------
+*/
+
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
+* An empty handle.
+*/
 template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+BinarySearchTree<Key, Value>::node_type::node_type() :
+    node_(NULL)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+
 }
+
 template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+BinarySearchTree<Key, Value>::node_type::node_type(Node<Key, Value>* node) :
+    node_(node)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Takes the node from other, leaving it empty.
 */
 template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+BinarySearchTree<Key, Value>::node_type::node_type(node_type&& other) :
+    node_(other.node_)
 {
-    // TODO
-    Node<Key, Value> *prev = internalFind(keyValuePair.first);
-    Node<Key, Value> *curr = root_;
-    Node<Key, Value> *parent = NULL;
+    other.node_ = NULL;
+}
 
-    // overwrites the current value with the updated value
-    if(prev != NULL){
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::node_type&
+BinarySearchTree<Key, Value>::node_type::operator=(node_type&& other)
+{
+    if(this != &other){
+        delete node_;
+        node_ = other.node_;
+        other.node_ = NULL;
+    }
+    return *this;
+}
+
+/**
+* Deletes the node if no tree took it back.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::~node_type()
+{
+    delete node_;
+}
+
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::node_type::empty() const
+{
+    return node_ == NULL;
+}
+
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::node_type::operator bool() const
+{
+    return node_ != NULL;
+}
+
+/**
+* @precondition The handle is not empty
+*/
+template<class Key, class Value>
+const Key& BinarySearchTree<Key, Value>::node_type::key() const
+{
+    return node_->getKey();
+}
+
+/**
+* @precondition The handle is not empty
+*/
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::node_type::mapped() const
+{
+    return node_->getValue();
+}
+
+/**
+* Gives up ownership of the node without deleting it.
+*/
+template<class Key, class Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::node_type::release()
+{
+    Node<Key, Value>* node = node_;
+    node_ = NULL;
+    return node;
+}
+
+/*
+-----------------------------------------------------------
+End implementations for the BinarySearchTree::node_type class.
+-----------------------------------------------------------
+*/
+
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+*/
+template<class Key, class Value>
+BinarySearchTree<Key, Value>::BinarySearchTree() 
+{
+    // TODO
+    root_ = NULL;
+    header_.leftmost = NULL;
+    header_.rightmost = NULL;
+    header_.count = 0;
+    header_.dead = 0;
+    rotations_ = 0;
+    scapegoat_ = false;
+    alpha_ = 0.7;
+    sgMaxCount_ = 0;
+}
+
+template<typename Key, typename Value>
+BinarySearchTree<Key, Value>::~BinarySearchTree()
+{
+    // TODO
+    clear();
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::empty() const
+{
+    return header_.count == header_.dead;
+}
+
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::begin() const
+{
+    BinarySearchTree<Key, Value>::iterator begin(liveForward(header_.leftmost, &header_), &header_);
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::end() const
+{
+    BinarySearchTree<Key, Value>::iterator end(NULL, &header_);
+    return end;
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::cbegin() const
+{
+    return begin();
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_iterator
+BinarySearchTree<Key, Value>::cend() const
+{
+    return end();
+}
+
+/**
+* Reverse iteration starts at the largest item, found in O(1).
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::reverse_iterator
+BinarySearchTree<Key, Value>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_reverse_iterator
+BinarySearchTree<Key, Value>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::const_reverse_iterator
+BinarySearchTree<Key, Value>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns an iterator to the smallest item, or end() if empty, in O(1)
+* unless tombstones sit at the low end.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::min() const
+{
+    return iterator(liveForward(header_.leftmost, &header_), &header_);
+}
+
+/**
+* Returns an iterator to the largest item, or end() if empty, in O(1)
+* unless tombstones sit at the high end.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::max() const
+{
+    return iterator(liveBackward(header_.rightmost, &header_), &header_);
+}
+
+/**
+* Returns the number of items, in O(1).
+*/
+template<class Key, class Value>
+size_t BinarySearchTree<Key, Value>::size() const
+{
+    return header_.count - header_.dead;
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::find(const Key & k) const
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value>::iterator it(curr, &header_);
+    return it;
+}
+
+/**
+* Looks up every key in keys and stores an iterator to each one
+* (or end() if it is missing) at the same index of out.
+* Up to BATCH_LANES searches descend in lockstep, and each one
+* prefetches the child it will visit next, so the cache misses of
+* independent lookups overlap instead of being paid one at a time.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::findBatch(
+    const std::vector<Key>& keys,
+    std::vector<iterator>& out) const
+{
+    out.assign(keys.size(), end());
+    Node<Key, Value>* lane[BATCH_LANES];
+
+    for(size_t first = 0; first < keys.size(); first += BATCH_LANES){
+        size_t count = keys.size() - first;
+        if(count > BATCH_LANES){
+            count = BATCH_LANES;
+        }
+        for(size_t i = 0; i < count; i++){
+            lane[i] = root_;
+        }
+
+        // advance every unfinished search by one level per pass
+        size_t active = count;
+        while(active > 0){
+            active = 0;
+            for(size_t i = 0; i < count; i++){
+                Node<Key, Value>* curr = lane[i];
+                if(curr == NULL){
+                    continue;
+                }
+                const Key& key = keys[first + i];
+                if(key == curr->getKey()){
+                    if(!curr->isTombstone()){
+                        out[first + i] = iterator(curr, &header_);
+                    }
+                    lane[i] = NULL;
+                    continue;
+                }
+                curr = (key < curr->getKey()) ? curr->getLeft() : curr->getRight();
+                if(curr != NULL){
+                    BST_PREFETCH(curr);
+                    active++;
+                }
+                lane[i] = curr;
+            }
+        }
+    }
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value>
+Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+* With the scapegoat policy on, an insert that lands too deep rebuilds
+* the subtree above it instead.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO
+    Node<Key, Value> *prev = internalFind(keyValuePair.first);
+    Node<Key, Value> *curr = root_;
+    Node<Key, Value> *parent = NULL;
+
+    // overwrites the current value with the updated value
+    if(prev != NULL){
         prev->setValue(keyValuePair.second);
         return;
     }
     
     // insert into tree
-    Node<Key, Value> *newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
     while(curr != NULL){
         parent = curr;
         if(keyValuePair.first < curr->getKey()){
@@ -501,20 +1179,135 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
             curr = curr->getRight();
         }
     }
+    linkNode(parent, new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
+}
 
-    newNode->setParent(parent);
-
+/**
+* Links n, a node not in any tree, as a child of parent (or as the root
+* if parent is NULL) and rebalances. parent must be where a search for
+* n's key ended. Each engine overrides this with its own fix-up; insert()
+* and insert(node_type&&) both come here.
+*/
+template<class Key, class Value>
+void BinarySearchTree<Key, Value>::linkNode(Node<Key, Value>* parent, Node<Key, Value>* n)
+{
+    n->setParent(parent);
+    n->setLeft(NULL);
+    n->setRight(NULL);
     if(parent == NULL){
-        root_ = newNode;
+        root_ = n;
     }
-    else if(keyValuePair.first < parent->getKey()){
-        parent->setLeft(newNode);
+    else if(n->getKey() < parent->getKey()){
+        parent->setLeft(n);
     }
     else{
-        parent->setRight(newNode);
+        parent->setRight(n);
+    }
+    noteInserted(n);
+
+    if(scapegoat_){
+        if(header_.count > sgMaxCount_){
+            sgMaxCount_ = header_.count;
+        }
+        size_t depth = 0;
+        for(Node<Key, Value>* up = parent; up != NULL; up = up->getParent()){
+            depth++;
+        }
+        // depth bound log_{1/alpha}(n)
+        if(depth > std::log(double(header_.count)) / -std::log(alpha_)){
+            rebuildAboveScapegoat(n);
+        }
     }
 }
 
+/**
+* Links the node held by handle into the tree, without allocating or
+* copying. Returns an iterator to the node with handle's key and whether
+* the insert happened; if the key was already present, nothing changes
+* and handle keeps its node. An empty handle inserts nothing.
+* Throws std::invalid_argument if the node came from a tree of a
+* different kind (an AVLTree needs an AVL node, for example); handles
+* move between trees of the same kind, such as two AVLTrees.
+*/
+template<class Key, class Value>
+std::pair<typename BinarySearchTree<Key, Value>::iterator, bool>
+BinarySearchTree<Key, Value>::insert(node_type&& handle)
+{
+    if(handle.empty()){
+        return std::make_pair(end(), false);
+    }
+    if(!acceptsNode(handle.node_)){
+        throw std::invalid_argument("node handle from an incompatible tree");
+    }
+    const Key& key = handle.node_->getKey();
+    Node<Key, Value>* curr = root_;
+    Node<Key, Value>* parent = NULL;
+    while(curr != NULL){
+        parent = curr;
+        if(key < curr->getKey()){
+            curr = curr->getLeft();
+        }
+        else if(curr->getKey() < key){
+            curr = curr->getRight();
+        }
+        else if(curr->isTombstone()){
+            // the handle's node replaces the removed one
+            removeNode(curr);
+            curr = root_;
+            parent = NULL;
+        }
+        else{
+            return std::make_pair(makeIterator(curr), false);
+        }
+    }
+    Node<Key, Value>* n = handle.release();
+    linkNode(parent, n);
+    return std::make_pair(makeIterator(n), true);
+}
+
+/**
+* Unlinks the key's node and returns a handle owning it, or an empty
+* handle if the key is not present. The tree rebalances as in remove().
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::node_type
+BinarySearchTree<Key, Value>::extract(const Key& key)
+{
+    Node<Key, Value>* curr = internalFind(key);
+    if(curr == NULL){
+        return node_type();
+    }
+    unlinkNode(curr);
+    return node_type(curr);
+}
+
+/**
+* Unlinks the node at pos, with no search by key, and returns a handle
+* owning it. Iterators to other items stay valid.
+*/
+template<class Key, class Value>
+typename BinarySearchTree<Key, Value>::node_type
+BinarySearchTree<Key, Value>::extract(iterator pos)
+{
+    Node<Key, Value>* curr = pos.current_;
+    if(curr == NULL){
+        return node_type();
+    }
+    unlinkNode(curr);
+    return node_type(curr);
+}
+
+/**
+* Returns true if n can be linked into this tree, which takes only
+* nodes of its own kind: a node's getters assume its neighbours are
+* the same type as itself. Engines with their own nodes override this.
+*/
+template<class Key, class Value>
+bool BinarySearchTree<Key, Value>::acceptsNode(Node<Key, Value>* n) const
+{
+    return typeid(*n) == typeid(Node<Key, Value>);
+}
+
 
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
@@ -529,12 +1322,158 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     if(curr == NULL){
         return;
     }
+    removeNode(curr);
+}
+
+/**
+* Removes the item at pos and returns an iterator to the item after it,
+* so a loop can keep going. The node is removed where it sits, with no
+* search by key; other iterators stay valid since nodes never move
+* their items.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::erase(iterator pos)
+{
+    Node<Key, Value>* curr = pos.current_;
+    if(curr == NULL){
+        return end();
+    }
+    Node<Key, Value>* next = liveForward(nextNode(curr), &header_);
+    removeNode(curr);
+    return iterator(next, &header_);
+}
+
+/**
+* Removes every item for which pred(item) is true in one in-order pass
+* and returns how many were removed.
+*/
+template<typename Key, typename Value>
+template<typename Predicate>
+size_t BinarySearchTree<Key, Value>::erase_if(Predicate pred)
+{
+    size_t removed = 0;
+    iterator it = begin();
+    while(it != end()){
+        if(pred(*it)){
+            it = erase(it);
+            removed++;
+        }
+        else{
+            ++it;
+        }
+    }
+    return removed;
+}
+
+/**
+* Removes every key in [lo, hi) and returns how many were removed. The
+* range is cut out with two splits, its nodes are freed in one linear
+* sweep, and the two outer pieces are joined again, so the cost is
+* O(height + k) instead of k separate removes.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::eraseRange(const Key& lo, const Key& hi)
+{
+    if(!(lo < hi) || root_ == NULL){
+        return 0;
+    }
+    Node<Key, Value>* less;
+    Node<Key, Value>* middle;
+    Node<Key, Value>* more;
+    splitAt(root_, lo, less, middle);
+    splitAt(middle, hi, middle, more);
+    size_t removed = freeSubtree(middle);
+
+    Node<Key, Value>* lessMax = less;
+    while(lessMax != NULL && lessMax->getRight() != NULL){
+        lessMax = lessMax->getRight();
+    }
+    Node<Key, Value>* moreMin = more;
+    while(moreMin != NULL && moreMin->getLeft() != NULL){
+        moreMin = moreMin->getLeft();
+    }
+    // hang the upper piece off the largest node of the lower one
+    if(lessMax == NULL){
+        root_ = more;
+    }
+    else{
+        root_ = less;
+        lessMax->setRight(more);
+        if(more != NULL){
+            more->setParent(lessMax);
+        }
+    }
+
+    header_.count -= removed;
+    if(less == NULL){
+        header_.leftmost = moreMin;
+    }
+    if(more == NULL){
+        header_.rightmost = lessMax;
+    }
+    if(scapegoat_ && header_.count < alpha_ * sgMaxCount_){
+        if(root_ != NULL){
+            rebuild(root_);
+        }
+        sgMaxCount_ = header_.count;
+    }
+    else if(scapegoat_ && lessMax != NULL && more != NULL){
+        rebuildAboveJoin(more);
+    }
+    return removed;
+}
+
+/**
+* The eraseRange() of engines whose unlinkNode() keeps more than the
+* shape right (colors, hashes, eviction order): the nodes in [lo, hi)
+* go through removeNode() one at a time, in order from a single search,
+* so O(log n + k log n). Tombstones in the range are freed but, having
+* been removed already, not counted.
+*/
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::eraseRangeByNode(const Key& lo, const Key& hi)
+{
+    size_t removed = 0;
+    if(!(lo < hi)){
+        return removed;
+    }
+    Node<Key, Value>* curr = lowerBound(lo);
+    while(curr != NULL && curr->getKey() < hi){
+        Node<Key, Value>* next = nextNode(curr);
+        if(!curr->isTombstone()){
+            removed++;
+        }
+        removeNode(curr);
+        curr = next;
+    }
+    return removed;
+}
 
+/**
+* Unlinks and deletes curr, a node of this tree; remove() and erase()
+* both come here.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::removeNode(Node<Key, Value>* curr)
+{
+    unlinkNode(curr);
+    delete curr;
+}
+
+/**
+* Takes curr, a node of this tree, out of it without deleting it. Each
+* engine overrides this with its own rebalancing.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::unlinkNode(Node<Key, Value>* curr)
+{
     if((curr->getLeft() != NULL) && (curr->getRight() != NULL)){
         // has 2 children
         Node<Key, Value> *pre = predecessor(curr);
         nodeSwap(curr, pre);
     }
+    noteRemoving(curr);
     if(curr->getLeft() != NULL){
         if(curr->getParent() == NULL){
             root_ = curr->getLeft();
@@ -579,53 +1518,195 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         }
     }
 
-    delete curr;
-    curr = NULL;
+    // once enough nodes are gone, the depth bound no longer follows from
+    // the insert-time checks, so rebuild the whole tree
+    if(scapegoat_ && header_.count < alpha_ * sgMaxCount_){
+        if(root_ != NULL){
+            rebuild(root_);
+        }
+        sgMaxCount_ = header_.count;
+    }
 }
 
 
 
 template<class Key, class Value>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+{
+    // TODO
+    Node<Key, Value> *pre = NULL;
+    if(current == NULL){
+        return pre;
+    }
+    
+    if(current->getLeft() != NULL){
+        pre = current->getLeft();
+        //std::cout << "HELLOOOOOOOO" <<std::endl;
+        while(pre->getRight() != NULL){
+          //std::cout << "BYEEEEEEEEEEEEEEEEE" <<std::endl;
+            pre = pre->getRight();
+        }
+    }
+    else{
+        pre = current->getParent();
+        while((pre != NULL) && (pre->getLeft() == current)){
+            current = pre;
+            pre = pre->getParent();
+        }
+    }
+    return pre;
+}
+
+
+/**
+* Mirror image of predecessor(): returns the next node in an in-order
+* walk by following child and parent links (never threads).
+*/
+template<class Key, class Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+{
+    Node<Key, Value> *succ = NULL;
+    if(current == NULL){
+        return succ;
+    }
+
+    if(current->getRight() != NULL){
+        succ = current->getRight();
+        while(succ->getLeft() != NULL){
+            succ = succ->getLeft();
+        }
+    }
+    else{
+        succ = current->getParent();
+        while((succ != NULL) && (succ->getRight() == current)){
+            current = succ;
+            succ = succ->getParent();
+        }
+    }
+    return succ;
+}
+
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::clear()
+{
+    // freeSubtree() needs no stack, so a long burst-mode chain is fine
+    freeSubtree(root_);
+    root_ = NULL;
+    header_.leftmost = NULL;
+    header_.rightmost = NULL;
+    header_.count = 0;
+    header_.dead = 0;
+    sgMaxCount_ = 0;
+}
+
+
+/**
+* The node after current in order, or NULL after the last one. Follows
+* a right thread when there is one instead of climbing parents.
+*/
+template<class Key, class Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::nextNode(Node<Key, Value>* current)
+{
+    if(current == NULL){
+        return NULL;
+    }
+    Node<Key, Value>* next = NULL;
+
+    // go to right subtree
+    if(current->getRight() != NULL){
+        next = current->getRight();
+        // get to the left
+        while(next->getLeft() != NULL){
+            next = next->getLeft();
+        }
+        current = next;
+    }
+    else if(current->isRightThread()){
+        // threaded trees store the successor directly
+        current = current->getRightThread();
+    }
+    else{
+        // store parent as next
+        next = current->getParent();
+        // go until there are no more parent nodes or there
+        // is a parent in which current was its left child
+        while((next != NULL) && (next->getRight() == current)){
+            current = next;
+            next = next->getParent();
+        }
+        current = next;
+    }
+
+    return current;
+}
+
+/**
+* The node before current in order. NULL (end()) steps back to the
+* largest node, read from the header.
+*/
+template<class Key, class Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::prevNode(Node<Key, Value>* current, const TreeHeader* header)
 {
-    // TODO
-    Node<Key, Value> *pre = NULL;
     if(current == NULL){
-        return pre;
+        return (header != NULL) ? header->rightmost : NULL;
     }
-    
     if(current->getLeft() != NULL){
-        pre = current->getLeft();
-        //std::cout << "HELLOOOOOOOO" <<std::endl;
-        while(pre->getRight() != NULL){
-          //std::cout << "BYEEEEEEEEEEEEEEEEE" <<std::endl;
-            pre = pre->getRight();
+        current = current->getLeft();
+        while(current->getRight() != NULL){
+            current = current->getRight();
         }
+        return current;
     }
-    else{
-        pre = current->getParent();
-        while((pre != NULL) && (pre->getLeft() == current)){
-            current = pre;
-            pre = pre->getParent();
-        }
+    if(current->isLeftThread()){
+        return current->getLeftThread();
     }
-    return pre;
+    Node<Key, Value>* next = current->getParent();
+    while(next != NULL && next->getLeft() == current){
+        current = next;
+        next = next->getParent();
+    }
+    return next;
 }
 
-
 /**
-* A method to remove all contents of the tree and
-* reset the values in the tree for use again.
+* Returns current, or the first node after it that is not a tombstone.
+* Costs one test when the tree holds no tombstones.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<class Key, class Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::liveForward(Node<Key, Value>* current, const TreeHeader* header)
 {
-    // TODO
-    clearSub(root_);
-    root_ = NULL;
+    if(header != NULL && header->dead != 0){
+        while(current != NULL && current->isTombstone()){
+            current = nextNode(current);
+        }
+    }
+    return current;
 }
 
+/**
+* Returns current, or the first node before it that is not a tombstone.
+*/
+template<class Key, class Value>
+Node<Key, Value>*
+BinarySearchTree<Key, Value>::liveBackward(Node<Key, Value>* current, const TreeHeader* header)
+{
+    if(header != NULL && header->dead != 0){
+        while(current != NULL && current->isTombstone()){
+            current = prevNode(current, header);
+        }
+    }
+    return current;
+}
 
 /**
 * A helper function to find the smallest node in the tree.
@@ -635,16 +1716,8 @@ Node<Key, Value>*
 BinarySearchTree<Key, Value>::getSmallestNode() const
 {
     // TODO
-    if(root_ == NULL){
-        return NULL;
-    }
-
-    // walk to furthest left
-    Node<Key, Value> *curr = root_;
-    while(curr->getLeft() != NULL){
-        curr = curr->getLeft();
-    }
-    return curr;
+    // cached in the header
+    return header_.leftmost;
 }
 
 /**
@@ -681,22 +1754,343 @@ bool BinarySearchTree<Key, Value>::isBalanced() const
     return balancedHelper(root_);
 }
 
+/**
+ * Returns how many rotations the tree has performed, for comparing
+ * the rebalancing cost of different engines.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::getRotationCount() const
+{
+    return rotations_;
+}
+
+/**
+ * Turns the scapegoat policy on or off for this tree's own insert() and
+ * remove(). Trees that balance themselves keep data in their nodes that
+ * a scapegoat rebuild would invalidate, so they throw instead. Alpha,
+ * in (0.5, 1), sets the allowed depth to log_{1/alpha}(n), about
+ * 1.94*log2(n) for the default 0.7; smaller alphas keep the tree
+ * shallower at the price of more rebuilding. Turning it on rebuilds
+ * the current tree once, in O(n). No per-node state is added.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::setScapegoat(bool enable, double alpha)
+{
+    if(!(alpha > 0.5 && alpha < 1.0)){
+        throw std::invalid_argument("Scapegoat alpha must be in (0.5, 1)");
+    }
+    scapegoat_ = enable;
+    alpha_ = alpha;
+    if(enable){
+        sgMaxCount_ = header_.count;
+        if(root_ != NULL){
+            rebuild(root_);
+        }
+    }
+}
+
+template<typename Key, typename Value>
+bool BinarySearchTree<Key, Value>::isScapegoat() const
+{
+    return scapegoat_;
+}
+
+/**
+ * Rebuilds the whole tree into a complete tree (height ceil(log2(n+1)))
+ * in O(n) time and O(1) extra memory, e.g. during idle periods once
+ * height() passes a threshold. Engines that keep balance data in their
+ * nodes override it to bring that data up to date as well.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebalance()
+{
+    if(root_ != NULL){
+        rebuild(root_);
+    }
+}
+
+/**
+ * Returns the number of nodes on the longest root-to-leaf path (0 when
+ * empty). Walks the tree through parent pointers, so it uses O(1)
+ * memory even when the tree has degenerated into a long chain.
+ */
+template<typename Key, typename Value>
+int BinarySearchTree<Key, Value>::height() const
+{
+    int maxDepth = 0;
+    int depth = 0;
+    Node<Key, Value>* prev = NULL;
+    Node<Key, Value>* curr = root_;
+    while(curr != NULL){
+        Node<Key, Value>* next;
+        if(prev == curr->getParent()){
+            // arrived from above
+            depth++;
+            if(depth > maxDepth){
+                maxDepth = depth;
+            }
+            if(curr->getLeft() != NULL) next = curr->getLeft();
+            else if(curr->getRight() != NULL) next = curr->getRight();
+            else next = curr->getParent();
+        }
+        else if(prev == curr->getLeft() && curr->getRight() != NULL){
+            next = curr->getRight();
+        }
+        else{
+            next = curr->getParent();
+        }
+        if(next == curr->getParent()){
+            depth--;
+        }
+        prev = curr;
+        curr = next;
+    }
+    return maxDepth;
+}
+
 template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearSub(Node<Key, Value>* curr){
-    // base case
+size_t BinarySearchTree<Key, Value>::subtreeSize(Node<Key, Value>* curr) const
+{
     if(curr == NULL){
+        return 0;
+    }
+    return subtreeSize(curr->getLeft()) + 1 + subtreeSize(curr->getRight());
+}
+
+/**
+ * Walks up from a node inserted too deep to the first ancestor whose
+ * child on the path holds more than alpha of its nodes, and rebuilds
+ * that ancestor's subtree. Only the sibling subtrees need counting.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildAboveScapegoat(Node<Key, Value>* newNode)
+{
+    Node<Key, Value>* child = newNode;
+    size_t childSize = 1;
+    Node<Key, Value>* parent = child->getParent();
+    while(parent != NULL){
+        Node<Key, Value>* sibling = (child == parent->getLeft()) ? parent->getRight() : parent->getLeft();
+        size_t size = childSize + 1 + subtreeSize(sibling);
+        if(childSize > alpha_ * size){
+            rebuild(parent);
+            return;
+        }
+        child = parent;
+        childSize = size;
+        parent = parent->getParent();
+    }
+}
+
+/**
+ * eraseRange() hangs the upper piece, joined, under the largest node of
+ * the lower one, which can push it past the scapegoat depth bound. If it
+ * does, rebuilds the lowest subtree holding joined that fits within the
+ * bound once complete; the whole tree always does. Costs O(size of
+ * joined) for the check plus the size of the rebuilt subtree.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuildAboveJoin(Node<Key, Value>* joined)
+{
+    double bound = std::log(double(header_.count)) / -std::log(alpha_);
+    size_t depth = 0;
+    for(Node<Key, Value>* up = joined->getParent(); up != NULL; up = up->getParent()){
+        depth++;
+    }
+    if(depth + getHeight(joined) - 1 <= bound){
         return;
     }
+    Node<Key, Value>* top = joined;
+    size_t size = subtreeSize(joined);
+    while(top->getParent() != NULL){
+        // a complete tree of size nodes has ceil(log2(size + 1)) levels
+        size_t levels = 0;
+        for(size_t full = 0; full < size; full = 2 * full + 1){
+            levels++;
+        }
+        if(depth + levels - 1 <= bound){
+            break;
+        }
+        Node<Key, Value>* parent = top->getParent();
+        Node<Key, Value>* sibling = (top == parent->getLeft()) ? parent->getRight() : parent->getLeft();
+        size += 1 + subtreeSize(sibling);
+        top = parent;
+        depth--;
+    }
+    rebuild(top);
+}
 
-    // clear left subtree
-    clearSub(curr->getLeft());
-    
-    // clear right subtree
-    clearSub(curr->getRight());
+/**
+ * Rebalances the subtree under top in place with the Day-Stout-Warren
+ * algorithm: rotate it into a right-leaning vine, then compress the
+ * vine into a complete tree. O(size) time and O(1) extra memory;
+ * parent pointers and the root are kept by the rotations.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rebuild(Node<Key, Value>* top)
+{
+    size_t count;
+    Node<Key, Value>* vine = treeToVine(top, count);
+    if(count == 0){
+        return;
+    }
+    // the largest full tree (2^k - 1 nodes) that fits; the rest of the
+    // nodes become its bottom level
+    size_t full = 1;
+    while(2 * full + 1 <= count){
+        full = 2 * full + 1;
+    }
+    vine = compress(vine, count - full);
+    while(full > 1){
+        full /= 2;
+        vine = compress(vine, full);
+    }
+}
 
-    // delete current node
-    delete curr;
-    curr = NULL;
+/**
+ * Rotates every left child under top up until the subtree is a chain of
+ * right children. Sets count to the subtree's size and returns the
+ * chain's first node, which now sits where top was.
+ */
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::treeToVine(Node<Key, Value>* top, size_t& count)
+{
+    Node<Key, Value>* vine = NULL;
+    Node<Key, Value>* curr = top;
+    count = 0;
+    while(curr != NULL){
+        Node<Key, Value>* left = curr->getLeft();
+        if(left != NULL){
+            rotateRight(curr);
+            curr = left;
+        }
+        else{
+            if(vine == NULL){
+                vine = curr;
+            }
+            count++;
+            curr = curr->getRight();
+        }
+    }
+    return vine;
+}
+
+/**
+ * Left-rotates every other node down the right chain starting at top,
+ * count times, halving the chain's length. Returns the node now at top.
+ */
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::compress(Node<Key, Value>* top, size_t count)
+{
+    Node<Key, Value>* newTop = top;
+    Node<Key, Value>* curr = top;
+    for(size_t i = 0; i < count; i++){
+        Node<Key, Value>* up = curr->getRight();
+        rotateLeft(curr);
+        if(i == 0){
+            newTop = up;
+        }
+        curr = up->getRight();
+    }
+    return newTop;
+}
+
+/**
+ * Returns the node with the smallest key not less than key, or NULL.
+ */
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::lowerBound(const Key& key) const
+{
+    Node<Key, Value>* curr = root_;
+    Node<Key, Value>* found = NULL;
+    while(curr != NULL){
+        if(curr->getKey() < key){
+            curr = curr->getRight();
+        }
+        else{
+            found = curr;
+            curr = curr->getLeft();
+        }
+    }
+    return found;
+}
+
+/**
+ * Splits the subtree under top by walking one path down from it: nodes
+ * with keys below key are chained into less and the rest into rest.
+ * Both results have NULL parents. Only links are changed, so it runs
+ * in O(height) and keeps the relative shape of each side.
+ */
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::splitAt(Node<Key, Value>* top, const Key& key,
+                                           Node<Key, Value>*& less, Node<Key, Value>*& rest)
+{
+    less = NULL;
+    rest = NULL;
+    // the last node placed on each side, whose inner link is still open
+    Node<Key, Value>* lessTail = NULL;
+    Node<Key, Value>* restTail = NULL;
+    Node<Key, Value>* curr = top;
+    while(curr != NULL){
+        if(curr->getKey() < key){
+            Node<Key, Value>* next = curr->getRight();
+            if(lessTail == NULL){
+                less = curr;
+                curr->setParent(NULL);
+            }
+            else{
+                lessTail->setRight(curr);
+                curr->setParent(lessTail);
+            }
+            lessTail = curr;
+            curr = next;
+        }
+        else{
+            Node<Key, Value>* next = curr->getLeft();
+            if(restTail == NULL){
+                rest = curr;
+                curr->setParent(NULL);
+            }
+            else{
+                restTail->setLeft(curr);
+                curr->setParent(restTail);
+            }
+            restTail = curr;
+            curr = next;
+        }
+    }
+    if(lessTail != NULL){
+        lessTail->setRight(NULL);
+    }
+    if(restTail != NULL){
+        restTail->setLeft(NULL);
+    }
+}
+
+/**
+ * Deletes every node under top and returns how many there were. Left
+ * children are rotated up as they are met, so this is one linear pass
+ * with no stack, however deep the subtree is.
+ */
+template<typename Key, typename Value>
+size_t BinarySearchTree<Key, Value>::freeSubtree(Node<Key, Value>* top)
+{
+    size_t count = 0;
+    Node<Key, Value>* curr = top;
+    while(curr != NULL){
+        Node<Key, Value>* left = curr->getLeft();
+        if(left != NULL){
+            curr->setLeft(left->getRight());
+            left->setRight(curr);
+            curr = left;
+        }
+        else{
+            Node<Key, Value>* right = curr->getRight();
+            delete curr;
+            count++;
+            curr = right;
+        }
+    }
+    return count;
 }
 
 template<typename Key, typename Value>
@@ -823,6 +2217,147 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
 
 }
 
+/**
+* Lets derived trees build iterators, whose node constructor is protected.
+*/
+template<typename Key, typename Value>
+typename BinarySearchTree<Key, Value>::iterator
+BinarySearchTree<Key, Value>::makeIterator(Node<Key, Value>* n) const
+{
+    return iterator(n, &header_);
+}
+
+/**
+* Lets derived trees see the node a handle owns (NULL if it is empty).
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::handleNode(const node_type& handle)
+{
+    return handle.node_;
+}
+
+/**
+* Lets derived trees take the node out of a handle, leaving it empty.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* BinarySearchTree<Key, Value>::releaseHandle(node_type& handle)
+{
+    return handle.release();
+}
+
+/**
+* Updates the header after n was linked into the tree as a leaf. Every
+* engine calls this from insert, before any rebalancing.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::noteInserted(Node<Key, Value>* n)
+{
+    header_.count++;
+    Node<Key, Value>* parent = n->getParent();
+    if(parent == NULL){
+        header_.leftmost = n;
+        header_.rightmost = n;
+        return;
+    }
+    if(parent == header_.leftmost && n == parent->getLeft()){
+        header_.leftmost = n;
+    }
+    if(parent == header_.rightmost && n == parent->getRight()){
+        header_.rightmost = n;
+    }
+}
+
+/**
+* Updates the header before n is unlinked from the tree, while the
+* links around it are still intact. Every engine calls this from remove.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::noteRemoving(Node<Key, Value>* n)
+{
+    header_.count--;
+    if(n->isTombstone()){
+        header_.dead--;
+    }
+    if(n == header_.leftmost){
+        header_.leftmost = successor(n);
+    }
+    if(n == header_.rightmost){
+        header_.rightmost = predecessor(n);
+    }
+}
+
+/**
+* Rotates n1's left child up into n1's place. Keeps parent pointers,
+* the root and any in-order threads consistent.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateRight(Node<Key,Value>* n1)
+{
+    if(n1 == NULL || n1->getLeft() == NULL){
+        return;
+    }
+    Node<Key, Value>* n2 = n1->getLeft();
+    Node<Key, Value>* n3 = n1->getParent();
+    rotations_++;
+    // n2's successor thread (to n1) becomes n1's predecessor thread
+    bool threaded = n2->isRightThread();
+
+    n1->setLeft(n2->getRight());
+    if(n2->getRight() != NULL){
+        n2->getRight()->setParent(n1);
+    }
+    else if(threaded){
+        n1->setLeftThread(n2);
+    }
+    n2->setRight(n1);
+    n1->setParent(n2);
+    n2->setParent(n3);
+    if(n3 == NULL){
+        root_ = n2;
+    }
+    else if(n1 == n3->getLeft()){
+        n3->setLeft(n2);
+    }
+    else{
+        n3->setRight(n2);
+    }
+}
+
+/**
+* Mirror image of rotateRight(): n1's right child moves up.
+*/
+template<typename Key, typename Value>
+void BinarySearchTree<Key, Value>::rotateLeft(Node<Key,Value>* n1)
+{
+    if(n1 == NULL || n1->getRight() == NULL){
+        return;
+    }
+    Node<Key, Value>* n2 = n1->getRight();
+    Node<Key, Value>* n3 = n1->getParent();
+    rotations_++;
+    bool threaded = n2->isLeftThread();
+
+    n1->setRight(n2->getLeft());
+    if(n2->getLeft() != NULL){
+        n2->getLeft()->setParent(n1);
+    }
+    else if(threaded){
+        n1->setRightThread(n2);
+    }
+    n2->setLeft(n1);
+    n1->setParent(n2);
+    n2->setParent(n3);
+    if(n3 == NULL){
+        root_ = n2;
+    }
+    else if(n1 == n3->getRight()){
+        n3->setRight(n2);
+    }
+    else{
+        n3->setLeft(n2);
+    }
+}
+
 /**
  * Lastly, we are providing you with a print function,
    BinarySearchTree::printRoot().
@@ -843,4 +2378,25 @@ End implementations for the BinarySearchTree class.
 ---------------------------------------------------
 */
 
+/**
+* A set of keys on the unbalanced tree. Nodes store only the key (see
+* KeyOnly), and iterators point at it rather than at a pair.
+*/
+template <typename Key>
+class BSTSet : public BinarySearchTree<Key, KeyOnly>
+{
+public:
+    using BinarySearchTree<Key, KeyOnly>::insert;
+    void insert(const Key& key);
+};
+
+/**
+* Adds key; inserting a key the set holds does nothing.
+*/
+template<class Key>
+void BSTSet<Key>::insert(const Key& key)
+{
+    this->insert(std::pair<const Key, KeyOnly>(key, KeyOnly()));
+}
+
 #endif
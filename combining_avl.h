@@ -0,0 +1,350 @@
+#ifndef COMBINING_AVL_H
+#define COMBINING_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include "avlbst.h"
+
+/**
+ * Counters for judging how well requests are being combined; the
+ * average batch is operations / passes.
+ */
+struct CombiningStats
+{
+    CombiningStats() : passes(0), operations(0) { }
+
+    uint64_t passes;      // combining passes that found requests
+    uint64_t operations;  // requests applied by those passes
+};
+
+/**
+ * A flat-combining front end that lets many threads share one AVLTree.
+ *
+ * Each thread opens a Session, which claims a publication slot. An
+ * operation is written into the slot, and the thread then either waits
+ * for it to be served or, if the combiner lock is free, takes the lock
+ * and serves every pending slot in one pass, in key order, so requests
+ * for nearby keys share the cache-hot top of their descent paths. Under
+ * contention one thread does all the tree work while the others only
+ * touch their own slot, instead of all of them passing a mutex (and the
+ * tree's cache lines) back and forth for every operation.
+ *
+ * Key and Value must be default constructible and copyable. Exceptions
+ * thrown by the tree are passed back to the thread whose request
+ * raised them.
+ */
+template<class Key, class Value>
+class CombiningAVLTree
+{
+    struct Slot;
+
+public:
+    class Session;
+    static const size_t DEFAULT_SLOTS = 128;
+
+    explicit CombiningAVLTree(size_t slots = DEFAULT_SLOTS);
+
+    size_t size();
+    CombiningStats stats();
+    AVLTree<Key, Value>& tree();
+
+    /**
+    * One thread's handle on the tree. A session is used by one thread
+    * at a time and holds its slot until destroyed.
+    */
+    class Session
+    {
+    public:
+        explicit Session(CombiningAVLTree& owner);
+        ~Session();
+
+        void insert(const std::pair<const Key, Value>& item);
+        void remove(const Key& key);
+        bool find(const Key& key, Value& value);
+
+    private:
+        Session(const Session&);
+        Session& operator=(const Session&);
+
+        CombiningAVLTree& owner_;
+        Slot* slot_;
+    };
+
+private:
+    CombiningAVLTree(const CombiningAVLTree&);
+    CombiningAVLTree& operator=(const CombiningAVLTree&);
+
+    enum Operation { INSERT, REMOVE, FIND };
+    enum SlotState { IDLE, PENDING, DONE };
+
+    /**
+    * A publication slot. The request fields are written by the owning
+    * thread before it publishes PENDING, and the results by the combiner
+    * before it publishes DONE. Padded so neighbouring slots do not share
+    * a cache line.
+    */
+    struct Slot
+    {
+        Slot() : state(IDLE), claimed(false), op(FIND), found(false) { }
+
+        std::atomic<int> state;
+        std::atomic<bool> claimed;
+        int op;
+        Key key;
+        Value value;
+        bool found;
+        std::exception_ptr error;
+        char pad[64];
+    };
+
+    // orders a batch by key
+    struct SlotOrder
+    {
+        bool operator()(const Slot* a, const Slot* b) const { return a->key < b->key; }
+    };
+
+    Slot* claim();
+    void release(Slot* slot);
+    void submit(Slot* slot);
+    void combine();
+    void apply(Slot* slot);
+
+    // waiting threads spin this many times between yields
+    static const unsigned SPINS_BEFORE_YIELD = 64;
+    // a combiner keeps scanning while passes find work, up to this many
+    static const int COMBINE_PASSES = 3;
+
+    AVLTree<Key, Value> tree_;
+    std::vector<Slot> slots_;
+    std::atomic<size_t> used_;   // slots ever claimed; scans stop here
+    std::mutex lock_;            // held by the combiner
+    std::vector<Slot*> batch_;   // the combiner's current pass
+    CombiningStats stats_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CombiningAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* Makes an empty tree with room for slots concurrent sessions.
+*/
+template<class Key, class Value>
+CombiningAVLTree<Key, Value>::CombiningAVLTree(size_t slots) :
+    slots_(slots), used_(0)
+{
+    batch_.reserve(slots);
+}
+
+/**
+* Number of items, read under the combiner lock.
+*/
+template<class Key, class Value>
+size_t CombiningAVLTree<Key, Value>::size()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return tree_.size();
+}
+
+template<class Key, class Value>
+CombiningStats CombiningAVLTree<Key, Value>::stats()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return stats_;
+}
+
+/**
+* The wrapped tree, for loading or inspecting it while no session is
+* in use (before the threads start or after they are joined).
+*/
+template<class Key, class Value>
+AVLTree<Key, Value>& CombiningAVLTree<Key, Value>::tree()
+{
+    return tree_;
+}
+
+/**
+* Claims a free slot. Throws std::runtime_error if all are in use.
+*/
+template<class Key, class Value>
+typename CombiningAVLTree<Key, Value>::Slot* CombiningAVLTree<Key, Value>::claim()
+{
+    for(size_t i = 0; i < slots_.size(); i++){
+        bool expected = false;
+        if(slots_[i].claimed.compare_exchange_strong(expected, true)){
+            size_t used = used_.load();
+            while(used < i + 1 && !used_.compare_exchange_weak(used, i + 1)){
+            }
+            return &slots_[i];
+        }
+    }
+    throw std::runtime_error("CombiningAVLTree: all session slots are in use");
+}
+
+template<class Key, class Value>
+void CombiningAVLTree<Key, Value>::release(Slot* slot)
+{
+    slot->claimed.store(false, std::memory_order_release);
+}
+
+/**
+* Publishes the request in slot and returns once it has been applied,
+* combining on behalf of every thread whenever the lock is free.
+*/
+template<class Key, class Value>
+void CombiningAVLTree<Key, Value>::submit(Slot* slot)
+{
+    slot->error = std::exception_ptr();
+    slot->state.store(PENDING, std::memory_order_release);
+    for(unsigned spins = 0; slot->state.load(std::memory_order_acquire) != DONE; spins++){
+        if(lock_.try_lock()){
+            // serves this slot too, since it is already pending
+            combine();
+            lock_.unlock();
+        }
+        else if(spins >= SPINS_BEFORE_YIELD){
+            std::this_thread::yield();
+        }
+    }
+    slot->state.store(IDLE, std::memory_order_relaxed);
+    if(slot->error){
+        std::rethrow_exception(slot->error);
+    }
+}
+
+/**
+* Applies every pending request, sorted by key, and repeats while new
+* ones keep arriving. Called with lock_ held.
+*/
+template<class Key, class Value>
+void CombiningAVLTree<Key, Value>::combine()
+{
+    for(int pass = 0; pass < COMBINE_PASSES; pass++){
+        batch_.clear();
+        size_t used = used_.load(std::memory_order_acquire);
+        for(size_t i = 0; i < used; i++){
+            if(slots_[i].state.load(std::memory_order_acquire) == PENDING){
+                batch_.push_back(&slots_[i]);
+            }
+        }
+        if(batch_.empty()){
+            return;
+        }
+        std::sort(batch_.begin(), batch_.end(), SlotOrder());
+        for(size_t i = 0; i < batch_.size(); i++){
+            apply(batch_[i]);
+            batch_[i]->state.store(DONE, std::memory_order_release);
+        }
+        stats_.passes++;
+        stats_.operations += batch_.size();
+    }
+}
+
+/**
+* Runs one request against the tree, recording its result or error.
+*/
+template<class Key, class Value>
+void CombiningAVLTree<Key, Value>::apply(Slot* slot)
+{
+    try{
+        if(slot->op == INSERT){
+            tree_.insert(std::make_pair(slot->key, slot->value));
+        }
+        else if(slot->op == REMOVE){
+            tree_.remove(slot->key);
+        }
+        else{
+            typename AVLTree<Key, Value>::iterator it = tree_.find(slot->key);
+            slot->found = (it != tree_.end());
+            if(slot->found){
+                slot->value = it->second;
+            }
+        }
+    }
+    catch(...){
+        slot->error = std::current_exception();
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CombiningAVLTree class.
+  -------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the CombiningAVLTree::Session class.
+  ------------------------------------------------------------
+*/
+
+/**
+* Claims one of owner's slots. Throws std::runtime_error if every slot
+* belongs to another session.
+*/
+template<class Key, class Value>
+CombiningAVLTree<Key, Value>::Session::Session(CombiningAVLTree& owner) :
+    owner_(owner), slot_(owner.claim())
+{
+
+}
+
+template<class Key, class Value>
+CombiningAVLTree<Key, Value>::Session::~Session()
+{
+    owner_.release(slot_);
+}
+
+/**
+* Inserts the item, overwriting the value of an existing key.
+*/
+template<class Key, class Value>
+void CombiningAVLTree<Key, Value>::Session::insert(const std::pair<const Key, Value>& item)
+{
+    slot_->op = INSERT;
+    slot_->key = item.first;
+    slot_->value = item.second;
+    owner_.submit(slot_);
+}
+
+template<class Key, class Value>
+void CombiningAVLTree<Key, Value>::Session::remove(const Key& key)
+{
+    slot_->op = REMOVE;
+    slot_->key = key;
+    owner_.submit(slot_);
+}
+
+/**
+* Copies the key's value into value and returns true, or returns false
+* if the key is not present.
+*/
+template<class Key, class Value>
+bool CombiningAVLTree<Key, Value>::Session::find(const Key& key, Value& value)
+{
+    slot_->op = FIND;
+    slot_->key = key;
+    owner_.submit(slot_);
+    if(slot_->found){
+        value = slot_->value;
+    }
+    return slot_->found;
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the CombiningAVLTree::Session class.
+  ----------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include "bst.h"
+
+/**
+* An open-addressing hash table from keys to the tree nodes holding
+* them, for O(1) expected point lookups beside a tree that still does
+* the ordered work. Slots hold only a node pointer (the key is read
+* from the node), so the table costs 8 bytes per slot. Linear probing,
+* with deletion by shifting later entries back, so no tombstones build
+* up. The table doubles once it is 70% full.
+*
+* Keys are hashed with std::hash<Key> and then mixed with a Fibonacci
+* multiply, since std::hash is the identity for integers on common
+* standard libraries and sequential keys would otherwise fill one run
+* of slots.
+*/
+template <typename Key, typename Value>
+class NodeHashIndex
+{
+public:
+    NodeHashIndex();
+
+    Node<Key, Value>* find(const Key& key) const;
+    void insert(Node<Key, Value>* n);
+    void erase(const Key& key);
+    void clear();
+
+    size_t size() const;
+    size_t capacity() const;
+    size_t memoryBytes() const;
+
+protected:
+    size_t slotFor(const Key& key) const;
+    void grow();
+
+    std::vector<Node<Key, Value>*> slots_;
+    size_t count_;
+    unsigned bits_;  // slots_.size() == 2^bits_ once allocated
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the NodeHashIndex class.
+  -------------------------------------------------
+*/
+
+/**
+* Starts empty; the first insert allocates the table.
+*/
+template<typename Key, typename Value>
+NodeHashIndex<Key, Value>::NodeHashIndex() :
+    count_(0), bits_(0)
+{
+
+}
+
+/**
+* Returns the node with the given key, or NULL.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>* NodeHashIndex<Key, Value>::find(const Key& key) const
+{
+    if(count_ == 0){
+        return NULL;
+    }
+    size_t mask = slots_.size() - 1;
+    for(size_t i = slotFor(key); slots_[i] != NULL; i = (i + 1) & mask){
+        if(slots_[i]->getKey() == key){
+            return slots_[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+* Adds n, whose key must not be in the index yet.
+*/
+template<typename Key, typename Value>
+void NodeHashIndex<Key, Value>::insert(Node<Key, Value>* n)
+{
+    if(10 * (count_ + 1) > 7 * slots_.size()){
+        grow();
+    }
+    size_t mask = slots_.size() - 1;
+    size_t i = slotFor(n->getKey());
+    while(slots_[i] != NULL){
+        i = (i + 1) & mask;
+    }
+    slots_[i] = n;
+    count_++;
+}
+
+/**
+* Removes the key if present. Entries later in the probe run move back
+* into the hole when their home slot allows, which keeps every run
+* unbroken without tombstones.
+*/
+template<typename Key, typename Value>
+void NodeHashIndex<Key, Value>::erase(const Key& key)
+{
+    if(count_ == 0){
+        return;
+    }
+    size_t mask = slots_.size() - 1;
+    size_t hole = slotFor(key);
+    while(slots_[hole] != NULL && !(slots_[hole]->getKey() == key)){
+        hole = (hole + 1) & mask;
+    }
+    if(slots_[hole] == NULL){
+        return;
+    }
+    slots_[hole] = NULL;
+    count_--;
+
+    for(size_t i = (hole + 1) & mask; slots_[i] != NULL; i = (i + 1) & mask){
+        size_t home = slotFor(slots_[i]->getKey());
+        // the entry may fill the hole unless its home lies cyclically
+        // in (hole, i]
+        if(((i - home) & mask) >= ((i - hole) & mask)){
+            slots_[hole] = slots_[i];
+            slots_[i] = NULL;
+            hole = i;
+        }
+    }
+}
+
+/**
+* Empties the index and releases its table.
+*/
+template<typename Key, typename Value>
+void NodeHashIndex<Key, Value>::clear()
+{
+    std::vector<Node<Key, Value>*>().swap(slots_);
+    count_ = 0;
+    bits_ = 0;
+}
+
+template<typename Key, typename Value>
+size_t NodeHashIndex<Key, Value>::size() const
+{
+    return count_;
+}
+
+template<typename Key, typename Value>
+size_t NodeHashIndex<Key, Value>::capacity() const
+{
+    return slots_.size();
+}
+
+/**
+* Bytes held by the table itself, not counting the nodes.
+*/
+template<typename Key, typename Value>
+size_t NodeHashIndex<Key, Value>::memoryBytes() const
+{
+    return slots_.capacity() * sizeof(Node<Key, Value>*);
+}
+
+/**
+* Home slot of key: the top bits_ bits of its mixed hash.
+*/
+template<typename Key, typename Value>
+size_t NodeHashIndex<Key, Value>::slotFor(const Key& key) const
+{
+    uint64_t h = static_cast<uint64_t>(std::hash<Key>()(key));
+    return static_cast<size_t>((h * 0x9E3779B97F4A7C15ULL) >> (64 - bits_));
+}
+
+/**
+* Doubles the table (starting at 16 slots) and reinserts every entry.
+*/
+template<typename Key, typename Value>
+void NodeHashIndex<Key, Value>::grow()
+{
+    std::vector<Node<Key, Value>*> old;
+    old.swap(slots_);
+    bits_ = (bits_ == 0) ? 4 : bits_ + 1;
+    slots_.assign(size_t(1) << bits_, NULL);
+    size_t mask = slots_.size() - 1;
+    for(size_t j = 0; j < old.size(); j++){
+        if(old[j] != NULL){
+            size_t i = slotFor(old[j]->getKey());
+            while(slots_[i] != NULL){
+                i = (i + 1) & mask;
+            }
+            slots_[i] = old[j];
+        }
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the NodeHashIndex class.
+  -----------------------------------------------
+*/
+
+#endif
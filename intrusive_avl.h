@@ -0,0 +1,709 @@
+#ifndef INTRUSIVE_AVL_H
+#define INTRUSIVE_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+
+/**
+* The links an object needs to sit in an IntrusiveAVLTree. Embed one
+* per tree the object can be in; a hook is in at most one tree at a time.
+*/
+struct AVLHook
+{
+    AVLHook() : parent(NULL), left(NULL), right(NULL), balance(0) { }
+
+    AVLHook* parent;
+    AVLHook* left;
+    AVLHook* right;
+    int8_t balance;  // height of the right subtree minus that of the left
+};
+
+/**
+* An AVL tree over objects the caller owns. T embeds an AVLHook at
+* HookMember and its key at KeyMember; the tree links the objects
+* through their hooks, so inserting and removing never allocate or copy
+* anything, and the caller keeps the objects wherever it likes (an
+* arena, a pool, the stack). The key must not change while the object
+* is linked, and an object must be removed before it is destroyed.
+*
+* The balancing is AVLTree's: the same rotations, the same insert
+* fix-up that stops at the first balanced or rotated level, and the same
+* remove fix-up, working on hooks instead of nodes. Removing an object
+* takes it out where it sits, with no search by key.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+class IntrusiveAVLTree
+{
+public:
+    /**
+    * A bidirectional iterator over the linked objects in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        iterator();
+        T& operator*() const;
+        T* operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    private:
+        friend class IntrusiveAVLTree;
+        iterator(AVLHook* current, const IntrusiveAVLTree* tree);
+        AVLHook* current_;
+        const IntrusiveAVLTree* tree_;
+    };
+
+    IntrusiveAVLTree();
+    ~IntrusiveAVLTree();
+
+    std::pair<iterator, bool> insert(T& obj);
+    void remove(T& obj);
+    iterator erase(iterator pos);
+    void clear();
+
+    iterator find(const Key& key) const;
+    iterator lowerBound(const Key& key) const;
+    iterator iteratorTo(T& obj) const;
+    iterator begin() const;
+    iterator end() const;
+    size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+private:
+    IntrusiveAVLTree(const IntrusiveAVLTree&);
+    IntrusiveAVLTree& operator=(const IntrusiveAVLTree&);
+
+    static T* owner(AVLHook* h);
+    static const Key& keyOf(AVLHook* h);
+    static AVLHook* hookOf(T& obj);
+    static AVLHook* successor(AVLHook* h);
+    static AVLHook* predecessor(AVLHook* h);
+    static int checkHeight(AVLHook* h);
+
+    void replaceChild(AVLHook* parent, AVLHook* from, AVLHook* to);
+    void rotateLeft(AVLHook* n1);
+    void rotateRight(AVLHook* n1);
+    void insertFix(AVLHook* p, AVLHook* n);
+    void removeFix(AVLHook* n, int difference);
+    AVLHook* fixImbalance(AVLHook* n);
+
+    AVLHook* root_;
+    AVLHook* rightmost_;  // for --end()
+    size_t count_;
+};
+
+/*
+  ----------------------------------------------------------
+  Begin implementations for the IntrusiveAVLTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::iterator() :
+    current_(NULL), tree_(NULL)
+{
+
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::iterator(AVLHook* current, const IntrusiveAVLTree* tree) :
+    current_(current), tree_(tree)
+{
+
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+T& IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator*() const
+{
+    return *owner(current_);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+T* IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator->() const
+{
+    return owner(current_);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+bool IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+bool IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator&
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator++()
+{
+    current_ = successor(current_);
+    return *this;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves back one object; decrementing end() gives the largest.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator&
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator--()
+{
+    current_ = (current_ == NULL) ? tree_->rightmost_ : predecessor(current_);
+    return *this;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
+/*
+  --------------------------------------------------------
+  End implementations for the IntrusiveAVLTree::iterator class.
+  --------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the IntrusiveAVLTree class.
+  ---------------------------------------------------
+*/
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::IntrusiveAVLTree() :
+    root_(NULL), rightmost_(NULL), count_(0)
+{
+
+}
+
+/**
+* Unlinks every object; the objects themselves belong to the caller.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::~IntrusiveAVLTree()
+{
+    clear();
+}
+
+/**
+* Links obj into the tree. Returns an iterator to the object with obj's
+* key and whether obj was linked; if the key was already present,
+* nothing changes.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+std::pair<typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator, bool>
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::insert(T& obj)
+{
+    const Key& key = obj.*KeyMember;
+    AVLHook* parent = NULL;
+    AVLHook* curr = root_;
+    bool left = false;
+    while(curr != NULL){
+        parent = curr;
+        if(key < keyOf(curr)){
+            curr = curr->left;
+            left = true;
+        }
+        else if(keyOf(curr) < key){
+            curr = curr->right;
+            left = false;
+        }
+        else{
+            return std::make_pair(iterator(curr, this), false);
+        }
+    }
+    AVLHook* n = hookOf(obj);
+    n->parent = parent;
+    n->left = NULL;
+    n->right = NULL;
+    n->balance = 0;
+    count_++;
+    if(parent == NULL){
+        root_ = n;
+        rightmost_ = n;
+        return std::make_pair(iterator(n, this), true);
+    }
+    if(left){
+        parent->left = n;
+    }
+    else{
+        parent->right = n;
+        if(parent == rightmost_){
+            rightmost_ = n;
+        }
+    }
+    insertFix(parent, n);
+    return std::make_pair(iterator(n, this), true);
+}
+
+/**
+* Unlinks obj, which must be in this tree, and rebalances, in
+* O(log n) with no key comparisons. obj's hook is reset.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::remove(T& obj)
+{
+    AVLHook* n = hookOf(obj);
+    if(n == rightmost_){
+        rightmost_ = predecessor(n);
+    }
+    count_--;
+
+    AVLHook* fixFrom;
+    int difference;
+    if(n->left != NULL && n->right != NULL){
+        // the predecessor takes n's place
+        AVLHook* pred = n->left;
+        while(pred->right != NULL){
+            pred = pred->right;
+        }
+        if(pred == n->left){
+            fixFrom = pred;
+            difference = 1;
+        }
+        else{
+            fixFrom = pred->parent;
+            difference = -1;
+            fixFrom->right = pred->left;
+            if(pred->left != NULL){
+                pred->left->parent = fixFrom;
+            }
+            pred->left = n->left;
+            n->left->parent = pred;
+        }
+        pred->right = n->right;
+        n->right->parent = pred;
+        pred->balance = n->balance;
+        pred->parent = n->parent;
+        replaceChild(n->parent, n, pred);
+    }
+    else{
+        AVLHook* child = (n->left != NULL) ? n->left : n->right;
+        fixFrom = n->parent;
+        difference = (fixFrom != NULL && n == fixFrom->left) ? 1 : -1;
+        if(child != NULL){
+            child->parent = n->parent;
+        }
+        replaceChild(n->parent, n, child);
+    }
+    *n = AVLHook();
+    removeFix(fixFrom, difference);
+}
+
+/**
+* Unlinks the object at pos and returns an iterator to the one after it.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::erase(iterator pos)
+{
+    if(pos.current_ == NULL){
+        return end();
+    }
+    AVLHook* next = successor(pos.current_);
+    remove(*owner(pos.current_));
+    return iterator(next, this);
+}
+
+/**
+* Unlinks every object in O(n), resetting their hooks.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::clear()
+{
+    // post-order walk through parent links, resetting each hook once
+    // both of its subtrees are done
+    AVLHook* curr = root_;
+    while(curr != NULL){
+        if(curr->left != NULL){
+            curr = curr->left;
+        }
+        else if(curr->right != NULL){
+            curr = curr->right;
+        }
+        else{
+            AVLHook* parent = curr->parent;
+            if(parent != NULL){
+                if(parent->left == curr){
+                    parent->left = NULL;
+                }
+                else{
+                    parent->right = NULL;
+                }
+            }
+            *curr = AVLHook();
+            curr = parent;
+        }
+    }
+    root_ = NULL;
+    rightmost_ = NULL;
+    count_ = 0;
+}
+
+/**
+* Returns an iterator to the object with the given key, or end().
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::find(const Key& key) const
+{
+    AVLHook* curr = root_;
+    while(curr != NULL){
+        if(key < keyOf(curr)){
+            curr = curr->left;
+        }
+        else if(keyOf(curr) < key){
+            curr = curr->right;
+        }
+        else{
+            break;
+        }
+    }
+    return iterator(curr, this);
+}
+
+/**
+* Returns an iterator to the first object whose key is not less than
+* key, or end().
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::lowerBound(const Key& key) const
+{
+    AVLHook* curr = root_;
+    AVLHook* best = NULL;
+    while(curr != NULL){
+        if(keyOf(curr) < key){
+            curr = curr->right;
+        }
+        else{
+            best = curr;
+            curr = curr->left;
+        }
+    }
+    return iterator(best, this);
+}
+
+/**
+* Returns an iterator to obj, which must be in this tree, in O(1).
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iteratorTo(T& obj) const
+{
+    return iterator(hookOf(obj), this);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::begin() const
+{
+    AVLHook* curr = root_;
+    while(curr != NULL && curr->left != NULL){
+        curr = curr->left;
+    }
+    return iterator(curr, this);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+typename IntrusiveAVLTree<T, Key, KeyMember, HookMember>::iterator
+IntrusiveAVLTree<T, Key, KeyMember, HookMember>::end() const
+{
+    return iterator(NULL, this);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+size_t IntrusiveAVLTree<T, Key, KeyMember, HookMember>::size() const
+{
+    return count_;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+bool IntrusiveAVLTree<T, Key, KeyMember, HookMember>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Checks every balance against the real subtree heights, in O(n).
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+bool IntrusiveAVLTree<T, Key, KeyMember, HookMember>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+/**
+* The object that embeds hook h.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+T* IntrusiveAVLTree<T, Key, KeyMember, HookMember>::owner(AVLHook* h)
+{
+    // offset of the hook within T, measured on an arbitrary aligned address
+    const T* probe = reinterpret_cast<const T*>(alignof(T) * 64);
+    ptrdiff_t offset = reinterpret_cast<const char*>(&(probe->*HookMember)) - reinterpret_cast<const char*>(probe);
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(h) - offset);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+const Key& IntrusiveAVLTree<T, Key, KeyMember, HookMember>::keyOf(AVLHook* h)
+{
+    return owner(h)->*KeyMember;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+AVLHook* IntrusiveAVLTree<T, Key, KeyMember, HookMember>::hookOf(T& obj)
+{
+    return &(obj.*HookMember);
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+AVLHook* IntrusiveAVLTree<T, Key, KeyMember, HookMember>::successor(AVLHook* h)
+{
+    if(h->right != NULL){
+        h = h->right;
+        while(h->left != NULL){
+            h = h->left;
+        }
+        return h;
+    }
+    AVLHook* up = h->parent;
+    while(up != NULL && up->right == h){
+        h = up;
+        up = up->parent;
+    }
+    return up;
+}
+
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+AVLHook* IntrusiveAVLTree<T, Key, KeyMember, HookMember>::predecessor(AVLHook* h)
+{
+    if(h->left != NULL){
+        h = h->left;
+        while(h->right != NULL){
+            h = h->right;
+        }
+        return h;
+    }
+    AVLHook* up = h->parent;
+    while(up != NULL && up->left == h){
+        h = up;
+        up = up->parent;
+    }
+    return up;
+}
+
+/**
+* Returns the height of the subtree under h, or -1 if any balance in it
+* is wrong or out of range.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+int IntrusiveAVLTree<T, Key, KeyMember, HookMember>::checkHeight(AVLHook* h)
+{
+    if(h == NULL){
+        return 0;
+    }
+    int hl = checkHeight(h->left);
+    int hr = checkHeight(h->right);
+    if(hl < 0 || hr < 0 || hr - hl != h->balance || std::abs(hr - hl) > 1){
+        return -1;
+    }
+    return std::max(hl, hr) + 1;
+}
+
+/**
+* Points parent's link to from (or the root, if parent is NULL) at to.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::replaceChild(AVLHook* parent, AVLHook* from, AVLHook* to)
+{
+    if(parent == NULL){
+        root_ = to;
+    }
+    else if(parent->left == from){
+        parent->left = to;
+    }
+    else{
+        parent->right = to;
+    }
+}
+
+/**
+* Rotates n1's right child up into n1's place.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::rotateLeft(AVLHook* n1)
+{
+    AVLHook* n2 = n1->right;
+    AVLHook* n3 = n1->parent;
+    n1->right = n2->left;
+    if(n2->left != NULL){
+        n2->left->parent = n1;
+    }
+    n2->left = n1;
+    n1->parent = n2;
+    n2->parent = n3;
+    replaceChild(n3, n1, n2);
+}
+
+/**
+* Mirror image of rotateLeft(): n1's left child moves up.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::rotateRight(AVLHook* n1)
+{
+    AVLHook* n2 = n1->left;
+    AVLHook* n3 = n1->parent;
+    n1->left = n2->right;
+    if(n2->right != NULL){
+        n2->right->parent = n1;
+    }
+    n2->right = n1;
+    n1->parent = n2;
+    n2->parent = n3;
+    replaceChild(n3, n1, n2);
+}
+
+/**
+* Walks up from p, whose child n grew by a level, as in
+* AVLTree::insertFix(): stops at a level that became balanced or after
+* one rotation.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::insertFix(AVLHook* p, AVLHook* n)
+{
+    while(p != NULL){
+        p->balance += (n == p->left) ? -1 : 1;
+        if(p->balance == 0){
+            return;
+        }
+        if(p->balance == 2 || p->balance == -2){
+            fixImbalance(p);
+            return;
+        }
+        n = p;
+        p = p->parent;
+    }
+}
+
+/**
+* Walks up from n after the subtree on one side of it lost a level
+* (difference is +1 for the left side, -1 for the right), as in
+* AVLTree::removeFix().
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+void IntrusiveAVLTree<T, Key, KeyMember, HookMember>::removeFix(AVLHook* n, int difference)
+{
+    while(n != NULL){
+        AVLHook* p = n->parent;
+        int parentDifference = (p != NULL && n == p->left) ? 1 : -1;
+
+        n->balance += difference;
+        if(n->balance == 1 || n->balance == -1){
+            // was balanced, so the height is unchanged
+            return;
+        }
+        if(n->balance == 2 || n->balance == -2){
+            if(fixImbalance(n)->balance != 0){
+                // rotating over a balanced child keeps the old height
+                return;
+            }
+        }
+        n = p;
+        difference = parentDifference;
+    }
+}
+
+/**
+* Rotates at n, whose balance is +-2, and returns the subtree's new root.
+*/
+template <typename T, typename Key, const Key T::*KeyMember, AVLHook T::*HookMember>
+AVLHook* IntrusiveAVLTree<T, Key, KeyMember, HookMember>::fixImbalance(AVLHook* n)
+{
+    if(n->balance < 0){
+        AVLHook* c = n->left;
+        if(c->balance <= 0){
+            // zig-zig case
+            rotateRight(n);
+            if(c->balance == 0){
+                n->balance = -1;
+                c->balance = 1;
+            }
+            else{
+                n->balance = 0;
+                c->balance = 0;
+            }
+            return c;
+        }
+        // zig-zag case
+        AVLHook* g = c->right;
+        rotateLeft(c);
+        rotateRight(n);
+        n->balance = (g->balance == -1) ? 1 : 0;
+        c->balance = (g->balance == 1) ? -1 : 0;
+        g->balance = 0;
+        return g;
+    }
+    AVLHook* c = n->right;
+    if(c->balance >= 0){
+        // zig-zig case
+        rotateLeft(n);
+        if(c->balance == 0){
+            n->balance = 1;
+            c->balance = -1;
+        }
+        else{
+            n->balance = 0;
+            c->balance = 0;
+        }
+        return c;
+    }
+    // zig-zag case
+    AVLHook* g = c->left;
+    rotateRight(c);
+    rotateLeft(n);
+    n->balance = (g->balance == 1) ? -1 : 0;
+    c->balance = (g->balance == -1) ? 1 : 0;
+    g->balance = 0;
+    return g;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the IntrusiveAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,1222 @@
+#ifndef LSM_STORE_H
+#define LSM_STORE_H
+
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "avl_wal.h"
+
+/**
+ * Settings for an LSMStore.
+ */
+struct LsmOptions
+{
+    LsmOptions() :
+        memtableBytes(4 << 20), blockBytes(4096), bloomBitsPerKey(10),
+        fanout(4), maxRuns(24), background(true), sync(true) { }
+
+    size_t memtableBytes;    // flush once the memtable holds this many encoded bytes
+    size_t blockBytes;       // data block size; the sparse index has one key per block
+    size_t bloomBitsPerKey;  // Bloom filter size (0 turns the filters off)
+    size_t fanout;           // this many runs of one tier merge into one of the next
+    size_t maxRuns;          // flush() waits for compaction at this many runs
+    bool background;         // compact on a background thread rather than in flush()
+    bool sync;               // fsync run files and the manifest (turn off only for testing)
+};
+
+/**
+ * Counters for judging the store's amplification. Write amplification
+ * is (flushBytes + compactionBytes) / userBytes; read amplification is
+ * blockReads / lookups, the data blocks read per find().
+ */
+struct LsmStats
+{
+    LsmStats() :
+        userBytes(0), flushBytes(0), compactionBytes(0), compactionReadBytes(0),
+        flushes(0), compactions(0), lookups(0), memtableHits(0), bloomSkips(0),
+        blockReads(0), blockReadBytes(0) { }
+
+    uint64_t userBytes;            // encoded keys and values passed to insert/remove
+    uint64_t flushBytes;           // run file bytes written by flushes
+    uint64_t compactionBytes;      // run file bytes written by compactions
+    uint64_t compactionReadBytes;  // data bytes read back by compactions
+    uint64_t flushes;
+    uint64_t compactions;
+    uint64_t lookups;              // find() calls
+    uint64_t memtableHits;         // finds answered by the memtable
+    uint64_t bloomSkips;           // runs a find() skipped on its filter
+    uint64_t blockReads;           // data blocks read by find()
+    uint64_t blockReadBytes;
+};
+
+/**
+ * Fixed-size header at the start of a sorted run file:
+ *
+ *   [LsmRunHeader][data blocks][sparse index][Bloom filter]
+ *
+ * A data block is a sequence of records [uint8 live][key][value], with
+ * the value left out of tombstones (live == 0), in increasing key order.
+ * Blocks end at the first record boundary past LsmOptions::blockBytes.
+ * The sparse index holds [uint64 block offset][key] for the first key of
+ * each block, offsets counted from dataOffset. Keys and values use the
+ * write-ahead log's LogCodec; integers are stored in native byte order.
+ */
+static const char LSM_RUN_MAGIC[8] = { 'A', 'V', 'L', 'R', 'U', 'N', '\0', '\0' };
+static const uint32_t LSM_RUN_VERSION = 1;
+
+struct LsmRunHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t count;           // records, tombstones included
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t indexCount;      // blocks
+    uint64_t indexSize;
+    uint64_t bloomWords;      // 64-bit words following the index
+    uint64_t bloomHashes;
+    uint64_t metaChecksum;    // FNV-1a over the index and the filter
+    uint64_t headerChecksum;  // FNV-1a over every field above
+};
+
+/**
+ * Bloom filter probes for a key: double hashing over a 64-bit mix of
+ * std::hash, which is the identity for integers on common libraries.
+ */
+template <typename Key>
+struct LsmBloom
+{
+    static void probes(const Key& key, uint64_t& h1, uint64_t& h2)
+    {
+        uint64_t h = static_cast<uint64_t>(std::hash<Key>()(key));
+        h1 = mix(h);
+        h2 = mix(h1) | 1;
+    }
+    static uint64_t mix(uint64_t h)
+    {
+        // splitmix64 finalizer
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        return h;
+    }
+};
+
+/**
+ * Syncs the directory holding path, which makes a rename into it
+ * durable.
+ */
+inline void lsmSyncDirectory(const std::string& path)
+{
+    std::string::size_type slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(dirFd < 0){
+        throw std::runtime_error("LSMStore: cannot open directory " + dir);
+    }
+    int synced = fsync(dirFd);
+    ::close(dirFd);
+    if(synced != 0){
+        throw std::runtime_error("LSMStore: cannot sync directory " + dir);
+    }
+}
+
+/**
+ * Writes one sorted run: records are added in increasing key order and
+ * finish() writes the index, filter and header, syncs, and renames the
+ * file into place. A writer dropped before finish() deletes its file.
+ */
+template <typename Key, typename Value>
+class LsmRunWriter
+{
+public:
+    LsmRunWriter(const std::string& path, const LsmOptions& options, uint64_t expected);
+    ~LsmRunWriter();
+
+    void add(const Key& key, bool live, const Value& value);
+    uint64_t count() const;
+    uint64_t finish();
+
+private:
+    LsmRunWriter(const LsmRunWriter&);
+    LsmRunWriter& operator=(const LsmRunWriter&);
+    static int create(const std::string& path);
+
+    std::string path_;
+    std::string tmpPath_;
+    LsmOptions options_;
+    int fd_;
+    MappedRegionWriter data_;
+    std::string index_;
+    uint64_t indexCount_;
+    std::vector<uint64_t> bloom_;
+    uint64_t hashes_;
+    uint64_t count_;
+    size_t blockFill_;
+    std::string record_;
+};
+
+/**
+ * An open, immutable sorted run. The sparse index and the filter stay in
+ * memory; data blocks are read with pread() when a lookup or a merge
+ * needs them. A run marked obsolete (merged away) deletes its file when
+ * the last reference to it goes.
+ */
+template <typename Key, typename Value>
+class LsmRun
+{
+public:
+    enum Lookup { ABSENT, LIVE, DELETED };
+
+    LsmRun(const std::string& path, uint64_t seq, unsigned tier);
+    ~LsmRun();
+
+    bool mayContain(const Key& key) const;
+    Lookup find(const Key& key, Value& value, uint64_t& bytesRead) const;
+    void markObsolete();
+
+    uint64_t seq() const;
+    unsigned tier() const;
+    uint64_t count() const;
+
+    /**
+     * Walks the run's records in key order, one block in memory at a time.
+     */
+    class Cursor
+    {
+    public:
+        explicit Cursor(const LsmRun* run);
+        bool valid() const;
+        void next();
+        const Key& key() const;
+        bool live() const;
+        const Value& value() const;
+        uint64_t bytesRead() const;
+
+    private:
+        void load();
+
+        const LsmRun* run_;
+        size_t block_;
+        std::string buffer_;
+        size_t pos_;
+        bool valid_;
+        Key key_;
+        bool live_;
+        Value value_;
+        uint64_t bytesRead_;
+    };
+
+private:
+    LsmRun(const LsmRun&);
+    LsmRun& operator=(const LsmRun&);
+    void readBlock(size_t block, std::string& out) const;
+    static bool decode(const char*& p, const char* end, Key& key, bool& live, Value& value);
+
+    std::string path_;
+    uint64_t seq_;
+    unsigned tier_;
+    int fd_;
+    LsmRunHeader header_;
+    std::vector<Key> firstKeys_;
+    std::vector<uint64_t> offsets_;  // one per block plus the end of the data
+    std::vector<uint64_t> bloom_;
+    bool obsolete_;
+};
+
+/**
+ * A log-structured merge store: an AVLTree memtable in front of
+ * immutable sorted run files on local disk.
+ *
+ * Writes go to the memtable. Once its encoded size reaches
+ * LsmOptions::memtableBytes, flush() writes it out as a new run of tier
+ * 0. Runs are kept newest first, with tiers growing with age; when
+ * fanout runs of one tier have piled up they are merged into a single
+ * run of the next tier (size-tiered compaction), on a background thread
+ * by default. A merge that includes the oldest run drops tombstones.
+ *
+ * find() checks the memtable and then each run from newest to oldest,
+ * skipping runs whose Bloom filter rules the key out and reading one
+ * data block from each of the others, found through the sparse index.
+ *
+ * The list of live runs is kept in base + ".manifest", rewritten
+ * atomically after every flush and merge, and run files are named
+ * base + "-<seq>.run". The memtable itself is not logged, so writes
+ * since the last flush are lost in a crash; the destructor flushes.
+ *
+ * Like DurableAVLTree, the store is meant for a single caller thread;
+ * only compaction runs beside it.
+ */
+template <typename Key, typename Value>
+class LSMStore
+{
+public:
+    LSMStore(const std::string& base, const LsmOptions& options = LsmOptions());
+    ~LSMStore();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value);
+    void flush();
+    void waitForCompaction();
+
+    size_t memtableSize() const;
+    size_t runCount() const;
+    LsmStats stats() const;
+
+protected:
+    // memtable entry; removes leave a tombstone (live == false)
+    struct Entry
+    {
+        Entry() : live(false) { }
+        Entry(const Value& v, bool l) : value(v), live(l) { }
+        Value value;
+        bool live;
+
+        // the tree's print() needs it
+        friend std::ostream& operator<<(std::ostream& out, const Entry& e)
+        {
+            return e.live ? (out << e.value) : (out << "(removed)");
+        }
+    };
+    typedef std::shared_ptr<LsmRun<Key, Value> > RunPtr;
+
+    void put(const Key& key, const Value& value, bool live);
+    void startCompaction();
+    void compactLoop();
+    bool pickCompaction(size_t& first, size_t& last) const;
+    RunPtr merge(const std::vector<RunPtr>& inputs, uint64_t seq, unsigned tier, bool dropTombstones);
+    void writeManifest(const std::vector<RunPtr>& runs) const;
+    void loadManifest();
+    void checkError();
+    std::string runPath(uint64_t seq) const;
+
+private:
+    LSMStore(const LSMStore&);
+    LSMStore& operator=(const LSMStore&);
+
+    std::string base_;
+    std::string manifestPath_;
+    LsmOptions options_;
+    AVLTree<Key, Entry> memtable_;
+    size_t memtableBytes_;
+    std::string scratch_;
+
+    // mutex_ guards runs_, nextSeq_, compacting_, error_ and the
+    // compaction counters in stats_; the other counters belong to the
+    // caller's thread
+    mutable std::mutex mutex_;
+    std::vector<RunPtr> runs_;  // newest first
+    uint64_t nextSeq_;
+    bool compacting_;
+    std::string error_;
+    std::thread worker_;
+    LsmStats stats_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the LsmRunWriter class.
+  -------------------------------------------------
+*/
+
+/**
+* Starts a run that will be renamed to path by finish(). expected, the
+* number of records that may be added, sizes the Bloom filter.
+*/
+template<typename Key, typename Value>
+LsmRunWriter<Key, Value>::LsmRunWriter(const std::string& path, const LsmOptions& options, uint64_t expected) :
+    path_(path),
+    tmpPath_(path + ".tmp"),
+    options_(options),
+    fd_(create(tmpPath_)),
+    data_(fd_, sizeof(LsmRunHeader)),
+    indexCount_(0),
+    hashes_(0),
+    count_(0),
+    blockFill_(0)
+{
+    if(options_.bloomBitsPerKey > 0){
+        uint64_t bits = std::max<uint64_t>(64, expected * options_.bloomBitsPerKey);
+        bloom_.assign((bits + 63) / 64, 0);
+        // k = ln 2 * bits per key minimizes false positives
+        hashes_ = std::max<uint64_t>(1, static_cast<uint64_t>(options_.bloomBitsPerKey * 0.69 + 0.5));
+    }
+}
+
+/**
+* Deletes the unfinished file, if finish() was never reached.
+*/
+template<typename Key, typename Value>
+LsmRunWriter<Key, Value>::~LsmRunWriter()
+{
+    if(fd_ >= 0){
+        ::close(fd_);
+        ::unlink(tmpPath_.c_str());
+    }
+}
+
+/**
+* Appends a record; keys must come in increasing order. value is
+* ignored for tombstones.
+*/
+template<typename Key, typename Value>
+void LsmRunWriter<Key, Value>::add(const Key& key, bool live, const Value& value)
+{
+    record_.assign(1, static_cast<char>(live ? 1 : 0));
+    LogCodec<Key>::write(key, record_);
+    if(live){
+        LogCodec<Value>::write(value, record_);
+    }
+    if(count_ == 0 || blockFill_ >= options_.blockBytes){
+        // this record starts a new block
+        uint64_t offset = data_.size();
+        index_.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        LogCodec<Key>::write(key, index_);
+        indexCount_++;
+        blockFill_ = 0;
+    }
+    data_.append(record_.data(), record_.size());
+    blockFill_ += record_.size();
+    count_++;
+
+    if(!bloom_.empty()){
+        uint64_t h1, h2;
+        LsmBloom<Key>::probes(key, h1, h2);
+        uint64_t bits = bloom_.size() * 64;
+        for(uint64_t i = 0; i < hashes_; i++){
+            uint64_t bit = (h1 + i * h2) % bits;
+            bloom_[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+    }
+}
+
+template<typename Key, typename Value>
+uint64_t LsmRunWriter<Key, Value>::count() const
+{
+    return count_;
+}
+
+/**
+* Writes the index, filter and header, syncs and renames the file into
+* place. Returns the file's size.
+*/
+template<typename Key, typename Value>
+uint64_t LsmRunWriter<Key, Value>::finish()
+{
+    data_.flush();
+    MappedRegionWriter meta(fd_, sizeof(LsmRunHeader) + data_.size());
+    meta.append(index_.data(), index_.size());
+    if(!bloom_.empty()){
+        meta.append(bloom_.data(), bloom_.size() * sizeof(uint64_t));
+    }
+    meta.flush();
+
+    LsmRunHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, LSM_RUN_MAGIC, sizeof(header.magic));
+    header.version = LSM_RUN_VERSION;
+    header.headerSize = sizeof(LsmRunHeader);
+    header.count = count_;
+    header.dataOffset = sizeof(LsmRunHeader);
+    header.dataSize = data_.size();
+    header.indexCount = indexCount_;
+    header.indexSize = index_.size();
+    header.bloomWords = bloom_.size();
+    header.bloomHashes = hashes_;
+    header.metaChecksum = meta.checksum();
+    header.headerChecksum = mappedChecksum(&header, offsetof(LsmRunHeader, headerChecksum));
+    if(pwrite(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))){
+        throw std::runtime_error("LSMStore: cannot write " + tmpPath_);
+    }
+    if(options_.sync && fsync(fd_) != 0){
+        throw std::runtime_error("LSMStore: fsync failed on " + tmpPath_);
+    }
+    ::close(fd_);
+    fd_ = -1;
+    if(std::rename(tmpPath_.c_str(), path_.c_str()) != 0){
+        ::unlink(tmpPath_.c_str());
+        throw std::runtime_error("LSMStore: cannot rename " + tmpPath_);
+    }
+    if(options_.sync){
+        lsmSyncDirectory(path_);
+    }
+    return sizeof(LsmRunHeader) + data_.size() + meta.size();
+}
+
+template<typename Key, typename Value>
+int LsmRunWriter<Key, Value>::create(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        throw std::runtime_error("LSMStore: cannot create " + path);
+    }
+    return fd;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the LsmRunWriter class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the LsmRun class.
+  -------------------------------------------
+*/
+
+/**
+* Opens the run at path and loads its index and filter. Throws
+* std::runtime_error if the file is not an intact run.
+*/
+template<typename Key, typename Value>
+LsmRun<Key, Value>::LsmRun(const std::string& path, uint64_t seq, unsigned tier) :
+    path_(path), seq_(seq), tier_(tier), fd_(-1), obsolete_(false)
+{
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if(fd_ < 0){
+        throw std::runtime_error("LSMStore: cannot open " + path);
+    }
+    try{
+        if(pread(fd_, &header_, sizeof(header_), 0) != static_cast<ssize_t>(sizeof(header_)) ||
+           std::memcmp(header_.magic, LSM_RUN_MAGIC, sizeof(header_.magic)) != 0 ||
+           header_.version != LSM_RUN_VERSION ||
+           header_.headerSize != sizeof(LsmRunHeader) ||
+           header_.headerChecksum != mappedChecksum(&header_, offsetof(LsmRunHeader, headerChecksum))){
+            throw std::runtime_error("LSMStore: bad run header in " + path);
+        }
+        std::string meta(header_.indexSize + header_.bloomWords * sizeof(uint64_t), '\0');
+        uint64_t metaOffset = header_.dataOffset + header_.dataSize;
+        if(!meta.empty() &&
+           pread(fd_, &meta[0], meta.size(), metaOffset) != static_cast<ssize_t>(meta.size())){
+            throw std::runtime_error("LSMStore: cannot read " + path);
+        }
+        if(mappedChecksum(meta.data(), meta.size()) != header_.metaChecksum){
+            throw std::runtime_error("LSMStore: corrupt index in " + path);
+        }
+
+        const char* p = meta.data();
+        const char* end = p + header_.indexSize;
+        for(uint64_t i = 0; i < header_.indexCount; i++){
+            uint64_t offset;
+            Key key;
+            if(static_cast<size_t>(end - p) < sizeof(offset)){
+                throw std::runtime_error("LSMStore: corrupt index in " + path);
+            }
+            std::memcpy(&offset, p, sizeof(offset));
+            p += sizeof(offset);
+            if(!LogCodec<Key>::read(p, end, key)){
+                throw std::runtime_error("LSMStore: corrupt index in " + path);
+            }
+            offsets_.push_back(offset);
+            firstKeys_.push_back(key);
+        }
+        offsets_.push_back(header_.dataSize);
+        bloom_.resize(header_.bloomWords);
+        if(!bloom_.empty()){
+            std::memcpy(bloom_.data(), end, bloom_.size() * sizeof(uint64_t));
+        }
+    }
+    catch(...){
+        ::close(fd_);
+        throw;
+    }
+}
+
+/**
+* Closes the file, and deletes it if the run was merged away.
+*/
+template<typename Key, typename Value>
+LsmRun<Key, Value>::~LsmRun()
+{
+    ::close(fd_);
+    if(obsolete_){
+        ::unlink(path_.c_str());
+    }
+}
+
+/**
+* False only if the key is certainly not in the run.
+*/
+template<typename Key, typename Value>
+bool LsmRun<Key, Value>::mayContain(const Key& key) const
+{
+    if(bloom_.empty()){
+        return true;
+    }
+    uint64_t h1, h2;
+    LsmBloom<Key>::probes(key, h1, h2);
+    uint64_t bits = bloom_.size() * 64;
+    for(uint64_t i = 0; i < header_.bloomHashes; i++){
+        uint64_t bit = (h1 + i * h2) % bits;
+        if((bloom_[bit / 64] & (uint64_t(1) << (bit % 64))) == 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Looks the key up in the one block that can hold it. Sets value if the
+* key is live; bytesRead grows by the block's size if one was read.
+*/
+template<typename Key, typename Value>
+typename LsmRun<Key, Value>::Lookup
+LsmRun<Key, Value>::find(const Key& key, Value& value, uint64_t& bytesRead) const
+{
+    typename std::vector<Key>::const_iterator it =
+        std::upper_bound(firstKeys_.begin(), firstKeys_.end(), key);
+    if(it == firstKeys_.begin()){
+        return ABSENT;
+    }
+    size_t block = static_cast<size_t>(it - firstKeys_.begin()) - 1;
+    std::string buffer;
+    readBlock(block, buffer);
+    bytesRead += buffer.size();
+
+    const char* p = buffer.data();
+    const char* end = p + buffer.size();
+    Key k;
+    Value v = Value();
+    bool live;
+    while(p < end){
+        if(!decode(p, end, k, live, v)){
+            throw std::runtime_error("LSMStore: corrupt block in " + path_);
+        }
+        if(key < k){
+            break;
+        }
+        if(!(k < key)){
+            if(!live){
+                return DELETED;
+            }
+            value = v;
+            return LIVE;
+        }
+    }
+    return ABSENT;
+}
+
+/**
+* Deletes the file once the last reference to the run is dropped.
+*/
+template<typename Key, typename Value>
+void LsmRun<Key, Value>::markObsolete()
+{
+    obsolete_ = true;
+}
+
+template<typename Key, typename Value>
+uint64_t LsmRun<Key, Value>::seq() const
+{
+    return seq_;
+}
+
+template<typename Key, typename Value>
+unsigned LsmRun<Key, Value>::tier() const
+{
+    return tier_;
+}
+
+template<typename Key, typename Value>
+uint64_t LsmRun<Key, Value>::count() const
+{
+    return header_.count;
+}
+
+template<typename Key, typename Value>
+void LsmRun<Key, Value>::readBlock(size_t block, std::string& out) const
+{
+    uint64_t size = offsets_[block + 1] - offsets_[block];
+    out.resize(size);
+    if(size > 0 &&
+       pread(fd_, &out[0], size, header_.dataOffset + offsets_[block]) != static_cast<ssize_t>(size)){
+        throw std::runtime_error("LSMStore: cannot read " + path_);
+    }
+}
+
+/**
+* Decodes one record at p and advances p past it; false if it is cut off.
+*/
+template<typename Key, typename Value>
+bool LsmRun<Key, Value>::decode(const char*& p, const char* end, Key& key, bool& live, Value& value)
+{
+    if(p >= end){
+        return false;
+    }
+    live = (*p++ != 0);
+    if(!LogCodec<Key>::read(p, end, key)){
+        return false;
+    }
+    return !live || LogCodec<Value>::read(p, end, value);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the LsmRun class.
+  -----------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the LsmRun::Cursor class.
+  ---------------------------------------------------
+*/
+
+/**
+* Starts at the run's first record.
+*/
+template<typename Key, typename Value>
+LsmRun<Key, Value>::Cursor::Cursor(const LsmRun* run) :
+    run_(run), block_(0), pos_(0), valid_(false), live_(false), bytesRead_(0)
+{
+    load();
+    next();
+}
+
+template<typename Key, typename Value>
+bool LsmRun<Key, Value>::Cursor::valid() const
+{
+    return valid_;
+}
+
+/**
+* Moves to the next record, reading the next block when this one runs out.
+*/
+template<typename Key, typename Value>
+void LsmRun<Key, Value>::Cursor::next()
+{
+    while(pos_ >= buffer_.size()){
+        if(block_ >= run_->firstKeys_.size()){
+            valid_ = false;
+            return;
+        }
+        load();
+    }
+    const char* p = buffer_.data() + pos_;
+    const char* end = buffer_.data() + buffer_.size();
+    if(!LsmRun::decode(p, end, key_, live_, value_)){
+        throw std::runtime_error("LSMStore: corrupt block in " + run_->path_);
+    }
+    pos_ = static_cast<size_t>(p - buffer_.data());
+    valid_ = true;
+}
+
+template<typename Key, typename Value>
+const Key& LsmRun<Key, Value>::Cursor::key() const
+{
+    return key_;
+}
+
+template<typename Key, typename Value>
+bool LsmRun<Key, Value>::Cursor::live() const
+{
+    return live_;
+}
+
+template<typename Key, typename Value>
+const Value& LsmRun<Key, Value>::Cursor::value() const
+{
+    return value_;
+}
+
+template<typename Key, typename Value>
+uint64_t LsmRun<Key, Value>::Cursor::bytesRead() const
+{
+    return bytesRead_;
+}
+
+template<typename Key, typename Value>
+void LsmRun<Key, Value>::Cursor::load()
+{
+    if(block_ < run_->firstKeys_.size()){
+        run_->readBlock(block_++, buffer_);
+        bytesRead_ += buffer_.size();
+    }
+    else{
+        buffer_.clear();
+    }
+    pos_ = 0;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the LsmRun::Cursor class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------
+  Begin implementations for the LSMStore class.
+  ---------------------------------------------
+*/
+
+/**
+* Opens the store at base, loading the runs listed in its manifest (or
+* starting empty). Throws std::runtime_error on I/O errors.
+*/
+template<typename Key, typename Value>
+LSMStore<Key, Value>::LSMStore(const std::string& base, const LsmOptions& options) :
+    base_(base),
+    manifestPath_(base + ".manifest"),
+    options_(options),
+    memtableBytes_(0),
+    nextSeq_(1),
+    compacting_(false)
+{
+    if(options_.fanout < 2){
+        throw std::invalid_argument("LSMStore: fanout must be at least 2");
+    }
+    loadManifest();
+}
+
+/**
+* Flushes the memtable and waits for compaction. Errors are swallowed
+* here; call flush() and waitForCompaction() first to see them.
+*/
+template<typename Key, typename Value>
+LSMStore<Key, Value>::~LSMStore()
+{
+    try{
+        flush();
+        waitForCompaction();
+    }
+    catch(const std::exception&){
+    }
+    if(worker_.joinable()){
+        worker_.join();
+    }
+}
+
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    put(keyValuePair.first, keyValuePair.second, true);
+}
+
+/**
+* Records a tombstone, which hides older versions of the key until a
+* merge that reaches the oldest run drops both.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::remove(const Key& key)
+{
+    put(key, Value(), false);
+}
+
+/**
+* Looks the key up in the memtable and then in the runs, newest first.
+* Returns true and sets value if the key is present.
+*/
+template<typename Key, typename Value>
+bool LSMStore<Key, Value>::find(const Key& key, Value& value)
+{
+    stats_.lookups++;
+    typename AVLTree<Key, Entry>::iterator it = memtable_.find(key);
+    if(it != memtable_.end()){
+        stats_.memtableHits++;
+        if(it->second.live){
+            value = it->second.value;
+        }
+        return it->second.live;
+    }
+
+    // a merge may swap runs_ meanwhile, but the copy keeps our runs open
+    std::vector<RunPtr> runs;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        runs = runs_;
+    }
+    for(size_t i = 0; i < runs.size(); i++){
+        if(!runs[i]->mayContain(key)){
+            stats_.bloomSkips++;
+            continue;
+        }
+        uint64_t before = stats_.blockReadBytes;
+        typename LsmRun<Key, Value>::Lookup found = runs[i]->find(key, value, stats_.blockReadBytes);
+        if(stats_.blockReadBytes != before){
+            stats_.blockReads++;
+        }
+        if(found != LsmRun<Key, Value>::ABSENT){
+            return found == LsmRun<Key, Value>::LIVE;
+        }
+    }
+    return false;
+}
+
+/**
+* Writes the memtable out as a new tier 0 run and empties it, then
+* starts any compaction that has become due. Waits for compaction first
+* if LsmOptions::maxRuns runs exist.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::flush()
+{
+    checkError();
+    if(memtable_.empty()){
+        return;
+    }
+    if(runCount() >= options_.maxRuns){
+        waitForCompaction();
+    }
+
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seq = nextSeq_++;
+    }
+    std::string path = runPath(seq);
+    LsmRunWriter<Key, Value> writer(path, options_, memtable_.size());
+    for(typename AVLTree<Key, Entry>::iterator it = memtable_.begin(); it != memtable_.end(); ++it){
+        writer.add(it->first, it->second.live, it->second.value);
+    }
+    uint64_t bytes = writer.finish();
+    RunPtr run(new LsmRun<Key, Value>(path, seq, 0));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<RunPtr> next(runs_);
+        next.insert(next.begin(), run);
+        writeManifest(next);
+        runs_.swap(next);
+        stats_.flushes++;
+        stats_.flushBytes += bytes;
+    }
+    memtable_.clear();
+    memtableBytes_ = 0;
+    startCompaction();
+    checkError();
+}
+
+/**
+* Blocks until no compaction is running, and reports a failed one.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::waitForCompaction()
+{
+    if(worker_.joinable()){
+        worker_.join();
+    }
+    checkError();
+}
+
+/**
+* Number of keys (tombstones included) in the memtable.
+*/
+template<typename Key, typename Value>
+size_t LSMStore<Key, Value>::memtableSize() const
+{
+    return memtable_.size();
+}
+
+template<typename Key, typename Value>
+size_t LSMStore<Key, Value>::runCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return runs_.size();
+}
+
+/**
+* A copy of the counters, taken while compaction cannot update them.
+*/
+template<typename Key, typename Value>
+LsmStats LSMStore<Key, Value>::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+/**
+* Shared path of insert() and remove(): updates the memtable and flushes
+* it once it is full.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::put(const Key& key, const Value& value, bool live)
+{
+    scratch_.clear();
+    LogCodec<Key>::write(key, scratch_);
+    if(live){
+        LogCodec<Value>::write(value, scratch_);
+    }
+    stats_.userBytes += scratch_.size();
+    memtableBytes_ += scratch_.size() + 1;
+    memtable_.insert(std::make_pair(key, Entry(value, live)));
+    if(memtableBytes_ >= options_.memtableBytes){
+        flush();
+    }
+}
+
+/**
+* Starts merging if some tier is full and no merge is running: on the
+* background thread, or right here when background compaction is off.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::startCompaction()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t first, last;
+        if(compacting_ || !pickCompaction(first, last)){
+            return;
+        }
+        compacting_ = true;
+    }
+    if(worker_.joinable()){
+        // the last worker has cleared compacting_, so it is done
+        worker_.join();
+    }
+    if(options_.background){
+        worker_ = std::thread(&LSMStore::compactLoop, this);
+    }
+    else{
+        compactLoop();
+    }
+}
+
+/**
+* Merges full tiers until none is left. Each merge reads its inputs
+* without holding the lock, since runs never change; only choosing the
+* inputs and swapping in the result are done under it.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::compactLoop()
+{
+    for(;;){
+        std::vector<RunPtr> inputs;
+        unsigned tier;
+        bool dropTombstones;
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t first, last;
+            if(!error_.empty() || !pickCompaction(first, last)){
+                compacting_ = false;
+                return;
+            }
+            inputs.assign(runs_.begin() + first, runs_.begin() + last);
+            tier = inputs.front()->tier() + 1;
+            dropTombstones = (last == runs_.size());
+            seq = nextSeq_++;
+        }
+
+        try{
+            RunPtr merged = merge(inputs, seq, tier, dropTombstones);
+            std::lock_guard<std::mutex> lock(mutex_);
+            // flushes only add runs in front, so the inputs are still
+            // next to each other
+            std::vector<RunPtr> next(runs_);
+            typename std::vector<RunPtr>::iterator at =
+                std::find(next.begin(), next.end(), inputs.front());
+            at = next.erase(at, at + inputs.size());
+            if(merged){
+                next.insert(at, merged);
+            }
+            // the inputs may only be deleted once the manifest no longer
+            // lists them
+            writeManifest(next);
+            runs_.swap(next);
+            for(size_t i = 0; i < inputs.size(); i++){
+                inputs[i]->markObsolete();
+            }
+            stats_.compactions++;
+        }
+        catch(const std::exception& e){
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = e.what();
+            compacting_ = false;
+            return;
+        }
+    }
+}
+
+/**
+* Finds the lowest tier with at least fanout runs; [first, last) are its
+* positions in runs_. Called with the lock held.
+*/
+template<typename Key, typename Value>
+bool LSMStore<Key, Value>::pickCompaction(size_t& first, size_t& last) const
+{
+    bool found = false;
+    size_t i = 0;
+    while(i < runs_.size()){
+        size_t j = i + 1;
+        while(j < runs_.size() && runs_[j]->tier() == runs_[i]->tier()){
+            j++;
+        }
+        if(j - i >= options_.fanout && (!found || runs_[i]->tier() < runs_[first]->tier())){
+            first = i;
+            last = j;
+            found = true;
+        }
+        i = j;
+    }
+    return found;
+}
+
+/**
+* Merges the input runs (newest first) into one run of the given tier.
+* Where several inputs hold a key, the newest wins. Returns NULL if
+* nothing is left, which happens when every record was a dropped
+* tombstone.
+*/
+template<typename Key, typename Value>
+typename LSMStore<Key, Value>::RunPtr
+LSMStore<Key, Value>::merge(const std::vector<RunPtr>& inputs, uint64_t seq, unsigned tier, bool dropTombstones)
+{
+    uint64_t expected = 0;
+    std::vector<typename LsmRun<Key, Value>::Cursor> cursors;
+    for(size_t i = 0; i < inputs.size(); i++){
+        expected += inputs[i]->count();
+        cursors.push_back(typename LsmRun<Key, Value>::Cursor(inputs[i].get()));
+    }
+
+    std::string path = runPath(seq);
+    LsmRunWriter<Key, Value> writer(path, options_, expected);
+    for(;;){
+        // inputs are few, so a linear scan for the smallest key will do
+        int smallest = -1;
+        for(size_t i = 0; i < cursors.size(); i++){
+            if(cursors[i].valid() && (smallest < 0 || cursors[i].key() < cursors[smallest].key())){
+                smallest = static_cast<int>(i);
+            }
+        }
+        if(smallest < 0){
+            break;
+        }
+        Key key = cursors[smallest].key();
+        if(cursors[smallest].live() || !dropTombstones){
+            writer.add(key, cursors[smallest].live(), cursors[smallest].value());
+        }
+        for(size_t i = 0; i < cursors.size(); i++){
+            if(cursors[i].valid() && !(key < cursors[i].key())){
+                cursors[i].next();
+            }
+        }
+    }
+
+    uint64_t readBytes = 0;
+    for(size_t i = 0; i < cursors.size(); i++){
+        readBytes += cursors[i].bytesRead();
+    }
+    if(writer.count() == 0){
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.compactionReadBytes += readBytes;
+        return RunPtr();
+    }
+    uint64_t bytes = writer.finish();
+    RunPtr run(new LsmRun<Key, Value>(path, seq, tier));
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.compactionReadBytes += readBytes;
+    stats_.compactionBytes += bytes;
+    return run;
+}
+
+/**
+* Replaces the manifest with the given run list: a "lsm 1" line, then
+* one "<seq> <tier>" line per run, newest first. Written to a temporary
+* file and renamed over the old one. Called with the lock held, before
+* runs_ takes the new list.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::writeManifest(const std::vector<RunPtr>& runs) const
+{
+    std::ostringstream out;
+    out << "lsm 1\n";
+    for(size_t i = 0; i < runs.size(); i++){
+        out << runs[i]->seq() << " " << runs[i]->tier() << "\n";
+    }
+    std::string text = out.str();
+    std::string tmp = manifestPath_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        throw std::runtime_error("LSMStore: cannot create " + tmp);
+    }
+    bool ok = (::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+    ok = ok && (!options_.sync || fsync(fd) == 0);
+    ::close(fd);
+    if(!ok || std::rename(tmp.c_str(), manifestPath_.c_str()) != 0){
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("LSMStore: cannot write " + manifestPath_);
+    }
+    if(options_.sync){
+        lsmSyncDirectory(manifestPath_);
+    }
+}
+
+/**
+* Opens the runs the manifest lists, if there is one.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::loadManifest()
+{
+    std::ifstream in(manifestPath_.c_str());
+    if(!in){
+        return;
+    }
+    std::string magic;
+    int version;
+    if(!(in >> magic >> version) || magic != "lsm" || version != 1){
+        throw std::runtime_error("LSMStore: bad manifest " + manifestPath_);
+    }
+    uint64_t seq;
+    unsigned tier;
+    while(in >> seq >> tier){
+        runs_.push_back(RunPtr(new LsmRun<Key, Value>(runPath(seq), seq, tier)));
+        nextSeq_ = std::max(nextSeq_, seq + 1);
+    }
+    if(!in.eof()){
+        throw std::runtime_error("LSMStore: bad manifest " + manifestPath_);
+    }
+}
+
+/**
+* Rethrows, once, the error that stopped the last compaction.
+*/
+template<typename Key, typename Value>
+void LSMStore<Key, Value>::checkError()
+{
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error.swap(error_);
+    }
+    if(!error.empty()){
+        throw std::runtime_error("LSMStore: compaction failed: " + error);
+    }
+}
+
+template<typename Key, typename Value>
+std::string LSMStore<Key, Value>::runPath(uint64_t seq) const
+{
+    std::ostringstream name;
+    name << base_ << "-" << seq << ".run";
+    return name.str();
+}
+
+/*
+  -------------------------------------------
+  End implementations for the LSMStore class.
+  -------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,716 @@
+#ifndef MAPPED_AVL_H
+#define MAPPED_AVL_H
+
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "avlbst.h"
+
+/**
+ * On-disk tree format written by AVLTree::saveTo() and read in place by
+ * MappedAVLTree. The file is a header followed by one fixed-size record
+ * per node and a blob area for variable-length data:
+ *
+ *   [MappedHeader][records in breadth-first order][blob bytes]
+ *
+ * Records refer to each other (and to the blob area) by byte offsets from
+ * the start of the file, with 0 meaning "none", so a mapping can be used
+ * at any address without fixing up pointers. Breadth-first order packs the
+ * top levels of the tree into the first few pages, which stay hot, while
+ * the rest of the file is only paged in as searches reach it.
+ * Integers are stored in native byte order.
+ */
+
+static const char MAPPED_AVL_MAGIC[8] = { 'A', 'V', 'L', 'M', 'A', 'P', '\0', '\0' };
+static const uint32_t MAPPED_AVL_VERSION = 1;
+
+struct MappedHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t count;             // number of records
+    uint64_t root;              // offset of the root record, 0 if empty
+    uint64_t recordSize;
+    uint64_t keySize;           // sizes of the stored key/value fields,
+    uint64_t valueSize;         // used to reject a file of another type
+    uint64_t recordsOffset;
+    uint64_t blobOffset;
+    uint64_t blobSize;
+    uint64_t recordsChecksum;   // FNV-1a over the record area
+    uint64_t blobChecksum;      // FNV-1a over the blob area
+    uint64_t headerChecksum;    // FNV-1a over every field above
+};
+
+/**
+ * 64-bit FNV-1a, continuing from hash so a region can be fed in pieces.
+ */
+inline uint64_t mappedChecksum(const void* data, size_t len,
+                               uint64_t hash = 14695981039346656037ULL)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < len; i++){
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Buffered writer for one region of a file, starting at a fixed offset.
+ * Keeps a running checksum of everything appended. Data still buffered
+ * is only written by flush().
+ */
+class MappedRegionWriter
+{
+public:
+    MappedRegionWriter(int fd, uint64_t start) :
+        fd_(fd), start_(start), written_(0),
+        checksum_(mappedChecksum(NULL, 0))
+    {
+    }
+
+    // Appends len bytes and returns the absolute file offset they land at
+    uint64_t append(const void* data, size_t len)
+    {
+        uint64_t offset = start_ + written_;
+        const char* bytes = static_cast<const char*>(data);
+        buffer_.insert(buffer_.end(), bytes, bytes + len);
+        written_ += len;
+        checksum_ = mappedChecksum(data, len, checksum_);
+        if(buffer_.size() >= (1 << 20)){
+            flush();
+        }
+        return offset;
+    }
+
+    void flush()
+    {
+        uint64_t at = start_ + written_ - buffer_.size();
+        size_t done = 0;
+        while(done < buffer_.size()){
+            ssize_t n = pwrite(fd_, buffer_.data() + done, buffer_.size() - done, at + done);
+            if(n < 0){
+                throw std::runtime_error("MappedAVLTree: write failed");
+            }
+            done += static_cast<size_t>(n);
+        }
+        buffer_.clear();
+    }
+
+    uint64_t size() const { return written_; }
+    uint64_t checksum() const { return checksum_; }
+
+private:
+    int fd_;
+    uint64_t start_;
+    uint64_t written_;
+    uint64_t checksum_;
+    std::vector<char> buffer_;
+};
+
+/**
+ * Serializer hook that decides how a key or value is stored in a record.
+ *
+ * Trivially copyable types are stored inline and read back in place, so a
+ * MappedAVLTree of them hands out references straight into the mapping.
+ * Other types need a specialization that provides:
+ *
+ *   typedef ... Stored;   // trivially copyable field kept in the record
+ *   typedef ... Result;   // what lookups return (T or const T&)
+ *   static void encode(const T& in, Stored& out, MappedRegionWriter& blob);
+ *   static Result decode(const Stored& s, const char* base);
+ *   static bool less(const Stored& s, const char* base, const T& k);    // s < k
+ *   static bool greater(const Stored& s, const char* base, const T& k); // s > k
+ *
+ * base is the start of the mapping, so blob offsets can be resolved.
+ * See the std::string specialization below for an example.
+ */
+template <typename T, bool Trivial = std::is_trivially_copyable<T>::value>
+struct MappedCodec;
+
+template <typename T>
+struct MappedCodec<T, true>
+{
+    typedef T Stored;
+    typedef const T& Result;
+
+    static void encode(const T& in, Stored& out, MappedRegionWriter&)
+    {
+        std::memcpy(static_cast<void*>(&out), static_cast<const void*>(&in), sizeof(T));
+    }
+    static Result decode(const Stored& s, const char*)
+    {
+        return s;
+    }
+    static bool less(const Stored& s, const char*, const T& k)
+    {
+        return s < k;
+    }
+    static bool greater(const Stored& s, const char*, const T& k)
+    {
+        return k < s;
+    }
+};
+
+/**
+ * Strings are stored as an (offset, length) pair into the blob area and
+ * compared against search keys byte by byte, without allocating.
+ */
+template <>
+struct MappedCodec<std::string, false>
+{
+    struct Stored
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+    typedef std::string Result;
+
+    static void encode(const std::string& in, Stored& out, MappedRegionWriter& blob)
+    {
+        out.offset = blob.append(in.data(), in.size());
+        out.length = in.size();
+    }
+    static Result decode(const Stored& s, const char* base)
+    {
+        return std::string(base + s.offset, s.length);
+    }
+    static int compare(const Stored& s, const char* base, const std::string& k)
+    {
+        size_t len = s.length < k.size() ? s.length : k.size();
+        int c = std::memcmp(base + s.offset, k.data(), len);
+        if(c != 0){
+            return c;
+        }
+        return (s.length < k.size()) ? -1 : (s.length > k.size() ? 1 : 0);
+    }
+    static bool less(const Stored& s, const char* base, const std::string& k)
+    {
+        return compare(s, base, k) < 0;
+    }
+    static bool greater(const Stored& s, const char* base, const std::string& k)
+    {
+        return compare(s, base, k) > 0;
+    }
+};
+
+/**
+ * One node as laid out in the file.
+ */
+template <typename Key, typename Value>
+struct MappedRecord
+{
+    uint64_t parent;
+    uint64_t left;
+    uint64_t right;
+    typename MappedCodec<Key>::Stored key;
+    typename MappedCodec<Value>::Stored value;
+    int8_t balance;
+};
+
+/**
+ * A read-only AVL tree searched and iterated directly inside a file
+ * written by AVLTree::saveTo(). Nothing is deserialized on open: the
+ * header is validated and the rest of the file is paged in on demand.
+ */
+template <typename Key, typename Value>
+class MappedAVLTree
+{
+public:
+    typedef MappedCodec<Key> KeyCodec;
+    typedef MappedCodec<Value> ValueCodec;
+    typedef MappedRecord<Key, Value> Record;
+
+    class iterator
+    {
+    public:
+        iterator();
+
+        typename KeyCodec::Result key() const;
+        typename ValueCodec::Result value() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class MappedAVLTree<Key, Value>;
+        iterator(const char* base, uint64_t offset);
+        const Record* record(uint64_t offset) const;
+
+        const char* base_;
+        uint64_t offset_;
+    };
+
+    MappedAVLTree();
+    MappedAVLTree(MappedAVLTree&& other);
+    MappedAVLTree& operator=(MappedAVLTree&& other);
+    ~MappedAVLTree();
+
+    static MappedAVLTree open(const std::string& path);
+    void close();
+    bool verify() const;
+
+    size_t size() const;
+    bool empty() const;
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    typename ValueCodec::Result operator[](const Key& key) const;
+
+private:
+    MappedAVLTree(const MappedAVLTree&);
+    MappedAVLTree& operator=(const MappedAVLTree&);
+
+    const MappedHeader* header() const;
+    const Record* record(uint64_t offset) const;
+
+    const char* base_;
+    size_t length_;
+};
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the MappedAVLTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to end().
+*/
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>::iterator::iterator() :
+    base_(NULL), offset_(0)
+{
+}
+
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>::iterator::iterator(const char* base, uint64_t offset) :
+    base_(base), offset_(offset)
+{
+}
+
+template<typename Key, typename Value>
+const typename MappedAVLTree<Key, Value>::Record*
+MappedAVLTree<Key, Value>::iterator::record(uint64_t offset) const
+{
+    return reinterpret_cast<const Record*>(base_ + offset);
+}
+
+/**
+* The key of the current record, read in place for trivially copyable keys.
+*/
+template<typename Key, typename Value>
+typename MappedCodec<Key>::Result
+MappedAVLTree<Key, Value>::iterator::key() const
+{
+    return KeyCodec::decode(record(offset_)->key, base_);
+}
+
+/**
+* The value of the current record, read in place for trivially copyable values.
+*/
+template<typename Key, typename Value>
+typename MappedCodec<Value>::Result
+MappedAVLTree<Key, Value>::iterator::value() const
+{
+    return ValueCodec::decode(record(offset_)->value, base_);
+}
+
+template<typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return offset_ == rhs.offset_;
+}
+
+template<typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return offset_ != rhs.offset_;
+}
+
+/**
+* Advances to the in-order successor by following record offsets.
+*/
+template<typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator&
+MappedAVLTree<Key, Value>::iterator::operator++()
+{
+    if(offset_ == 0){
+        return *this;
+    }
+    const Record* curr = record(offset_);
+    if(curr->right != 0){
+        offset_ = curr->right;
+        while(record(offset_)->left != 0){
+            offset_ = record(offset_)->left;
+        }
+    }
+    else{
+        uint64_t child = offset_;
+        offset_ = curr->parent;
+        while(offset_ != 0 && record(offset_)->right == child){
+            child = offset_;
+            offset_ = record(offset_)->parent;
+        }
+    }
+    return *this;
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the MappedAVLTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the MappedAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* An empty, closed tree.
+*/
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>::MappedAVLTree() :
+    base_(NULL), length_(0)
+{
+}
+
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>::MappedAVLTree(MappedAVLTree&& other) :
+    base_(other.base_), length_(other.length_)
+{
+    other.base_ = NULL;
+    other.length_ = 0;
+}
+
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>&
+MappedAVLTree<Key, Value>::operator=(MappedAVLTree&& other)
+{
+    if(this != &other){
+        close();
+        base_ = other.base_;
+        length_ = other.length_;
+        other.base_ = NULL;
+        other.length_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value>::~MappedAVLTree()
+{
+    close();
+}
+
+/**
+* Maps the file at path read-only and validates its header: magic,
+* version, header checksum, record layout and that every region lies
+* inside the file. Record and blob contents are not touched, so pages
+* load lazily as they are used; call verify() to check them as well.
+* Throws std::runtime_error if the file cannot be used.
+*/
+template<typename Key, typename Value>
+MappedAVLTree<Key, Value> MappedAVLTree<Key, Value>::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        throw std::runtime_error("MappedAVLTree: cannot open " + path);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MappedHeader)){
+        ::close(fd);
+        throw std::runtime_error("MappedAVLTree: " + path + " is too small");
+    }
+    size_t length = static_cast<size_t>(st.st_size);
+    void* addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED){
+        throw std::runtime_error("MappedAVLTree: cannot map " + path);
+    }
+
+    MappedAVLTree tree;
+    tree.base_ = static_cast<const char*>(addr);
+    tree.length_ = length;
+
+    const MappedHeader* h = tree.header();
+    const char* problem = NULL;
+    if(std::memcmp(h->magic, MAPPED_AVL_MAGIC, sizeof(h->magic)) != 0){
+        problem = "bad magic";
+    }
+    else if(h->version != MAPPED_AVL_VERSION || h->headerSize != sizeof(MappedHeader)){
+        problem = "unsupported version";
+    }
+    else if(h->headerChecksum != mappedChecksum(h, offsetof(MappedHeader, headerChecksum))){
+        problem = "header checksum mismatch";
+    }
+    else if(h->recordSize != sizeof(Record) ||
+            h->keySize != sizeof(typename KeyCodec::Stored) ||
+            h->valueSize != sizeof(typename ValueCodec::Stored)){
+        problem = "key/value layout does not match this tree type";
+    }
+    else if(h->recordsOffset + h->count * h->recordSize > h->blobOffset ||
+            h->blobOffset + h->blobSize > length){
+        problem = "truncated file";
+    }
+    if(problem != NULL){
+        throw std::runtime_error(std::string("MappedAVLTree: ") + path + ": " + problem);
+    }
+
+    // searches jump around the file, so don't read ahead
+    madvise(addr, length, MADV_RANDOM);
+    return tree;
+}
+
+/**
+* Unmaps the file. The tree is empty afterwards.
+*/
+template<typename Key, typename Value>
+void MappedAVLTree<Key, Value>::close()
+{
+    if(base_ != NULL){
+        munmap(const_cast<char*>(base_), length_);
+        base_ = NULL;
+        length_ = 0;
+    }
+}
+
+/**
+* Checks the record and blob checksums. This reads the whole file.
+*/
+template<typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::verify() const
+{
+    if(base_ == NULL){
+        return true;
+    }
+    const MappedHeader* h = header();
+    return mappedChecksum(base_ + h->recordsOffset, h->count * h->recordSize) == h->recordsChecksum &&
+           mappedChecksum(base_ + h->blobOffset, h->blobSize) == h->blobChecksum;
+}
+
+template<typename Key, typename Value>
+size_t MappedAVLTree<Key, Value>::size() const
+{
+    return base_ == NULL ? 0 : static_cast<size_t>(header()->count);
+}
+
+template<typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Returns an iterator to the smallest key.
+*/
+template<typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::begin() const
+{
+    if(base_ == NULL || header()->root == 0){
+        return end();
+    }
+    uint64_t curr = header()->root;
+    while(record(curr)->left != 0){
+        curr = record(curr)->left;
+    }
+    return iterator(base_, curr);
+}
+
+template<typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::end() const
+{
+    return iterator(base_, 0);
+}
+
+/**
+* Searches the mapped records for key, comparing against the stored
+* keys in place.
+*/
+template<typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::find(const Key& key) const
+{
+    uint64_t curr = (base_ == NULL) ? 0 : header()->root;
+    while(curr != 0){
+        const Record* r = record(curr);
+        if(KeyCodec::greater(r->key, base_, key)){
+            curr = r->left;
+        }
+        else if(KeyCodec::less(r->key, base_, key)){
+            curr = r->right;
+        }
+        else{
+            return iterator(base_, curr);
+        }
+    }
+    return end();
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value>
+typename MappedCodec<Value>::Result
+MappedAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it.value();
+}
+
+template<typename Key, typename Value>
+const MappedHeader* MappedAVLTree<Key, Value>::header() const
+{
+    return reinterpret_cast<const MappedHeader*>(base_);
+}
+
+template<typename Key, typename Value>
+const typename MappedAVLTree<Key, Value>::Record*
+MappedAVLTree<Key, Value>::record(uint64_t offset) const
+{
+    return reinterpret_cast<const Record*>(base_ + offset);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the MappedAVLTree class.
+  -------------------------------------------------
+*/
+
+/**
+* Writes the tree to path in the MappedAVLTree format. Records are
+* written breadth first; keys and values go through MappedCodec. The
+* file is built under a temporary name, synced and renamed over path,
+* and the directory is synced, so readers (and restarts after a crash)
+* see either the old file or the complete new one. A tree
+* holding tombstones is saved through a compacted copy, since records
+* mirror the tree's shape.
+* Throws std::runtime_error on I/O errors.
+*/
+template<class Key, class Value>
+void AVLTree<Key, Value>::saveTo(const std::string& path) const
+{
+    typedef MappedRecord<Key, Value> Record;
+
+    if(this->header_.dead != 0){
+        AVLTree<Key, Value> live;
+        // by node rather than by iterator, since a set's iterators give keys
+        for(Node<Key, Value>* n = this->getSmallestNode(); n != NULL; n = this->nextNode(n)){
+            if(!n->isTombstone()){
+                live.insert(std::pair<const Key, Value>(n->getKey(), n->getValue()));
+            }
+        }
+        live.saveTo(path);
+        return;
+    }
+
+    uint64_t count = 0;
+    for(typename BinarySearchTree<Key, Value>::iterator it = this->begin(); it != this->end(); ++it){
+        count++;
+    }
+
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        throw std::runtime_error("AVLTree::saveTo: cannot create " + tmpPath);
+    }
+
+    MappedHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, MAPPED_AVL_MAGIC, sizeof(h.magic));
+    h.version = MAPPED_AVL_VERSION;
+    h.headerSize = sizeof(MappedHeader);
+    h.count = count;
+    h.recordSize = sizeof(Record);
+    h.keySize = sizeof(typename MappedCodec<Key>::Stored);
+    h.valueSize = sizeof(typename MappedCodec<Value>::Stored);
+    h.recordsOffset = (sizeof(MappedHeader) + 63) & ~static_cast<uint64_t>(63);
+    h.blobOffset = h.recordsOffset + count * sizeof(Record);
+    h.root = (count == 0) ? 0 : h.recordsOffset;
+
+    try{
+        MappedRegionWriter records(fd, h.recordsOffset);
+        MappedRegionWriter blob(fd, h.blobOffset);
+
+        // Breadth-first walk. Children are numbered as they are queued,
+        // so each record knows its children's offsets when it is written.
+        std::vector<std::pair<AVLNode<Key, Value>*, uint64_t> > queue;
+        if(this->root_ != NULL){
+            queue.push_back(std::make_pair(static_cast<AVLNode<Key, Value>*>(this->root_), 0));
+        }
+        for(size_t i = 0; i < queue.size(); i++){
+            AVLNode<Key, Value>* n = queue[i].first;
+            Record r;
+            std::memset(static_cast<void*>(&r), 0, sizeof(r));
+            r.parent = queue[i].second;
+            r.balance = n->getBalance();
+            uint64_t self = h.recordsOffset + i * sizeof(Record);
+            if(n->getLeft() != NULL){
+                r.left = h.recordsOffset + queue.size() * sizeof(Record);
+                queue.push_back(std::make_pair(n->getLeft(), self));
+            }
+            if(n->getRight() != NULL){
+                r.right = h.recordsOffset + queue.size() * sizeof(Record);
+                queue.push_back(std::make_pair(n->getRight(), self));
+            }
+            MappedCodec<Key>::encode(n->getKey(), r.key, blob);
+            MappedCodec<Value>::encode(n->getValue(), r.value, blob);
+            records.append(&r, sizeof(r));
+        }
+        records.flush();
+        blob.flush();
+
+        h.blobSize = blob.size();
+        h.recordsChecksum = records.checksum();
+        h.blobChecksum = blob.checksum();
+        h.headerChecksum = mappedChecksum(&h, offsetof(MappedHeader, headerChecksum));
+        // the record area may be empty, so set the length explicitly
+        if(pwrite(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) ||
+           ftruncate(fd, h.blobOffset + h.blobSize) != 0 || fsync(fd) != 0){
+            throw std::runtime_error("AVLTree::saveTo: write failed");
+        }
+    }
+    catch(...){
+        ::close(fd);
+        unlink(tmpPath.c_str());
+        throw;
+    }
+    ::close(fd);
+    if(rename(tmpPath.c_str(), path.c_str()) != 0){
+        unlink(tmpPath.c_str());
+        throw std::runtime_error("AVLTree::saveTo: cannot replace " + path);
+    }
+
+    // the rename is only durable once the directory entry is synced
+    std::string::size_type slash = path.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(dirFd < 0){
+        throw std::runtime_error("AVLTree::saveTo: cannot open directory " + dir);
+    }
+    int synced = fsync(dirFd);
+    ::close(dirFd);
+    if(synced != 0){
+        throw std::runtime_error("AVLTree::saveTo: cannot sync directory " + dir);
+    }
+}
+
+#endif
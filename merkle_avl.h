@@ -0,0 +1,979 @@
+#ifndef MERKLE_AVL_H
+#define MERKLE_AVL_H
+
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <unistd.h>
+#include "avl_wal.h"
+
+/**
+* An AVL node that also carries the hash of its own item and the hash
+* and size of its subtree.
+*/
+template <typename Key, typename Value>
+class MerkleAVLNode : public AVLNode<Key, Value>
+{
+public:
+    MerkleAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    virtual ~MerkleAVLNode();
+
+    uint64_t getItemHash() const;
+    void setItemHash(uint64_t hash);
+    uint64_t getHash() const;
+    size_t getCount() const;
+    void recompute();
+
+protected:
+    uint64_t itemHash_;
+    uint64_t hash_;    // sum of the item hashes in the subtree
+    size_t count_;     // nodes in the subtree
+};
+
+/**
+* A key range [lo, hi); an end without a bound is open.
+*/
+template <typename Key>
+struct MerkleRange
+{
+    MerkleRange() : hasLo(false), hasHi(false), lo(), hi() { }
+    bool hasLo;
+    bool hasHi;
+    Key lo;
+    Key hi;
+};
+
+/**
+* One key on which two replicas disagree. theirs holds the other
+* replica's value unless the key is ONLY_HERE.
+*/
+template <typename Key, typename Value>
+struct MerkleDelta
+{
+    enum Kind { ONLY_HERE, ONLY_THERE, CHANGED };
+    Kind kind;
+    Key key;
+    Value theirs;
+};
+
+/**
+* The replica diff() compares against: it answers with the count, hash
+* and median key of a key range, and with the items of a small range.
+* MerkleTreePeer wraps a tree in this process; MerklePipePeer talks to
+* serveMerkle() in another one.
+*/
+template <typename Key, typename Value>
+class MerklePeer
+{
+public:
+    virtual ~MerklePeer() { }
+    // sets count and hash; sets mid and returns true if count >= 2
+    virtual bool summary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash, Key& mid) = 0;
+    virtual void items(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out) = 0;
+};
+
+/**
+* An AVLTree that keeps a hash of every subtree, for comparing replicas
+* without reading them in full.
+*
+* A subtree's hash is the sum (mod 2^64) of its items' hashes, each a
+* mixed FNV-1a of the item's LogCodec encoding. A sum does not depend on
+* the tree's shape, and replicas built in different orders have
+* different shapes; so the hash of any key range can be read off the
+* tree in O(log n), and two replicas agree on a range exactly when
+* their range hashes do (up to hash collisions).
+*
+* diff() bisects the key space: ranges whose counts and hashes match on
+* both sides are skipped, others are split at a median key until they
+* hold a few items, which are then compared directly. d differing keys
+* cost O(d log n) range comparisons, each O(log n) on either side.
+*
+* Hashes are updated by insert, remove, extract and the rotations of
+* their fix-ups (through noteRelinked()). Values changed in place via
+* operator[] or an iterator bypass the hashes; change values with
+* insert(). settle() and rebalance() recompute all hashes in O(n).
+* Tombstones would leave removed items in the subtree sums, so
+* setTombstoneMode() is not available.
+*/
+template <typename Key, typename Value>
+class MerkleAVLTree : public AVLTree<Key, Value>
+{
+public:
+    static const size_t LEAF_ITEMS = 16;  // ranges this small are compared item by item
+
+    MerkleAVLTree();
+    using AVLTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& new_item);
+    virtual bool settleStep(size_t budget);
+    virtual void setTombstoneMode(bool enable, double maxDeadFraction = 0.25);
+
+    uint64_t rootHash() const;
+    void rangeSummary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash) const;
+    bool rangeMedian(const MerkleRange<Key>& range, Key& mid) const;
+    void rangeItems(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out) const;
+
+    size_t diff(const MerkleAVLTree& other, std::vector<MerkleDelta<Key, Value> >& out) const;
+    size_t diff(MerklePeer<Key, Value>& peer, std::vector<MerkleDelta<Key, Value> >& out) const;
+    size_t syncFrom(MerklePeer<Key, Value>& peer);
+
+    static uint64_t itemHash(const Key& key, const Value& value);
+
+protected:
+    virtual AVLNode<Key,Value>* createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent);
+    virtual bool acceptsNode(Node<Key,Value>* n) const;
+    virtual void linkNode(Node<Key,Value>* parent, Node<Key,Value>* n);
+    virtual void unlinkNode(Node<Key,Value>* n);
+    virtual void noteRelinked(Node<Key,Value>* n);
+    virtual bool erasesByNode() const;
+
+    void refresh(Node<Key,Value>* from);
+    void rehashAll();
+    static size_t countOf(Node<Key,Value>* n);
+    static uint64_t hashOf(Node<Key,Value>* n);
+    void below(const Key& key, size_t& count, uint64_t& hash) const;
+    size_t diffRange(MerklePeer<Key, Value>& peer, const MerkleRange<Key>& range,
+                     std::vector<MerkleDelta<Key, Value> >& out) const;
+
+    // nodes moved by the current operation's rotations, oldest first
+    std::vector<Node<Key,Value>*> moved_;
+};
+
+/**
+* A MerklePeer for a tree in the same process.
+*/
+template <typename Key, typename Value>
+class MerkleTreePeer : public MerklePeer<Key, Value>
+{
+public:
+    explicit MerkleTreePeer(const MerkleAVLTree<Key, Value>& tree);
+    virtual bool summary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash, Key& mid);
+    virtual void items(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out);
+
+private:
+    const MerkleAVLTree<Key, Value>& tree_;
+};
+
+/**
+* A MerklePeer on the far end of a pair of pipes (or a socket, with the
+* same descriptor twice), answered by serveMerkle(). Requests and replies
+* are frames of [uint32 length][payload], payloads encoded with LogCodec:
+*
+*   request  'S' [range]   reply [uint64 count][uint64 hash][uint8 has mid][mid]
+*   request  'I' [range]   reply [uint64 n] then n times [key][value]
+*   request  'Q'           no reply; the server returns
+*
+* where [range] is [uint8 bounds: 1 = lo, 2 = hi][lo if bounded][hi if
+* bounded]. Both ends must agree on the codec, so on Key and Value.
+*/
+template <typename Key, typename Value>
+class MerklePipePeer : public MerklePeer<Key, Value>
+{
+public:
+    MerklePipePeer(int inFd, int outFd);
+    ~MerklePipePeer();
+    virtual bool summary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash, Key& mid);
+    virtual void items(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out);
+    void close();
+    uint64_t bytesSent() const;
+    uint64_t bytesReceived() const;
+
+private:
+    MerklePipePeer(const MerklePipePeer&);
+    MerklePipePeer& operator=(const MerklePipePeer&);
+
+    int inFd_;
+    int outFd_;
+    bool open_;
+    uint64_t sent_;
+    uint64_t received_;
+    std::string buffer_;
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the MerkleAVLNode class.
+  ------------------------------------------------
+*/
+
+template<class Key, class Value>
+MerkleAVLNode<Key, Value>::MerkleAVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), itemHash_(0), hash_(0), count_(1)
+{
+
+}
+
+template<class Key, class Value>
+MerkleAVLNode<Key, Value>::~MerkleAVLNode()
+{
+
+}
+
+template<class Key, class Value>
+uint64_t MerkleAVLNode<Key, Value>::getItemHash() const
+{
+    return itemHash_;
+}
+
+template<class Key, class Value>
+void MerkleAVLNode<Key, Value>::setItemHash(uint64_t hash)
+{
+    itemHash_ = hash;
+}
+
+template<class Key, class Value>
+uint64_t MerkleAVLNode<Key, Value>::getHash() const
+{
+    return hash_;
+}
+
+template<class Key, class Value>
+size_t MerkleAVLNode<Key, Value>::getCount() const
+{
+    return count_;
+}
+
+/**
+* Recomputes the subtree hash and count from the children's, which must
+* be up to date.
+*/
+template<class Key, class Value>
+void MerkleAVLNode<Key, Value>::recompute()
+{
+    MerkleAVLNode<Key, Value>* left = static_cast<MerkleAVLNode<Key, Value>*>(this->getLeft());
+    MerkleAVLNode<Key, Value>* right = static_cast<MerkleAVLNode<Key, Value>*>(this->getRight());
+    hash_ = itemHash_;
+    count_ = 1;
+    if(left != NULL){
+        hash_ += left->hash_;
+        count_ += left->count_;
+    }
+    if(right != NULL){
+        hash_ += right->hash_;
+        count_ += right->count_;
+    }
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the MerkleAVLNode class.
+  ----------------------------------------------
+*/
+
+/*
+  ------------------------------------------------
+  Begin implementations for the MerkleAVLTree class.
+  ------------------------------------------------
+*/
+
+template<class Key, class Value>
+MerkleAVLTree<Key, Value>::MerkleAVLTree()
+{
+
+}
+
+/**
+* Inserts or overwrites the key. An overwrite changes the item's hash,
+* so it is done here rather than in AVLTree::insert().
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    Node<Key, Value>* found = this->internalFind(new_item.first);
+    if(found == NULL){
+        AVLTree<Key, Value>::insert(new_item);
+        return;
+    }
+    found->setValue(new_item.second);
+    static_cast<MerkleAVLNode<Key, Value>*>(found)->setItemHash(itemHash(new_item.first, new_item.second));
+    moved_.clear();
+    refresh(found);
+}
+
+/**
+* Every removal has to go through unlinkNode() to keep the hashes
+* current, so eraseRange() may not cut the range out as a subtree.
+*/
+template<class Key, class Value>
+bool MerkleAVLTree<Key, Value>::erasesByNode() const
+{
+    return true;
+}
+
+/**
+* AVLTree::settleStep(), followed by rehashing the whole tree once the
+* rebuild finishes. The rebuild's rotations are not tracked, so the
+* hashes are only usable again after that. settle() and rebalance()
+* both finish here.
+*/
+template<class Key, class Value>
+bool MerkleAVLTree<Key, Value>::settleStep(size_t budget)
+{
+    bool wasSettled = this->isSettled();
+    bool settled = AVLTree<Key, Value>::settleStep(budget);
+    if(settled && !wasSettled){
+        rehashAll();
+    }
+    return settled;
+}
+
+/**
+* Throws std::logic_error when asked to turn tombstones on.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::setTombstoneMode(bool enable, double maxDeadFraction)
+{
+    if(enable){
+        throw std::logic_error("MerkleAVLTree: tombstone mode is not supported");
+    }
+    AVLTree<Key, Value>::setTombstoneMode(false, maxDeadFraction);
+}
+
+/**
+* Hash of the whole tree; equal trees have equal root hashes whatever
+* their shapes.
+*/
+template<class Key, class Value>
+uint64_t MerkleAVLTree<Key, Value>::rootHash() const
+{
+    return hashOf(this->root_);
+}
+
+/**
+* Number of keys in the range and the sum of their item hashes, in
+* O(log n): the two bounds' prefix sums, subtracted.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::rangeSummary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash) const
+{
+    count = countOf(this->root_);
+    hash = hashOf(this->root_);
+    if(range.hasHi){
+        below(range.hi, count, hash);
+    }
+    if(range.hasLo){
+        size_t loCount;
+        uint64_t loHash;
+        below(range.lo, loCount, loHash);
+        count -= loCount;
+        hash -= loHash;
+    }
+}
+
+/**
+* Sets mid to the key of rank count / 2 within the range (so both
+* halves [lo, mid) and [mid, hi) are non-empty) and returns true, or
+* returns false if the range holds fewer than two keys. O(log n).
+*/
+template<class Key, class Value>
+bool MerkleAVLTree<Key, Value>::rangeMedian(const MerkleRange<Key>& range, Key& mid) const
+{
+    size_t count;
+    uint64_t hash;
+    rangeSummary(range, count, hash);
+    if(count < 2){
+        return false;
+    }
+    size_t rank = count / 2;
+    if(range.hasLo){
+        size_t loCount;
+        uint64_t loHash;
+        below(range.lo, loCount, loHash);
+        rank += loCount;
+    }
+    // select the node of overall rank `rank` by subtree counts
+    Node<Key, Value>* n = this->root_;
+    for(;;){
+        size_t left = countOf(n->getLeft());
+        if(rank < left){
+            n = n->getLeft();
+        }
+        else if(rank == left){
+            mid = n->getKey();
+            return true;
+        }
+        else{
+            rank -= left + 1;
+            n = n->getRight();
+        }
+    }
+}
+
+/**
+* Appends the range's items to out in key order.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::rangeItems(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out) const
+{
+    Node<Key, Value>* curr = range.hasLo ? this->lowerBound(range.lo) : this->getSmallestNode();
+    for(; curr != NULL && (!range.hasHi || curr->getKey() < range.hi); curr = this->nextNode(curr)){
+        out.push_back(std::make_pair(curr->getKey(), curr->getValue()));
+    }
+}
+
+/**
+* Appends to out every key on which this tree and other disagree, in
+* key order, and returns the number of ranges compared.
+*/
+template<class Key, class Value>
+size_t MerkleAVLTree<Key, Value>::diff(const MerkleAVLTree& other, std::vector<MerkleDelta<Key, Value> >& out) const
+{
+    MerkleTreePeer<Key, Value> peer(other);
+    return diff(peer, out);
+}
+
+template<class Key, class Value>
+size_t MerkleAVLTree<Key, Value>::diff(MerklePeer<Key, Value>& peer, std::vector<MerkleDelta<Key, Value> >& out) const
+{
+    return diffRange(peer, MerkleRange<Key>(), out);
+}
+
+/**
+* Makes this tree equal to the peer's, changing only the keys that
+* differ. Returns the number of keys changed.
+*/
+template<class Key, class Value>
+size_t MerkleAVLTree<Key, Value>::syncFrom(MerklePeer<Key, Value>& peer)
+{
+    std::vector<MerkleDelta<Key, Value> > deltas;
+    diff(peer, deltas);
+    for(size_t i = 0; i < deltas.size(); i++){
+        if(deltas[i].kind == MerkleDelta<Key, Value>::ONLY_HERE){
+            this->remove(deltas[i].key);
+        }
+        else{
+            insert(std::make_pair(deltas[i].key, deltas[i].theirs));
+        }
+    }
+    return deltas.size();
+}
+
+/**
+* Hash of one item: FNV-1a of its LogCodec encoding, with a splitmix64
+* finish so that sums of hashes of similar items do not cancel out.
+*/
+template<class Key, class Value>
+uint64_t MerkleAVLTree<Key, Value>::itemHash(const Key& key, const Value& value)
+{
+    std::string bytes;
+    LogCodec<Key>::write(key, bytes);
+    LogCodec<Value>::write(value, bytes);
+    uint64_t h = mappedChecksum(bytes.data(), bytes.size());
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+template<class Key, class Value>
+AVLNode<Key,Value>* MerkleAVLTree<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent)
+{
+    return new MerkleAVLNode<Key, Value>(key, value, parent);
+}
+
+/**
+* Only Merkle nodes carry the hashes.
+*/
+template<class Key, class Value>
+bool MerkleAVLTree<Key, Value>::acceptsNode(Node<Key,Value>* n) const
+{
+    return typeid(*n) == typeid(MerkleAVLNode<Key, Value>);
+}
+
+/**
+* Links n in through AVLTree, then rehashes the nodes its fix-up rotated
+* and the path from n to the root. The item hash is recomputed here
+* rather than in createNode() since a node handle may carry a changed
+* value.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::linkNode(Node<Key,Value>* parent, Node<Key,Value>* n)
+{
+    MerkleAVLNode<Key, Value>* m = static_cast<MerkleAVLNode<Key, Value>*>(n);
+    m->setItemHash(itemHash(n->getKey(), n->getValue()));
+    moved_.clear();
+    AVLTree<Key, Value>::linkNode(parent, n);
+    refresh(n);
+}
+
+/**
+* Unlinks n through AVLTree, then rehashes from the place it left. n
+* keeps its old parent link, which (after the swap with its predecessor,
+* if any) is the node it was physically unlinked from.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::unlinkNode(Node<Key,Value>* n)
+{
+    moved_.clear();
+    AVLTree<Key, Value>::unlinkNode(n);
+    refresh(n->getParent());
+}
+
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::noteRelinked(Node<Key,Value>* n)
+{
+    AVLTree<Key, Value>::noteRelinked(n);
+    moved_.push_back(n);
+}
+
+/**
+* Rehashes after one update: first the rotated nodes, in the order they
+* were rotated (each rotation leaves the nodes it records below the ones
+* recorded after them), then every node from `from` up to the root.
+* Rotated nodes off that path have untouched children, and those on it
+* are redone on the way up.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::refresh(Node<Key,Value>* from)
+{
+    for(size_t i = 0; i < moved_.size(); i++){
+        static_cast<MerkleAVLNode<Key, Value>*>(moved_[i])->recompute();
+    }
+    moved_.clear();
+    for(Node<Key, Value>* curr = from; curr != NULL; curr = curr->getParent()){
+        static_cast<MerkleAVLNode<Key, Value>*>(curr)->recompute();
+    }
+}
+
+/**
+* Recomputes every subtree hash in one post-order walk, O(n).
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::rehashAll()
+{
+    moved_.clear();
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* prev = NULL;
+    while(curr != NULL){
+        if(prev == curr->getParent()){
+            // coming down: visit the left subtree first
+            prev = curr;
+            if(curr->getLeft() != NULL){
+                curr = curr->getLeft();
+            }
+            else if(curr->getRight() != NULL){
+                curr = curr->getRight();
+            }
+            else{
+                static_cast<MerkleAVLNode<Key, Value>*>(curr)->recompute();
+                curr = curr->getParent();
+            }
+        }
+        else if(prev == curr->getLeft() && curr->getRight() != NULL){
+            prev = curr;
+            curr = curr->getRight();
+        }
+        else{
+            static_cast<MerkleAVLNode<Key, Value>*>(curr)->recompute();
+            prev = curr;
+            curr = curr->getParent();
+        }
+    }
+}
+
+template<class Key, class Value>
+size_t MerkleAVLTree<Key, Value>::countOf(Node<Key,Value>* n)
+{
+    return (n == NULL) ? 0 : static_cast<MerkleAVLNode<Key, Value>*>(n)->getCount();
+}
+
+template<class Key, class Value>
+uint64_t MerkleAVLTree<Key, Value>::hashOf(Node<Key,Value>* n)
+{
+    return (n == NULL) ? 0 : static_cast<MerkleAVLNode<Key, Value>*>(n)->getHash();
+}
+
+/**
+* Count and hash sum of the keys below key, in one descent.
+*/
+template<class Key, class Value>
+void MerkleAVLTree<Key, Value>::below(const Key& key, size_t& count, uint64_t& hash) const
+{
+    count = 0;
+    hash = 0;
+    Node<Key, Value>* curr = this->root_;
+    while(curr != NULL){
+        if(curr->getKey() < key){
+            count += countOf(curr->getLeft()) + 1;
+            hash += hashOf(curr->getLeft()) + static_cast<MerkleAVLNode<Key, Value>*>(curr)->getItemHash();
+            curr = curr->getRight();
+        }
+        else{
+            curr = curr->getLeft();
+        }
+    }
+}
+
+/**
+* Compares one range with the peer, skipping it if the summaries match,
+* comparing items if it is small, and otherwise recursing on its halves
+* around the median key of whichever side holds more of it.
+*/
+template<class Key, class Value>
+size_t MerkleAVLTree<Key, Value>::diffRange(MerklePeer<Key, Value>& peer, const MerkleRange<Key>& range,
+                                            std::vector<MerkleDelta<Key, Value> >& out) const
+{
+    size_t mine, theirs;
+    uint64_t myHash, theirHash;
+    Key theirMid;
+    rangeSummary(range, mine, myHash);
+    bool theirHasMid = peer.summary(range, theirs, theirHash, theirMid);
+    if(mine == theirs && myHash == theirHash){
+        return 1;
+    }
+
+    if(mine + theirs <= LEAF_ITEMS){
+        std::vector<std::pair<Key, Value> > here, there;
+        rangeItems(range, here);
+        peer.items(range, there);
+        size_t i = 0, j = 0;
+        while(i < here.size() || j < there.size()){
+            MerkleDelta<Key, Value> delta;
+            if(j == there.size() || (i < here.size() && here[i].first < there[j].first)){
+                delta.kind = MerkleDelta<Key, Value>::ONLY_HERE;
+                delta.key = here[i++].first;
+                delta.theirs = Value();
+            }
+            else if(i == here.size() || there[j].first < here[i].first){
+                delta.kind = MerkleDelta<Key, Value>::ONLY_THERE;
+                delta.key = there[j].first;
+                delta.theirs = there[j++].second;
+            }
+            else{
+                bool same = itemHash(here[i].first, here[i].second) == itemHash(there[j].first, there[j].second);
+                i++;
+                if(same){
+                    j++;
+                    continue;
+                }
+                delta.kind = MerkleDelta<Key, Value>::CHANGED;
+                delta.key = there[j].first;
+                delta.theirs = there[j++].second;
+            }
+            out.push_back(delta);
+        }
+        return 1;
+    }
+
+    // with more than LEAF_ITEMS between them, the larger side has a median
+    Key mid = theirMid;
+    if(mine >= theirs || !theirHasMid){
+        rangeMedian(range, mid);
+    }
+    MerkleRange<Key> lower = range, upper = range;
+    lower.hasHi = true;
+    lower.hi = mid;
+    upper.hasLo = true;
+    upper.lo = mid;
+    size_t compared = 1 + diffRange(peer, lower, out);
+    return compared + diffRange(peer, upper, out);
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the MerkleAVLTree class.
+  ----------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the MerkleTreePeer class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+MerkleTreePeer<Key, Value>::MerkleTreePeer(const MerkleAVLTree<Key, Value>& tree) :
+    tree_(tree)
+{
+
+}
+
+template<class Key, class Value>
+bool MerkleTreePeer<Key, Value>::summary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash, Key& mid)
+{
+    tree_.rangeSummary(range, count, hash);
+    return count >= 2 && tree_.rangeMedian(range, mid);
+}
+
+template<class Key, class Value>
+void MerkleTreePeer<Key, Value>::items(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out)
+{
+    tree_.rangeItems(range, out);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the MerkleTreePeer class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the Merkle pipe protocol.
+  -------------------------------------------------------
+*/
+
+/**
+* Writes all of data, retrying short writes. Throws std::runtime_error.
+*/
+inline void merkleWriteAll(int fd, const std::string& data)
+{
+    size_t done = 0;
+    while(done < data.size()){
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if(n <= 0){
+            throw std::runtime_error("MerkleAVLTree: pipe write failed");
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+/**
+* Reads one frame's payload into out. Returns false on a clean end of
+* file before the frame; throws std::runtime_error on a cut-off frame.
+*/
+inline bool merkleReadFrame(int fd, std::string& out)
+{
+    uint32_t len;
+    size_t done = 0;
+    char* p = reinterpret_cast<char*>(&len);
+    while(done < sizeof(len)){
+        ssize_t n = ::read(fd, p + done, sizeof(len) - done);
+        if(n <= 0){
+            if(n == 0 && done == 0){
+                return false;
+            }
+            throw std::runtime_error("MerkleAVLTree: pipe read failed");
+        }
+        done += static_cast<size_t>(n);
+    }
+    out.resize(len);
+    done = 0;
+    while(done < len){
+        ssize_t n = ::read(fd, &out[done], len - done);
+        if(n <= 0){
+            throw std::runtime_error("MerkleAVLTree: pipe read failed");
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+* Sends payload as one frame.
+*/
+inline void merkleWriteFrame(int fd, const std::string& payload)
+{
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    std::string frame(reinterpret_cast<const char*>(&len), sizeof(len));
+    frame.append(payload);
+    merkleWriteAll(fd, frame);
+}
+
+template <typename Key>
+void merkleWriteRange(const MerkleRange<Key>& range, std::string& out)
+{
+    out.push_back(static_cast<char>((range.hasLo ? 1 : 0) | (range.hasHi ? 2 : 0)));
+    if(range.hasLo){
+        LogCodec<Key>::write(range.lo, out);
+    }
+    if(range.hasHi){
+        LogCodec<Key>::write(range.hi, out);
+    }
+}
+
+template <typename Key>
+bool merkleReadRange(const char*& p, const char* end, MerkleRange<Key>& range)
+{
+    if(p >= end){
+        return false;
+    }
+    unsigned char bounds = static_cast<unsigned char>(*p++);
+    range.hasLo = (bounds & 1) != 0;
+    range.hasHi = (bounds & 2) != 0;
+    return (!range.hasLo || LogCodec<Key>::read(p, end, range.lo)) &&
+           (!range.hasHi || LogCodec<Key>::read(p, end, range.hi));
+}
+
+/**
+* Answers a MerklePipePeer's requests about tree, reading from inFd and
+* writing to outFd, until it sends 'Q' or closes its end. Returns the
+* number of requests answered. The tree must not change meanwhile.
+*/
+template <typename Key, typename Value>
+size_t serveMerkle(const MerkleAVLTree<Key, Value>& tree, int inFd, int outFd)
+{
+    std::string request, reply;
+    size_t served = 0;
+    while(merkleReadFrame(inFd, request)){
+        const char* p = request.data();
+        const char* end = p + request.size();
+        MerkleRange<Key> range;
+        if(p == end || *p == 'Q'){
+            break;
+        }
+        char op = *p++;
+        if(!merkleReadRange(p, end, range)){
+            throw std::runtime_error("MerkleAVLTree: bad request");
+        }
+        reply.clear();
+        if(op == 'S'){
+            uint64_t count;
+            size_t n;
+            uint64_t hash;
+            Key mid;
+            tree.rangeSummary(range, n, hash);
+            count = n;
+            bool hasMid = tree.rangeMedian(range, mid);
+            LogCodec<uint64_t>::write(count, reply);
+            LogCodec<uint64_t>::write(hash, reply);
+            reply.push_back(static_cast<char>(hasMid ? 1 : 0));
+            if(hasMid){
+                LogCodec<Key>::write(mid, reply);
+            }
+        }
+        else if(op == 'I'){
+            std::vector<std::pair<Key, Value> > items;
+            tree.rangeItems(range, items);
+            uint64_t n = items.size();
+            LogCodec<uint64_t>::write(n, reply);
+            for(size_t i = 0; i < items.size(); i++){
+                LogCodec<Key>::write(items[i].first, reply);
+                LogCodec<Value>::write(items[i].second, reply);
+            }
+        }
+        else{
+            throw std::runtime_error("MerkleAVLTree: bad request");
+        }
+        merkleWriteFrame(outFd, reply);
+        served++;
+    }
+    return served;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the Merkle pipe protocol.
+  -----------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the MerklePipePeer class.
+  -------------------------------------------------
+*/
+
+/**
+* Talks to serveMerkle() by writing requests to outFd and reading
+* replies from inFd. The descriptors stay owned by the caller.
+*/
+template<class Key, class Value>
+MerklePipePeer<Key, Value>::MerklePipePeer(int inFd, int outFd) :
+    inFd_(inFd), outFd_(outFd), open_(true), sent_(0), received_(0)
+{
+
+}
+
+/**
+* Tells the server to stop, if close() has not been called.
+*/
+template<class Key, class Value>
+MerklePipePeer<Key, Value>::~MerklePipePeer()
+{
+    try{
+        close();
+    }
+    catch(const std::exception&){
+    }
+}
+
+template<class Key, class Value>
+bool MerklePipePeer<Key, Value>::summary(const MerkleRange<Key>& range, size_t& count, uint64_t& hash, Key& mid)
+{
+    buffer_.assign(1, 'S');
+    merkleWriteRange(range, buffer_);
+    merkleWriteFrame(outFd_, buffer_);
+    sent_ += buffer_.size() + sizeof(uint32_t);
+    if(!merkleReadFrame(inFd_, buffer_)){
+        throw std::runtime_error("MerkleAVLTree: peer closed the pipe");
+    }
+    received_ += buffer_.size() + sizeof(uint32_t);
+
+    const char* p = buffer_.data();
+    const char* end = p + buffer_.size();
+    uint64_t n;
+    if(!LogCodec<uint64_t>::read(p, end, n) || !LogCodec<uint64_t>::read(p, end, hash) || p == end){
+        throw std::runtime_error("MerkleAVLTree: bad reply");
+    }
+    count = static_cast<size_t>(n);
+    bool hasMid = (*p++ != 0);
+    if(hasMid && !LogCodec<Key>::read(p, end, mid)){
+        throw std::runtime_error("MerkleAVLTree: bad reply");
+    }
+    return hasMid;
+}
+
+template<class Key, class Value>
+void MerklePipePeer<Key, Value>::items(const MerkleRange<Key>& range, std::vector<std::pair<Key, Value> >& out)
+{
+    buffer_.assign(1, 'I');
+    merkleWriteRange(range, buffer_);
+    merkleWriteFrame(outFd_, buffer_);
+    sent_ += buffer_.size() + sizeof(uint32_t);
+    if(!merkleReadFrame(inFd_, buffer_)){
+        throw std::runtime_error("MerkleAVLTree: peer closed the pipe");
+    }
+    received_ += buffer_.size() + sizeof(uint32_t);
+
+    const char* p = buffer_.data();
+    const char* end = p + buffer_.size();
+    uint64_t n;
+    if(!LogCodec<uint64_t>::read(p, end, n)){
+        throw std::runtime_error("MerkleAVLTree: bad reply");
+    }
+    for(uint64_t i = 0; i < n; i++){
+        Key key;
+        Value value;
+        if(!LogCodec<Key>::read(p, end, key) || !LogCodec<Value>::read(p, end, value)){
+            throw std::runtime_error("MerkleAVLTree: bad reply");
+        }
+        out.push_back(std::make_pair(key, value));
+    }
+}
+
+/**
+* Sends 'Q' so the server returns. Further requests are not allowed.
+*/
+template<class Key, class Value>
+void MerklePipePeer<Key, Value>::close()
+{
+    if(open_){
+        open_ = false;
+        merkleWriteFrame(outFd_, std::string(1, 'Q'));
+    }
+}
+
+template<class Key, class Value>
+uint64_t MerklePipePeer<Key, Value>::bytesSent() const
+{
+    return sent_;
+}
+
+template<class Key, class Value>
+uint64_t MerklePipePeer<Key, Value>::bytesReceived() const
+{
+    return received_;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the MerklePipePeer class.
+  -----------------------------------------------
+*/
+
+#endif
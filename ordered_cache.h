@@ -0,0 +1,540 @@
+#ifndef ORDERED_CACHE_H
+#define ORDERED_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include "avlbst.h"
+
+/**
+* Which entry an OrderedCache evicts when it is full: the least recently
+* used one, or the least frequently used one (the least recently used
+* among those tied for the lowest use count).
+*/
+enum CachePolicy { CACHE_LRU, CACHE_LFU };
+
+/**
+* Counters kept by an OrderedCache. Hits and misses count find() calls.
+*/
+struct CacheStats
+{
+    CacheStats() : hits(0), misses(0), evictions(0) { }
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+template <typename Key, typename Value>
+class OrderedCache;
+
+template <typename Key, typename Value>
+class CacheNode;
+
+/**
+* The entries used the same number of times, most recent first. Buckets
+* form a list in increasing order of uses; an LRU cache has only one.
+*/
+template <typename Key, typename Value>
+struct CacheBucket
+{
+    size_t uses;
+    CacheNode<Key, Value>* newest;
+    CacheNode<Key, Value>* oldest;
+    CacheBucket* lower;
+    CacheBucket* higher;
+};
+
+/**
+* An AVL node that also sits in its cache's eviction order.
+*/
+template <typename Key, typename Value>
+class CacheNode : public AVLNode<Key, Value>
+{
+public:
+    CacheNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    virtual ~CacheNode();
+
+protected:
+    friend class OrderedCache<Key, Value>;
+
+    CacheNode* newer_;
+    CacheNode* older_;
+    CacheBucket<Key, Value>* bucket_;
+};
+
+/**
+* An AVLTree with a capacity, used as an ordered cache. Every node is
+* also linked into the eviction order (see CachePolicy), so one
+* allocation per entry serves lookups, ordered scans and eviction, and
+* touching an entry or evicting one costs O(1) on top of the tree work.
+*
+* find() counts as a use of the entry and updates the hit and miss
+* counters; peek(), seek(), operator[] and iteration do neither.
+* Inserting a new key into a full cache first evicts the entry the
+* policy picks, calling the eviction callback (if set) with its key and
+* value; the callback must not modify the cache. Overwriting an
+* existing key counts as a use of it.
+*/
+template <typename Key, typename Value>
+class OrderedCache : public AVLTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+    typedef typename BinarySearchTree<Key, Value>::node_type node_type;
+    typedef std::function<void(const Key&, const Value&)> EvictionCallback;
+
+    explicit OrderedCache(size_t capacity, CachePolicy policy = CACHE_LRU);
+    virtual ~OrderedCache();
+
+    using AVLTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& new_item);
+    std::pair<iterator, bool> insert(node_type&& handle);
+    virtual void clear();
+    virtual void setTombstoneMode(bool enable, double maxDeadFraction = 0.25);
+
+    iterator find(const Key& key);
+    iterator peek(const Key& key) const;
+    iterator seek(const Key& key) const;
+    iterator victim() const;
+
+    size_t capacity() const;
+    void setCapacity(size_t capacity);
+    CachePolicy policy() const;
+    void setEvictionCallback(const EvictionCallback& callback);
+    CacheStats stats() const;
+    void resetStats();
+
+protected:
+    virtual AVLNode<Key,Value>* createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent);
+    virtual bool acceptsNode(Node<Key,Value>* n) const;
+    virtual void linkNode(Node<Key,Value>* parent, Node<Key,Value>* n);
+    virtual void unlinkNode(Node<Key,Value>* n);
+    virtual bool erasesByNode() const;
+
+    void touch(CacheNode<Key, Value>* n);
+    void evict();
+    void pushNewest(CacheBucket<Key, Value>* b, CacheNode<Key, Value>* n);
+    void detach(CacheNode<Key, Value>* n);
+    CacheBucket<Key, Value>* bucketAfter(CacheBucket<Key, Value>* lower, size_t uses);
+    void freeBuckets();
+
+    size_t capacity_;
+    CachePolicy policy_;
+    EvictionCallback onEvict_;
+    CacheStats stats_;
+    CacheBucket<Key, Value>* lowest_;  // the bucket evicted from
+    CacheBucket<Key, Value>* spare_;   // emptied buckets, kept for reuse
+};
+
+/*
+  --------------------------------------------
+  Begin implementations for the CacheNode class.
+  --------------------------------------------
+*/
+
+template<class Key, class Value>
+CacheNode<Key, Value>::CacheNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(key, value, parent), newer_(NULL), older_(NULL), bucket_(NULL)
+{
+
+}
+
+template<class Key, class Value>
+CacheNode<Key, Value>::~CacheNode()
+{
+
+}
+
+/*
+  ------------------------------------------
+  End implementations for the CacheNode class.
+  ------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the OrderedCache class.
+  -----------------------------------------------
+*/
+
+/**
+* Makes an empty cache holding at most capacity entries. Throws
+* std::invalid_argument if capacity is 0.
+*/
+template<class Key, class Value>
+OrderedCache<Key, Value>::OrderedCache(size_t capacity, CachePolicy policy) :
+    capacity_(capacity), policy_(policy), lowest_(NULL), spare_(NULL)
+{
+    if(capacity == 0){
+        throw std::invalid_argument("OrderedCache: capacity must be positive");
+    }
+}
+
+/**
+* The base destructor frees the nodes; the buckets are freed here.
+*/
+template<class Key, class Value>
+OrderedCache<Key, Value>::~OrderedCache()
+{
+    freeBuckets();
+}
+
+/**
+* Overwrites and touches an existing key, or inserts a new one after
+* evicting an entry if the cache is full.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    Node<Key, Value>* found = this->internalFind(new_item.first);
+    if(found != NULL){
+        found->setValue(new_item.second);
+        touch(static_cast<CacheNode<Key, Value>*>(found));
+        return;
+    }
+    if(this->size() >= capacity_){
+        evict();
+    }
+    AVLTree<Key, Value>::insert(new_item);
+}
+
+/**
+* As BinarySearchTree::insert(node_type&&), evicting an entry first if
+* the key is new and the cache is full.
+*/
+template<class Key, class Value>
+std::pair<typename OrderedCache<Key, Value>::iterator, bool>
+OrderedCache<Key, Value>::insert(node_type&& handle)
+{
+    if(!handle.empty() && this->size() >= capacity_ && this->internalFind(handle.key()) == NULL){
+        evict();
+    }
+    return BinarySearchTree<Key, Value>::insert(std::move(handle));
+}
+
+/**
+* Each removed key also has to leave the eviction order in unlinkNode(),
+* so eraseRange() goes node by node.
+*/
+template<class Key, class Value>
+bool OrderedCache<Key, Value>::erasesByNode() const
+{
+    return true;
+}
+
+/**
+* Empties the cache without calling the eviction callback.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::clear()
+{
+    AVLTree<Key, Value>::clear();
+    freeBuckets();
+}
+
+/**
+* Throws std::logic_error when asked to turn tombstones on, since a
+* tombstone would still hold its place in the eviction order.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::setTombstoneMode(bool enable, double maxDeadFraction)
+{
+    if(enable){
+        throw std::logic_error("OrderedCache: tombstone mode is not supported");
+    }
+    AVLTree<Key, Value>::setTombstoneMode(false, maxDeadFraction);
+}
+
+/**
+* Looks the key up as a use of its entry: a hit touches the entry and a
+* miss returns end().
+*/
+template<class Key, class Value>
+typename OrderedCache<Key, Value>::iterator
+OrderedCache<Key, Value>::find(const Key& key)
+{
+    Node<Key, Value>* found = this->internalFind(key);
+    if(found == NULL){
+        stats_.misses++;
+        return this->end();
+    }
+    stats_.hits++;
+    touch(static_cast<CacheNode<Key, Value>*>(found));
+    return this->makeIterator(found);
+}
+
+/**
+* Looks the key up without touching it or counting a hit or miss.
+*/
+template<class Key, class Value>
+typename OrderedCache<Key, Value>::iterator
+OrderedCache<Key, Value>::peek(const Key& key) const
+{
+    return this->makeIterator(this->internalFind(key));
+}
+
+/**
+* Returns an iterator to the first entry whose key is not less than key,
+* or end(), for scanning a key range in order.
+*/
+template<class Key, class Value>
+typename OrderedCache<Key, Value>::iterator
+OrderedCache<Key, Value>::seek(const Key& key) const
+{
+    return this->makeIterator(this->lowerBound(key));
+}
+
+/**
+* The entry the next eviction would remove, or end() if empty.
+*/
+template<class Key, class Value>
+typename OrderedCache<Key, Value>::iterator
+OrderedCache<Key, Value>::victim() const
+{
+    return this->makeIterator((lowest_ != NULL) ? lowest_->oldest : NULL);
+}
+
+template<class Key, class Value>
+size_t OrderedCache<Key, Value>::capacity() const
+{
+    return capacity_;
+}
+
+/**
+* Changes the capacity, evicting entries until the cache fits. Throws
+* std::invalid_argument if capacity is 0.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::setCapacity(size_t capacity)
+{
+    if(capacity == 0){
+        throw std::invalid_argument("OrderedCache: capacity must be positive");
+    }
+    capacity_ = capacity;
+    while(this->size() > capacity_){
+        evict();
+    }
+}
+
+template<class Key, class Value>
+CachePolicy OrderedCache<Key, Value>::policy() const
+{
+    return policy_;
+}
+
+template<class Key, class Value>
+void OrderedCache<Key, Value>::setEvictionCallback(const EvictionCallback& callback)
+{
+    onEvict_ = callback;
+}
+
+template<class Key, class Value>
+CacheStats OrderedCache<Key, Value>::stats() const
+{
+    return stats_;
+}
+
+template<class Key, class Value>
+void OrderedCache<Key, Value>::resetStats()
+{
+    stats_ = CacheStats();
+}
+
+template<class Key, class Value>
+AVLNode<Key,Value>* OrderedCache<Key, Value>::createNode(const Key& key, const Value& value, AVLNode<Key,Value>* parent)
+{
+    return new CacheNode<Key, Value>(key, value, parent);
+}
+
+/**
+* Only cache nodes carry the eviction links.
+*/
+template<class Key, class Value>
+bool OrderedCache<Key, Value>::acceptsNode(Node<Key,Value>* n) const
+{
+    return typeid(*n) == typeid(CacheNode<Key, Value>);
+}
+
+/**
+* Links n in through AVLTree and makes it the newest entry used once.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::linkNode(Node<Key,Value>* parent, Node<Key,Value>* n)
+{
+    AVLTree<Key, Value>::linkNode(parent, n);
+    CacheBucket<Key, Value>* b = lowest_;
+    if(b == NULL || b->uses != 1){
+        b = bucketAfter(NULL, 1);
+    }
+    pushNewest(b, static_cast<CacheNode<Key, Value>*>(n));
+}
+
+/**
+* Unlinks n through AVLTree and takes it out of the eviction order.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::unlinkNode(Node<Key,Value>* n)
+{
+    AVLTree<Key, Value>::unlinkNode(n);
+    detach(static_cast<CacheNode<Key, Value>*>(n));
+}
+
+/**
+* Records a use of n: it becomes the newest entry of its bucket (LRU)
+* or moves up to the bucket for one more use (LFU).
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::touch(CacheNode<Key, Value>* n)
+{
+    CacheBucket<Key, Value>* b = n->bucket_;
+    if(policy_ == CACHE_LRU){
+        if(b->newest == n){
+            return;
+        }
+        n->newer_->older_ = n->older_;
+        if(n->older_ != NULL){
+            n->older_->newer_ = n->newer_;
+        }
+        else{
+            b->oldest = n->newer_;
+        }
+        n->newer_ = NULL;
+        n->older_ = b->newest;
+        b->newest->newer_ = n;
+        b->newest = n;
+        return;
+    }
+    CacheBucket<Key, Value>* up = b->higher;
+    if(up == NULL || up->uses != b->uses + 1){
+        up = bucketAfter(b, b->uses + 1);
+    }
+    detach(n);
+    pushNewest(up, n);
+}
+
+/**
+* Removes the entry the policy picks, after passing it to the callback.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::evict()
+{
+    if(lowest_ == NULL){
+        return;
+    }
+    CacheNode<Key, Value>* n = lowest_->oldest;
+    if(onEvict_){
+        onEvict_(n->getKey(), n->getValue());
+    }
+    stats_.evictions++;
+    this->removeNode(n);
+}
+
+template<class Key, class Value>
+void OrderedCache<Key, Value>::pushNewest(CacheBucket<Key, Value>* b, CacheNode<Key, Value>* n)
+{
+    n->bucket_ = b;
+    n->newer_ = NULL;
+    n->older_ = b->newest;
+    if(b->newest != NULL){
+        b->newest->newer_ = n;
+    }
+    else{
+        b->oldest = n;
+    }
+    b->newest = n;
+}
+
+/**
+* Takes n out of its bucket, retiring the bucket if that empties it.
+*/
+template<class Key, class Value>
+void OrderedCache<Key, Value>::detach(CacheNode<Key, Value>* n)
+{
+    CacheBucket<Key, Value>* b = n->bucket_;
+    if(n->newer_ != NULL){
+        n->newer_->older_ = n->older_;
+    }
+    else{
+        b->newest = n->older_;
+    }
+    if(n->older_ != NULL){
+        n->older_->newer_ = n->newer_;
+    }
+    else{
+        b->oldest = n->newer_;
+    }
+    n->newer_ = NULL;
+    n->older_ = NULL;
+    n->bucket_ = NULL;
+    if(b->newest != NULL){
+        return;
+    }
+    if(b->lower != NULL){
+        b->lower->higher = b->higher;
+    }
+    else{
+        lowest_ = b->higher;
+    }
+    if(b->higher != NULL){
+        b->higher->lower = b->lower;
+    }
+    b->higher = spare_;
+    spare_ = b;
+}
+
+/**
+* Returns a new empty bucket for the given use count, placed right
+* after lower (or first if lower is NULL).
+*/
+template<class Key, class Value>
+CacheBucket<Key, Value>* OrderedCache<Key, Value>::bucketAfter(CacheBucket<Key, Value>* lower, size_t uses)
+{
+    CacheBucket<Key, Value>* b = spare_;
+    if(b != NULL){
+        spare_ = b->higher;
+    }
+    else{
+        b = new CacheBucket<Key, Value>;
+    }
+    b->uses = uses;
+    b->newest = NULL;
+    b->oldest = NULL;
+    b->lower = lower;
+    b->higher = (lower != NULL) ? lower->higher : lowest_;
+    if(b->higher != NULL){
+        b->higher->lower = b;
+    }
+    if(lower != NULL){
+        lower->higher = b;
+    }
+    else{
+        lowest_ = b;
+    }
+    return b;
+}
+
+template<class Key, class Value>
+void OrderedCache<Key, Value>::freeBuckets()
+{
+    CacheBucket<Key, Value>* lists[2] = { lowest_, spare_ };
+    for(int i = 0; i < 2; i++){
+        while(lists[i] != NULL){
+            CacheBucket<Key, Value>* next = lists[i]->higher;
+            delete lists[i];
+            lists[i] = next;
+        }
+    }
+    lowest_ = NULL;
+    spare_ = NULL;
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the OrderedCache class.
+  ---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,479 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <cstdint>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds a color to the base Node.
+* The color fits in padding at the end of Node, so an RBNode is no
+* bigger than a plain Node.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    virtual ~RBNode();
+
+    bool isRed() const;
+    void setRed(bool red);
+
+    // Redefined to return RBNodes, as in AVLNode.
+    virtual RBNode<Key, Value>* getParent() const override;
+    virtual RBNode<Key, Value>* getLeft() const override;
+    virtual RBNode<Key, Value>* getRight() const override;
+
+protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* New nodes start out red, as insertion expects.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(key, value, parent), red_(true)
+{
+
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return red_;
+}
+
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    red_ = red;
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getLeft() const
+{
+    return (this->flags_ & this->LEFT_THREAD) ? NULL : static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getRight() const
+{
+    return (this->flags_ & this->RIGHT_THREAD) ? NULL : static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+/**
+* A red-black tree. Heights are only bounded by 2*log2(n+1), a little
+* looser than AVL, but an insert rotates at most twice and a remove at
+* most three times, with color flips doing the rest of the repair.
+* Like the other trees, a node with two children is removed by swapping
+* it with its predecessor first.
+*/
+template <class Key, class Value>
+class RedBlackTree : public BinarySearchTree<Key, Value>
+{
+public:
+    using BinarySearchTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+    virtual size_t eraseRange(const Key& lo, const Key& hi);
+    virtual void rebalance();
+    virtual void setScapegoat(bool enable, double alpha = 0.7);
+    bool isValidRedBlack() const;
+
+protected:
+    virtual void nodeSwap(RBNode<Key,Value>* n1, RBNode<Key,Value>* n2);
+    virtual void linkNode(Node<Key,Value>* parent, Node<Key,Value>* n);
+    virtual void unlinkNode(Node<Key,Value>* n);
+    virtual bool acceptsNode(Node<Key,Value>* n) const;
+
+    static bool isRed(RBNode<Key, Value>* n);
+    RBNode<Key, Value>* getRBRoot() const;
+    void insertFix(RBNode<Key, Value>* n);
+    void removeFix(RBNode<Key, Value>* n);
+    int blackHeight(RBNode<Key, Value>* n) const;
+    void colorByDepth(RBNode<Key, Value>* n, int depth, int height);
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the RedBlackTree class.
+  ------------------------------------------------
+*/
+
+/**
+* Inserts the pair (overwriting the value of an existing key) and
+* restores the red-black rules.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    RBNode<Key, Value>* curr = getRBRoot();
+    RBNode<Key, Value>* parent = NULL;
+    while(curr != NULL){
+        parent = curr;
+        if(keyValuePair.first < curr->getKey()){
+            curr = curr->getLeft();
+        }
+        else if(curr->getKey() < keyValuePair.first){
+            curr = curr->getRight();
+        }
+        else{
+            curr->setValue(keyValuePair.second);
+            return;
+        }
+    }
+
+    linkNode(parent, new RBNode<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
+}
+
+/**
+* Links n as a red leaf under parent (or as the root) and restores the
+* red-black rules.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::linkNode(Node<Key,Value>* parent, Node<Key,Value>* n)
+{
+    RBNode<Key, Value>* newNode = static_cast<RBNode<Key, Value>*>(n);
+    newNode->setParent(parent);
+    newNode->setLeft(NULL);
+    newNode->setRight(NULL);
+    newNode->setRed(true);
+    if(parent == NULL){
+        this->root_ = newNode;
+    }
+    else if(newNode->getKey() < parent->getKey()){
+        parent->setLeft(newNode);
+    }
+    else{
+        parent->setRight(newNode);
+    }
+    this->noteInserted(newNode);
+    insertFix(newNode);
+}
+
+/**
+* Only red-black nodes carry a color, so only they can be linked in.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::acceptsNode(Node<Key,Value>* n) const
+{
+    return typeid(*n) == typeid(RBNode<Key, Value>);
+}
+
+/**
+* Removes the key if present. A node with two children first trades
+* places with its predecessor, so the node unlinked has at most one child.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* curr = this->internalFind(key);
+    if(curr != NULL){
+        this->removeNode(curr);
+    }
+}
+
+/**
+* Removes every key in [lo, hi). The base class's split and join would
+* not keep the colors valid, so this goes node by node.
+*/
+template<class Key, class Value>
+size_t RedBlackTree<Key, Value>::eraseRange(const Key& lo, const Key& hi)
+{
+    return this->eraseRangeByNode(lo, hi);
+}
+
+/**
+* Rebuilds the tree into a complete tree and colors it to match: only
+* the nodes on the bottom level are red, so every path has the same
+* number of black nodes. O(n).
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::rebalance()
+{
+    BinarySearchTree<Key, Value>::rebalance();
+    colorByDepth(getRBRoot(), 1, this->height());
+}
+
+/**
+* Throws std::logic_error when asked to turn the policy on: a scapegoat
+* rebuild would leave the colors invalid.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::setScapegoat(bool enable, double alpha)
+{
+    if(enable){
+        throw std::logic_error("RedBlackTree: the scapegoat policy is for the plain tree");
+    }
+    BinarySearchTree<Key, Value>::setScapegoat(false, alpha);
+}
+
+/**
+* Takes n out where it sits, without deleting it, as remove() does
+* after its search.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::unlinkNode(Node<Key,Value>* n)
+{
+    RBNode<Key, Value>* curr = static_cast<RBNode<Key, Value>*>(n);
+    if(curr->getLeft() != NULL && curr->getRight() != NULL){
+        nodeSwap(curr, static_cast<RBNode<Key, Value>*>(this->predecessor(curr)));
+    }
+
+    this->noteRemoving(curr);
+    RBNode<Key, Value>* child = (curr->getLeft() != NULL) ? curr->getLeft() : curr->getRight();
+    if(child != NULL){
+        // a lone child must be a red leaf under a black node
+        child->setRed(false);
+    }
+    else if(!curr->isRed()){
+        // removing a black leaf shortens its paths; repair while it is
+        // still in place so the fix-up has a node to start from
+        removeFix(curr);
+    }
+
+    RBNode<Key, Value>* parent = curr->getParent();
+    if(child != NULL){
+        child->setParent(parent);
+    }
+    if(parent == NULL){
+        this->root_ = child;
+    }
+    else if(curr == parent->getLeft()){
+        parent->setLeft(child);
+    }
+    else{
+        parent->setRight(child);
+    }
+}
+
+/**
+* Checks the red-black rules: a black root, no red node with a red
+* child, and the same number of black nodes on every root-to-leaf path.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isValidRedBlack() const
+{
+    RBNode<Key, Value>* root = getRBRoot();
+    if(isRed(root)){
+        return false;
+    }
+    return blackHeight(root) >= 0;
+}
+
+/**
+* Colors the nodes of a complete tree: red on the bottom level (unless
+* that is the root), black above it. Recursion depth is the height.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::colorByDepth(RBNode<Key, Value>* n, int depth, int height)
+{
+    if(n == NULL){
+        return;
+    }
+    n->setRed(depth == height && depth > 1);
+    colorByDepth(n->getLeft(), depth + 1, height);
+    colorByDepth(n->getRight(), depth + 1, height);
+}
+
+/**
+* Swaps two nodes' positions, and their colors with them.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::nodeSwap(RBNode<Key,Value>* n1, RBNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/**
+* Empty (NULL) children count as black.
+*/
+template<class Key, class Value>
+bool RedBlackTree<Key, Value>::isRed(RBNode<Key, Value>* n)
+{
+    return n != NULL && n->isRed();
+}
+
+template<class Key, class Value>
+RBNode<Key, Value>* RedBlackTree<Key, Value>::getRBRoot() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->root_);
+}
+
+/**
+* Repairs a red node n that may have a red parent. Recoloring moves the
+* problem two levels up; once the uncle is black, at most two rotations
+* finish the job.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::insertFix(RBNode<Key, Value>* n)
+{
+    while(isRed(n->getParent())){
+        RBNode<Key, Value>* p = n->getParent();
+        // p is red, so it is not the root and g exists
+        RBNode<Key, Value>* g = p->getParent();
+        if(p == g->getLeft()){
+            RBNode<Key, Value>* u = g->getRight();
+            if(isRed(u)){
+                p->setRed(false);
+                u->setRed(false);
+                g->setRed(true);
+                n = g;
+                continue;
+            }
+            if(n == p->getRight()){
+                // zig-zag: straighten into zig-zig first
+                this->rotateLeft(p);
+                n = p;
+                p = n->getParent();
+            }
+            p->setRed(false);
+            g->setRed(true);
+            this->rotateRight(g);
+        }
+        else{
+            RBNode<Key, Value>* u = g->getLeft();
+            if(isRed(u)){
+                p->setRed(false);
+                u->setRed(false);
+                g->setRed(true);
+                n = g;
+                continue;
+            }
+            if(n == p->getLeft()){
+                this->rotateRight(p);
+                n = p;
+                p = n->getParent();
+            }
+            p->setRed(false);
+            g->setRed(true);
+            this->rotateLeft(g);
+        }
+    }
+    getRBRoot()->setRed(false);
+}
+
+/**
+* Called on a black node n that is about to lose one black from every
+* path through it. Pushes the missing black up by recoloring siblings,
+* and ends with at most three rotations in total.
+*/
+template<class Key, class Value>
+void RedBlackTree<Key, Value>::removeFix(RBNode<Key, Value>* n)
+{
+    while(n->getParent() != NULL && !n->isRed()){
+        RBNode<Key, Value>* p = n->getParent();
+        if(n == p->getLeft()){
+            // n is short a black, so its sibling is a real node
+            RBNode<Key, Value>* s = p->getRight();
+            if(s->isRed()){
+                s->setRed(false);
+                p->setRed(true);
+                this->rotateLeft(p);
+                s = p->getRight();
+            }
+            if(!isRed(s->getLeft()) && !isRed(s->getRight())){
+                s->setRed(true);
+                n = p;
+                continue;
+            }
+            if(!isRed(s->getRight())){
+                s->getLeft()->setRed(false);
+                s->setRed(true);
+                this->rotateRight(s);
+                s = p->getRight();
+            }
+            s->setRed(p->isRed());
+            p->setRed(false);
+            s->getRight()->setRed(false);
+            this->rotateLeft(p);
+            n = getRBRoot();
+        }
+        else{
+            RBNode<Key, Value>* s = p->getLeft();
+            if(s->isRed()){
+                s->setRed(false);
+                p->setRed(true);
+                this->rotateRight(p);
+                s = p->getLeft();
+            }
+            if(!isRed(s->getLeft()) && !isRed(s->getRight())){
+                s->setRed(true);
+                n = p;
+                continue;
+            }
+            if(!isRed(s->getLeft())){
+                s->getRight()->setRed(false);
+                s->setRed(true);
+                this->rotateLeft(s);
+                s = p->getLeft();
+            }
+            s->setRed(p->isRed());
+            p->setRed(false);
+            s->getLeft()->setRed(false);
+            this->rotateRight(p);
+            n = getRBRoot();
+        }
+    }
+    n->setRed(false);
+}
+
+/**
+* Returns the number of black nodes on each path below n, or -1 if the
+* paths disagree or a red node has a red child.
+*/
+template<class Key, class Value>
+int RedBlackTree<Key, Value>::blackHeight(RBNode<Key, Value>* n) const
+{
+    if(n == NULL){
+        return 0;
+    }
+    if(n->isRed() && (isRed(n->getLeft()) || isRed(n->getRight()))){
+        return -1;
+    }
+    int left = blackHeight(n->getLeft());
+    int right = blackHeight(n->getRight());
+    if(left < 0 || left != right){
+        return -1;
+    }
+    return left + (n->isRed() ? 0 : 1);
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the RedBlackTree class.
+  ----------------------------------------------
+*/
+
+#endif
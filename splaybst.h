@@ -0,0 +1,289 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include "bst.h"
+
+/**
+* A splay tree: every access rotates the accessed node up to the root,
+* so frequently used keys stay a few comparisons away from the top.
+* Uses plain Nodes since no balance information is kept.
+*
+* Splaying on reads rewrites links, which costs stores on every lookup.
+* setSplayPeriod(k) makes find() and operator[] splay only on every
+* k-th read; insert() and remove() always splay.
+*/
+template <class Key, class Value>
+class SplayTree : public BinarySearchTree<Key, Value>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value>::iterator iterator;
+
+    SplayTree();
+    using BinarySearchTree<Key, Value>::insert;
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+
+    // non-const lookups splay; the const ones from the base do not
+    using BinarySearchTree<Key, Value>::find;
+    using BinarySearchTree<Key, Value>::operator[];
+    iterator find(const Key& key);
+    Value& operator[](const Key& key);
+
+    void setSplayPeriod(unsigned period);
+    unsigned getSplayPeriod() const;
+    virtual void setScapegoat(bool enable, double alpha = 0.7);
+
+protected:
+    Node<Key, Value>* access(const Key& key);
+    void splay(Node<Key, Value>* n);
+    virtual void linkNode(Node<Key, Value>* parent, Node<Key, Value>* n);
+    virtual void unlinkNode(Node<Key, Value>* curr);
+
+    unsigned period_;
+    unsigned reads_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the SplayTree class.
+  ---------------------------------------------
+*/
+
+/**
+* Default constructor, which splays on every access.
+*/
+template<class Key, class Value>
+SplayTree<Key, Value>::SplayTree() :
+    period_(1), reads_(0)
+{
+
+}
+
+/**
+* Inserts or overwrites the key, then splays its node to the root.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* parent = NULL;
+    while(curr != NULL){
+        parent = curr;
+        if(keyValuePair.first < curr->getKey()){
+            curr = curr->getLeft();
+        }
+        else if(curr->getKey() < keyValuePair.first){
+            curr = curr->getRight();
+        }
+        else{
+            curr->setValue(keyValuePair.second);
+            splay(curr);
+            return;
+        }
+    }
+
+    linkNode(parent, new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
+}
+
+/**
+* Links n as a leaf under parent (or as the root) and splays it up.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::linkNode(Node<Key, Value>* parent, Node<Key, Value>* n)
+{
+    n->setParent(parent);
+    n->setLeft(NULL);
+    n->setRight(NULL);
+    if(parent == NULL){
+        this->root_ = n;
+    }
+    else if(n->getKey() < parent->getKey()){
+        parent->setLeft(n);
+    }
+    else{
+        parent->setRight(n);
+    }
+    this->noteInserted(n);
+    splay(n);
+}
+
+/**
+* Splays the key's node to the root and removes it by joining its two
+* subtrees: the largest node on the left is splayed to the top of the
+* left subtree, where it has no right child, and the right subtree hangs
+* off it. A missing key still splays the last node on its search path.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::remove(const Key& key)
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* last = NULL;
+    while(curr != NULL && !(curr->getKey() == key)){
+        last = curr;
+        curr = (key < curr->getKey()) ? curr->getLeft() : curr->getRight();
+    }
+    if(curr == NULL){
+        splay(last);
+        return;
+    }
+    this->removeNode(curr);
+}
+
+/**
+* Takes curr out by splaying it to the root and joining its subtrees.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::unlinkNode(Node<Key, Value>* curr)
+{
+    splay(curr);
+    this->noteRemoving(curr);
+    Node<Key, Value>* left = curr->getLeft();
+    Node<Key, Value>* right = curr->getRight();
+    if(left == NULL){
+        this->root_ = right;
+        if(right != NULL){
+            right->setParent(NULL);
+        }
+    }
+    else{
+        left->setParent(NULL);
+        this->root_ = left;
+        Node<Key, Value>* max = left;
+        while(max->getRight() != NULL){
+            max = max->getRight();
+        }
+        splay(max);
+        max->setRight(right);
+        if(right != NULL){
+            right->setParent(max);
+        }
+    }
+}
+
+/**
+* Returns an iterator to the key (or end()), splaying if this read is
+* one of the periodic ones.
+*/
+template<class Key, class Value>
+typename SplayTree<Key, Value>::iterator
+SplayTree<Key, Value>::find(const Key& key)
+{
+    return this->makeIterator(access(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value>
+Value& SplayTree<Key, Value>::operator[](const Key& key)
+{
+    Node<Key, Value>* curr = access(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* Makes reads splay only once every period calls (1 means every read).
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::setSplayPeriod(unsigned period)
+{
+    period_ = (period == 0) ? 1 : period;
+    reads_ = 0;
+}
+
+template<class Key, class Value>
+unsigned SplayTree<Key, Value>::getSplayPeriod() const
+{
+    return period_;
+}
+
+/**
+* Throws std::logic_error when asked to turn the policy on: splaying
+* already bounds the amortized cost, and a rebuild would undo the
+* recently-used shape the splays built.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::setScapegoat(bool enable, double alpha)
+{
+    if(enable){
+        throw std::logic_error("SplayTree: the scapegoat policy is for the plain tree");
+    }
+    BinarySearchTree<Key, Value>::setScapegoat(false, alpha);
+}
+
+/**
+* Shared read path: finds the key and, on every period-th read, splays
+* the node found (or the last node visited if the key is missing).
+*/
+template<class Key, class Value>
+Node<Key, Value>* SplayTree<Key, Value>::access(const Key& key)
+{
+    Node<Key, Value>* curr = this->root_;
+    Node<Key, Value>* last = NULL;
+    while(curr != NULL && !(curr->getKey() == key)){
+        last = curr;
+        curr = (key < curr->getKey()) ? curr->getLeft() : curr->getRight();
+    }
+    if(++reads_ >= period_){
+        reads_ = 0;
+        splay(curr != NULL ? curr : last);
+    }
+    return curr;
+}
+
+/**
+* Moves n to the root with zig, zig-zig and zig-zag steps.
+*/
+template<class Key, class Value>
+void SplayTree<Key, Value>::splay(Node<Key, Value>* n)
+{
+    if(n == NULL){
+        return;
+    }
+    while(n->getParent() != NULL){
+        Node<Key, Value>* p = n->getParent();
+        Node<Key, Value>* g = p->getParent();
+        bool nLeft = (n == p->getLeft());
+        if(g == NULL){
+            // zig
+            if(nLeft) this->rotateRight(p);
+            else this->rotateLeft(p);
+        }
+        else if(nLeft == (p == g->getLeft())){
+            // zig-zig: rotate the grandparent first
+            if(nLeft){
+                this->rotateRight(g);
+                this->rotateRight(p);
+            }
+            else{
+                this->rotateLeft(g);
+                this->rotateLeft(p);
+            }
+        }
+        else{
+            // zig-zag
+            if(nLeft){
+                this->rotateRight(p);
+                this->rotateLeft(g);
+            }
+            else{
+                this->rotateLeft(p);
+                this->rotateRight(g);
+            }
+        }
+    }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the SplayTree class.
+  -------------------------------------------
+*/
+
+#endif